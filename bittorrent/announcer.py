@@ -0,0 +1,527 @@
+#!/usr/bin/env python
+
+# Announces many torrents at once, on one epoll loop.  The announces to a
+# tracker host share one keep-alive HTTP/1.1 connection, on which up to
+# pipeline requests are sent before the answers come; each host has its own
+# rate limit and timeout, and a host that fails is tried again after a
+# backoff that doubles each time.  The peers of all answers go into one
+# table.
+#
+# LocalHTTPTracker is a stand-in HTTP tracker on the loopback interface, for
+# the tests.
+#
+# usage: announcer.py <torrent file> ...
+
+from sys import argv, exit
+from select import epoll, EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP
+from socket import socket, getaddrinfo, error, SOCK_STREAM, SOL_SOCKET, SO_ERROR, \
+    AF_INET, AF_INET6
+from errno import EINPROGRESS, EAGAIN, EWOULDBLOCK
+from collections import deque
+from time import time, sleep
+from threading import Thread
+from urlparse import urlsplit, parse_qs
+from urllib import urlencode
+from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+from SocketServer import ThreadingMixIn
+from cbencode import bdecode
+from bencode import bencode
+from peers import PeerTable, compact
+
+# one announce: the torrent, the path and query to get, and how often it
+# has been sent
+#
+class Request:
+    def __init__(self, meta, path):
+        self.meta = meta
+        self.path = path
+        self.tries = 0
+
+# the announces to one tracker host, and the connection they go on
+#
+class TrackerHost:
+    def __init__(self, announcer, host, port):
+        self.announcer = announcer
+        self.host = host
+        self.port = port
+        self.address = None
+        self.queue = deque()		# not sent yet
+        self.inflight = deque()		# sent, in order, no answer yet
+        self.sock = None
+        self.connected = False
+        self.outbuf = ''
+        self.inbuf = ''
+        self.active = 0			# last time the connection got anywhere
+        self.tokens = float(announcer.pipeline)
+        self.refilled = time()
+        self.failures = 0		# in a row
+        self.retry_at = 0
+
+    # does what is due at time now: gives up on a connection that is stuck,
+    # opens one if there is work, and sends what the rate limit allows
+    def pump(self, now):
+        a = self.announcer
+        if self.sock is not None and (self.inflight or not self.connected) and \
+                now - self.active > a.timeout:
+            self.fail("timeout")
+        if self.sock is None and self.queue and now >= self.retry_at:
+            self.open(now)
+        if not self.connected:
+            return
+        self.tokens = min(a.pipeline, self.tokens + (now - self.refilled) * a.rate)
+        self.refilled = now
+        while self.queue and len(self.inflight) < a.pipeline and self.tokens >= 1:
+            request = self.queue.popleft()
+            request.tries += 1
+            self.outbuf += 'GET %s HTTP/1.1\r\nHost: %s:%d\r\nAccept-Encoding: identity\r\n\r\n' % \
+                (request.path, self.host, self.port)
+            self.inflight.append(request)
+            self.tokens -= 1
+        if self.outbuf:
+            self.flush()
+
+    # seconds until pump() has something to do, at most 1
+    def wakeup(self, now):
+        a = self.announcer
+        wait = 1.0
+        if self.sock is not None and (self.inflight or not self.connected):
+            wait = min(wait, self.active + a.timeout - now)
+        if self.sock is None and self.queue:
+            wait = min(wait, self.retry_at - now)
+        if self.connected and self.queue and len(self.inflight) < a.pipeline and self.tokens < 1:
+            wait = min(wait, (1 - self.tokens) / a.rate)
+        return wait
+
+    def open(self, now):
+        try:
+            if self.address is None:
+                family, type, proto, name, self.address = \
+                    getaddrinfo(self.host, self.port, 0, SOCK_STREAM)[0]
+                self.family = family
+            self.sock = socket(self.family, SOCK_STREAM)
+            self.sock.setblocking(0)
+            err = self.sock.connect_ex(self.address)
+        except error as e:
+            self.sock = None
+            self.fail(str(e))
+            return
+        self.connected = False
+        self.active = now
+        self.announcer.register(self, EPOLLIN | EPOLLOUT)
+        if err != 0 and err != EINPROGRESS:
+            self.fail("connect failed")
+
+    def flush(self):
+        try:
+            sent = self.sock.send(self.outbuf)
+        except error as e:
+            if e.errno in (EAGAIN, EWOULDBLOCK):
+                return
+            self.fail(str(e))
+            return
+        self.outbuf = self.outbuf[sent:]
+        self.announcer.modify(self, self.outbuf and EPOLLIN | EPOLLOUT or EPOLLIN)
+
+    # what epoll says about the connection
+    def event(self, events):
+        if not self.connected:
+            if self.sock.getsockopt(SOL_SOCKET, SO_ERROR) != 0:
+                self.fail("connect failed")
+                return
+            self.connected = True
+            self.active = time()
+            self.announcer.modify(self, EPOLLIN)
+        if events & (EPOLLIN | EPOLLHUP | EPOLLERR):
+            try:
+                data = self.sock.recv(65536)
+            except error as e:
+                if e.errno not in (EAGAIN, EWOULDBLOCK):
+                    self.fail(str(e))
+                return
+            if not data:
+                self.parse(True)
+                self.close()
+                return
+            self.inbuf += data
+            self.active = time()
+            self.parse(False)
+        if self.sock is not None and events & EPOLLOUT and self.outbuf:
+            self.flush()
+
+    # hands over the answers in inbuf, in the order of the requests; eof is
+    # set when the tracker has closed the connection
+    def parse(self, eof):
+        while self.inflight:
+            end = self.inbuf.find('\r\n\r\n')
+            if end < 0:
+                return
+            lines = self.inbuf[:end].split('\r\n')
+            try:
+                status = int(lines[0].split()[1])
+            except (IndexError, ValueError):
+                self.fail("bad HTTP answer")
+                return
+            headers = {}
+            for line in lines[1:]:
+                name, colon, value = line.partition(':')
+                headers[name.strip().lower()] = value.strip().lower()
+            start = end + 4
+
+            # a length or chunk size that is not a number fails the
+            # connection, like a bad status line
+            try:
+                if headers.get('transfer-encoding', '').startswith('chunked'):
+                    chunked = dechunk(self.inbuf, start)
+                    if chunked is None:
+                        return
+                    body, end = chunked
+                elif headers.has_key('content-length'):
+                    end = start + int(headers['content-length'])
+                    if end < start:
+                        raise ValueError, "negative length"
+                    if len(self.inbuf) < end:
+                        return
+                    body = self.inbuf[start:end]
+                elif eof:
+                    body, end = self.inbuf[start:], len(self.inbuf)
+                else:
+                    return
+            except ValueError:
+                self.fail("bad HTTP answer")
+                return
+            self.inbuf = self.inbuf[end:]
+            self.failures = 0
+            self.announcer.finish(self.inflight.popleft(), status, body)
+            if headers.get('connection') == 'close':
+                self.close()
+                return
+
+    # closes the connection; what was sent on it and not answered goes
+    # first the next time
+    def close(self):
+        if self.sock is not None:
+            self.announcer.unregister(self)
+            self.sock.close()
+        self.sock = None
+        self.connected = False
+        self.outbuf = ''
+        self.inbuf = ''
+        a = self.announcer
+        while self.inflight:
+            request = self.inflight.pop()
+            if request.tries > a.retries:
+                a.fail(request, "no answer")
+            else:
+                self.queue.appendleft(request)
+
+    # the connection failed: close it, and give up on the host after
+    # retries failures in a row
+    def fail(self, reason):
+        self.close()
+        self.failures += 1
+        a = self.announcer
+        if self.failures > a.retries:
+            while self.queue:
+                a.fail(self.queue.popleft(), reason)
+            self.failures = 0
+        self.retry_at = time() + a.backoff * 2 ** (self.failures - 1)
+
+# the body of a chunked HTTP answer at start of data, and where it ends, or
+# None if it is not all there; ValueError if a chunk size is bad
+#
+def dechunk(data, start):
+    body = []
+    while True:
+        end = data.find('\r\n', start)
+        if end < 0:
+            return None
+        size = int(data[start:end].split(';')[0], 16)
+        if size < 0:
+            raise ValueError, "negative chunk size"
+        start = end + 2
+        if size == 0:
+            # no trailers
+            if len(data) < start + 2:
+                return None
+            return ''.join(body), start + 2
+        if len(data) < start + size + 2:
+            return None
+        body.append(data[start:start + size])
+        start += size + 2
+
+# announces torrents to their HTTP trackers; results maps each info hash to
+# the tracker's answer, as a dict with the peers as compact "peers" and
+# "peers6" strings (udp_tracker.compact_peers() decodes them), or to an
+# error string, and peers is the PeerTable of the peers of all answers
+#
+class Announcer:
+    def __init__(self, peer_id, port, pipeline = 8, rate = 20, timeout = 30, retries = 2,
+                 backoff = 1):
+        self.peer_id = peer_id
+        self.port = port
+        self.pipeline = pipeline	# requests sent ahead on a connection
+        self.rate = rate		# requests a second to one host
+        self.timeout = timeout		# seconds a connection may get nowhere
+        self.retries = retries
+        self.backoff = backoff		# seconds after the first failure
+        self.epoll = epoll()
+        self.hosts = {}			# (host, port) -> TrackerHost
+        self.by_fd = {}
+        self.results = {}
+        self.peers = PeerTable()
+        self.pending = 0
+
+    # queues an announce of meta, a FileMeta
+    def add(self, meta, event = 'started'):
+        url = urlsplit(meta.announce)
+        info_hash = meta.info_hash.digest()
+        if url.scheme != 'http' or not url.hostname:
+            self.results[info_hash] = "not an HTTP tracker"
+            return
+        query = urlencode([('info_hash', info_hash), ('peer_id', self.peer_id),
+                           ('port', self.port), ('uploaded', 0), ('downloaded', 0),
+                           ('left', meta.length), ('compact', 1), ('no_peer_id', 1),
+                           ('event', event)])
+        path = (url.path or '/') + '?' + (url.query and url.query + '&' or '') + query
+        key = (url.hostname, url.port or 80)
+        if not self.hosts.has_key(key):
+            self.hosts[key] = TrackerHost(self, url.hostname, url.port or 80)
+        self.hosts[key].queue.append(Request(meta, path))
+        self.pending += 1
+
+    # runs the loop until every announce is answered or given up on
+    def run(self):
+        while self.pending > 0:
+            now = time()
+            wait = 1.0
+            for host in self.hosts.values():
+                host.pump(now)
+                wait = min(wait, host.wakeup(now))
+            if self.pending == 0:
+                break
+            for fd, events in self.epoll.poll(max(wait, 0.001)):
+                host = self.by_fd.get(fd)
+                if host is not None:
+                    host.event(events)
+
+    def register(self, host, events):
+        self.by_fd[host.sock.fileno()] = host
+        self.epoll.register(host.sock.fileno(), events)
+
+    def modify(self, host, events):
+        self.epoll.modify(host.sock.fileno(), events)
+
+    def unregister(self, host):
+        self.epoll.unregister(host.sock.fileno())
+        del self.by_fd[host.sock.fileno()]
+
+    def finish(self, request, status, body):
+        if status != 200:
+            self.fail(request, "HTTP status %d" % status)
+            return
+        try:
+            response = bdecode(body)
+        except ValueError:
+            self.fail(request, "bad tracker answer")
+            return
+        if type(response) != dict:
+            self.fail(request, "bad tracker answer")
+            return
+        if response.has_key('failure reason'):
+            self.fail(request, "tracker failure: %s" % response['failure reason'])
+            return
+        peers, peers6 = response.get('peers', ''), response.get('peers6', '')
+        if type(peers) == list:
+            peers, more6 = compact(peers)
+            if type(peers6) == str:
+                peers6 += more6
+        if type(peers) != str or type(peers6) != str:
+            self.fail(request, "bad tracker answer")
+            return
+        response['peers'], response['peers6'] = peers, peers6
+        self.results[request.meta.info_hash.digest()] = response
+        now = int(time())
+        self.peers.add(peers, False, now)
+        self.peers.add(peers6, True, now)
+        self.pending -= 1
+
+    def fail(self, request, reason):
+        self.results[request.meta.info_hash.digest()] = reason
+        self.pending -= 1
+
+# the stand-in tracker's request handler; one lives as long as a connection
+#
+class LocalTrackerHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        BaseHTTPRequestHandler.setup(self)
+        self.served = 0
+        self.server.tracker.connections += 1
+
+    def do_GET(self):
+        tracker = self.server.tracker
+        tracker.requests += 1
+        self.served += 1
+        if tracker.delay:
+            sleep(tracker.delay)
+        if tracker.raw is not None:
+            self.wfile.write(tracker.raw)
+            self.close_connection = 1
+            return
+        query = parse_qs(urlsplit(self.path).query)
+        try:
+            info_hash = query['info_hash'][0]
+            peer = (self.client_address[0], int(query['port'][0]))
+            left = int(query['left'][0])
+            assert len(info_hash) == 20
+        except (KeyError, ValueError, AssertionError):
+            body = bencode({'failure reason': 'bad announce'})
+        else:
+            swarm = tracker.swarms.setdefault(info_hash, {})
+            if query.get('event') == ['stopped']:
+                swarm.pop(peer, None)
+            else:
+                swarm[peer] = left
+            seeders = len([p for p in swarm if swarm[p] == 0])
+            body = bencode({'interval': tracker.interval, 'complete': seeders,
+                            'incomplete': len(swarm) - seeders,
+                            'peers': ''.join([''.join([chr(int(b)) for b in ip.split('.')]) +
+                                              chr(port >> 8) + chr(port & 255)
+                                              for ip, port in swarm if (ip, port) != peer])})
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/plain')
+        self.send_header('Content-Length', str(len(body)))
+        if tracker.max_requests and self.served >= tracker.max_requests:
+            self.send_header('Connection', 'close')
+            self.close_connection = 1
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+# an HTTP tracker on the loopback interface, serving in a thread of its
+# own; it closes a connection after max_requests answers if that is set,
+# takes delay seconds over each answer, and counts connections and requests.
+# If raw is set, it is sent as the whole answer instead, status line and
+# all
+#
+class LocalHTTPTracker(Thread):
+    def __init__(self, interval = 1800, max_requests = 0, delay = 0):
+        Thread.__init__(self)
+        self.daemon = True
+        self.server = ThreadingHTTPServer(('127.0.0.1', 0), LocalTrackerHandler)
+        self.server.tracker = self
+        self.port = self.server.server_address[1]
+        self.interval = interval
+        self.max_requests = max_requests
+        self.delay = delay
+        self.raw = None
+        self.swarms = {}	# info hash -> {(ip, port): bytes left}
+        self.connections = 0
+        self.requests = 0
+        self.start()
+
+    def run(self):
+        self.server.serve_forever(0.05)
+
+    def stop(self):
+        self.server.shutdown()
+        self.server.server_close()
+
+def test_dechunk():
+    assert dechunk('HTTP\r\n\r\n4\r\nabcd\r\n2;x\r\nef\r\n0\r\n\r\nmore', 8) == ('abcdef', 31)
+    assert dechunk('4\r\nabcd\r\n0\r\n', 0) is None
+    assert dechunk('4\r\nab', 0) is None
+
+def test_announcer():
+    from hashlib import sha1
+    from udp_tracker import compact_peers
+    class Meta:
+        def __init__(self, announce, i):
+            self.announce = announce
+            self.info_hash = sha1(str(i))
+            self.i = i
+            self.length = 1000
+    trackers = [LocalHTTPTracker(), LocalHTTPTracker(max_requests = 5)]
+    try:
+        # a seed in each swarm; 25 torrents on each tracker
+        metas = []
+        for i in xrange(50):
+            tracker = trackers[i % 2]
+            meta = Meta('http://127.0.0.1:%d/announce' % tracker.port, i)
+            tracker.swarms[meta.info_hash.digest()] = {('10.0.0.%d' % i, 6881): 0}
+            metas.append(meta)
+        start = time()
+        a = Announcer('-XX0000-000000000000', 6881, pipeline = 4, rate = 100, backoff = 0.01)
+        for meta in metas:
+            a.add(meta)
+        a.run()
+        # the first 4 at once, the rest at 100 a second
+        assert time() - start > 0.15
+        for meta in metas:
+            r = a.results[meta.info_hash.digest()]
+            assert compact_peers(r['peers']) == [('10.0.0.%d' % meta.i, 6881)] and r['peers6'] == ''
+            assert r['complete'] == 1
+        assert len(a.peers) == 50 and a.peers.find('10.0.0.7', 6881)[2] == 1
+        # one connection to the first tracker; the second closes them after 5
+        assert trackers[0].connections == 1 and trackers[0].requests == 25
+        assert trackers[1].connections == 5 and trackers[1].requests == 25
+
+        # trackers that are too slow, or not there
+        trackers[0].delay = 0.3
+        trackers[1].stop()
+        a = Announcer('-XX0000-000000000000', 6881, timeout = 0.1, retries = 1, backoff = 0.01)
+        for meta in metas[:4]:
+            a.add(meta)
+        a.add(Meta('udp://127.0.0.1:1/announce', 99))
+        a.run()
+        assert a.results[metas[0].info_hash.digest()] == "no answer"
+        assert a.results[metas[1].info_hash.digest()] == "connect failed"
+        assert a.results[sha1('99').digest()] == "not an HTTP tracker"
+
+        # answers that are not HTTP or not bencoded dicts fail only their
+        # announces, and peers that are not dicts are left out
+        trackers[0].delay = 0
+        a = Announcer('-XX0000-000000000000', 6881, retries = 1, backoff = 0.01)
+        for raw in ['HTTP/1.1 200 OK\r\nContent-Length: x\r\n\r\n',
+                    'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n',
+                    'HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nd5:peersi1ee']:
+            trackers[0].raw = raw
+            a.add(metas[0])
+            a.run()
+            assert type(a.results[metas[0].info_hash.digest()]) == str
+        body = bencode({'peers': [1, 'x', {'ip': 5}, {'ip': 'example.com', 'port': 1},
+                                  {'ip': '10.0.0.1', 'port': 1}, {'ip': '::1', 'port': 2}]})
+        trackers[0].raw = 'HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s' % (len(body), body)
+        a.add(metas[0])
+        a.run()
+        r = a.results[metas[0].info_hash.digest()]
+        assert compact_peers(r['peers']) == [('10.0.0.1', 1)]
+        assert compact_peers(r['peers6'], AF_INET6) == [('::1', 2)]
+        assert len(a.peers) == 2 and a.peers.find('::1', 2) is not None
+    finally:
+        trackers[0].stop()
+
+if __name__ == '__main__':
+    from bittorrent_get_peers import FileMeta
+    if len(argv) < 2:
+        print "Usage: announcer.py <torrent file> ..."
+        exit(2)
+    a = Announcer('R520-----e7YcWsHfZfF', 7760)
+    metas = [FileMeta(name) for name in argv[1:]]
+    for meta in metas:
+        a.add(meta)
+    start = time()
+    a.run()
+    for meta in metas:
+        r = a.results[meta.info_hash.digest()]
+        if type(r) == dict:
+            print "%s: %d peers" % (meta.file_name, len(r['peers']) / 6 + len(r['peers6']) / 18)
+        else:
+            print "%s: %s" % (meta.file_name, r)
+    print "%d torrents, %d peers in %.2f s" % (len(metas), len(a.peers), time() - start)
@@ -0,0 +1,130 @@
+/* A bencode tokenizer.  See bdecode.h. */
+
+#include <string.h>
+#include "bdecode.h"
+
+#define DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/* An open list or dict: its token, and the last key of a dict so far. */
+struct level {
+    int tok;
+    int lastkey;		/* -1 before the first key */
+};
+
+static int key_order(const char *buf, const struct btok *a, const struct btok *b)
+{
+    /* Compare two keys as bencode.py does: bytewise, a prefix first. */
+
+    size_t n = (a->len < b->len ? a->len : b->len);
+    int c = memcmp(buf + a->start, buf + b->start, n);
+
+    if (c != 0) return(c);
+    return(a->len < b->len ? -1 : a->len > b->len);
+}
+
+int bdecode(const char *buf, size_t len, struct btok *tok, int ntok, int sloppy)
+{
+    struct level stack[BDECODE_MAX_DEPTH];
+    struct btok *t, *parent;
+    int n = 0, depth = 0;
+    size_t p = 0, q, size;
+
+    do {
+        if (p >= len) return(BDECODE_ERR);
+
+        /* The end of a list or dict; a dict must not end after a key. */
+        parent = (depth > 0 ? &tok[stack[depth - 1].tok] : NULL);
+        if (parent != NULL && buf[p] == 'e') {
+            if (parent->type == BT_DICT && parent->children % 2 != 0) return(BDECODE_ERR);
+            parent->len = p + 1 - parent->start;
+            parent->next = n;
+            depth--;
+            p++;
+            continue;
+        }
+        if (parent != NULL && parent->type == BT_DICT && parent->children % 2 == 0 &&
+            !DIGIT(buf[p]))
+            return(BDECODE_ERR);	/* keys are strings */
+
+        if (n == ntok) return(BDECODE_NOMEM);
+        t = &tok[n];
+        t->children = 0;
+        t->next = n + 1;
+        if (buf[p] == 'i') {
+            /* An integer: an optional minus and digits, without leading
+             * zeros, and no minus before a zero.
+             */
+            q = ++p;
+            if (q < len && buf[q] == '-') q++;
+            if (q >= len || !DIGIT(buf[q])) return(BDECODE_ERR);
+            if (buf[q] == '0' && (q > p || (q + 1 < len && buf[q + 1] != 'e'))) return(BDECODE_ERR);
+            while (q < len && DIGIT(buf[q])) q++;
+            if (q >= len || buf[q] != 'e') return(BDECODE_ERR);
+            t->type = BT_INT;
+            t->start = p;
+            t->len = q - p;
+            p = q + 1;
+        } else if (buf[p] == 'l' || buf[p] == 'd') {
+            if (depth == BDECODE_MAX_DEPTH) return(BDECODE_ERR);
+            t->type = (buf[p] == 'l' ? BT_LIST : BT_DICT);
+            t->start = p++;
+            stack[depth].tok = n;
+            stack[depth].lastkey = -1;
+            depth++;
+        } else if (DIGIT(buf[p])) {
+            /* A string: its length without leading zeros, and the bytes. */
+            if (buf[p] == '0' && p + 1 < len && buf[p + 1] != ':') return(BDECODE_ERR);
+            for (size = 0, q = p; q < len && DIGIT(buf[q]); q++) {
+                size = 10 * size + (buf[q] - '0');
+                if (size > len) return(BDECODE_ERR);
+            }
+            if (q >= len || buf[q] != ':' || size > len - q - 1) return(BDECODE_ERR);
+            t->type = BT_STRING;
+            t->start = q + 1;
+            t->len = size;
+            p = q + 1 + size;
+        } else {
+            return(BDECODE_ERR);
+        }
+
+        if (parent != NULL) {
+            if (parent->type == BT_DICT && parent->children % 2 == 0) {
+                if (stack[depth - 1].lastkey >= 0 &&
+                    key_order(buf, &tok[stack[depth - 1].lastkey], t) >= 0)
+                    return(BDECODE_ERR);	/* keys must be sorted */
+                stack[depth - 1].lastkey = n;
+            }
+            parent->children++;
+        }
+        n++;
+    } while (depth > 0);
+
+    if (!sloppy && p != len) return(BDECODE_ERR);
+    return(n);
+}
+
+int bdecode_find(const char *buf, const struct btok *tok, int i, const char *key)
+{
+    size_t n = strlen(key);
+    int k, j;
+
+    if (tok[i].type != BT_DICT) return(-1);
+    for (k = 0, j = i + 1; k < tok[i].children; k += 2, j = tok[j + 1].next) {
+        if (tok[j].len == n && memcmp(buf + tok[j].start, key, n) == 0) return(j + 1);
+    }
+    return(-1);
+}
+
+int bdecode_int(const char *buf, const struct btok *t, long long *v)
+{
+    const char *s = buf + t->start, *end = s + t->len;
+    int neg = (*s == '-');
+    unsigned long long u = 0, max = (neg ? 1ULL << 63 : (1ULL << 63) - 1);
+
+    for (s += neg; s < end; s++) {
+        if (u > (max - (*s - '0')) / 10) return(0);
+        u = 10 * u + (*s - '0');
+    }
+    *v = (neg ? (long long) (0 - u) : (long long) u);
+    return(1);
+}
@@ -0,0 +1,55 @@
+/* A bencode tokenizer.
+ *
+ * bdecode() reads a bencoded buffer in one pass and describes it in a flat
+ * array of tokens, one per value, in the order they appear.  Nothing is
+ * copied: a token gives the offset and length of its bytes in the buffer.
+ * The checks are those of bencode.py: no leading zeros in integers or
+ * string lengths, no i-0e, dict keys are strings in strictly increasing
+ * order, and nothing may follow the value unless sloppy is set.
+ *
+ * For example, d3:agei25e4:eyes4:bluee gives five tokens: the dict
+ * (start 0, len 23, 4 children), the string "age" (start 3, len 3), the
+ * integer 25 (start 7, len 2), and the strings "eyes" and "blue".
+ */
+
+#ifndef BDECODE_H
+#define BDECODE_H
+
+#include <stddef.h>
+
+/* Token types. */
+#define BT_INT    1
+#define BT_STRING 2
+#define BT_LIST   3
+#define BT_DICT   4
+
+/* What bdecode() returns on failure. */
+#define BDECODE_ERR   -1	/* bad bencoded data */
+#define BDECODE_NOMEM -2	/* more tokens are needed */
+
+#define BDECODE_MAX_DEPTH 256	/* lists and dicts nested deeper are refused */
+
+struct btok {
+    int type;			/* BT_INT, BT_STRING, BT_LIST or BT_DICT */
+    int children;		/* values in a list; keys and values in a dict */
+    int next;			/* index of the first token after this value */
+    size_t start;		/* offset of the digits of an integer (sign
+                                 * included), of the bytes of a string, or of
+                                 * the 'l' or 'd' of a list or dict */
+    size_t len;			/* their length; for a list or dict, up to and
+                                 * including its 'e' */
+};
+
+/* Tokenize the len bytes at buf into at most ntok tokens.  Returns the
+ * number of tokens, BDECODE_ERR, or BDECODE_NOMEM if ntok is too small;
+ * len / 2 + 1 tokens are always enough.
+ */
+int bdecode(const char *buf, size_t len, struct btok *tok, int ntok, int sloppy);
+
+/* The index of the value of key in dict token i, or -1 if it has none. */
+int bdecode_find(const char *buf, const struct btok *tok, int i, const char *key);
+
+/* The value of integer token t in *v.  Returns 0 if it does not fit. */
+int bdecode_int(const char *buf, const struct btok *t, long long *v);
+
+#endif
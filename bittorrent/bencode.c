@@ -0,0 +1,167 @@
+/* A streaming bencode encoder.  See bencode.h. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "bencode.h"
+
+void benc_init(struct benc *e, char *buf, size_t size)
+{
+    e->buf = buf;
+    e->len = 0;
+    e->size = size;
+    e->fd = -1;
+    e->grow = 0;
+    e->error = 0;
+}
+
+int benc_init_grow(struct benc *e, size_t size)
+{
+    if (size == 0) size = 1;
+    benc_init(e, malloc(size), size);
+    e->grow = 1;
+    if (e->buf == NULL) e->error = BENC_NOMEM;
+    return(e->error);
+}
+
+void benc_init_fd(struct benc *e, int fd, char *buf, size_t size)
+{
+    benc_init(e, buf, size);
+    e->fd = fd;
+}
+
+void benc_free(struct benc *e)
+{
+    if (e->grow) free(e->buf);
+    e->buf = NULL;
+    e->size = e->len = 0;
+}
+
+/* Writes all of n iovecs, which it changes. */
+static int write_all(struct benc *e, struct iovec *iov, int n)
+{
+    ssize_t w;
+
+    while (n > 0) {
+        if ((w = writev(e->fd, iov, n)) < 0) {
+            if (errno == EINTR) continue;
+            return(e->error = BENC_IO);
+        }
+        for (; n > 0 && (size_t) w >= iov->iov_len; iov++, n--) w -= iov->iov_len;
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return(0);
+}
+
+int benc_flush(struct benc *e)
+{
+    struct iovec iov;
+
+    if (e->error || e->fd < 0 || e->len == 0) return(e->error);
+    iov.iov_base = e->buf;
+    iov.iov_len = e->len;
+    e->len = 0;
+    return(write_all(e, &iov, 1));
+}
+
+/* Appends n bytes, making room as the output allows. */
+static int put(struct benc *e, const void *s, size_t n)
+{
+    size_t size;
+    char *buf;
+    struct iovec iov[2];
+
+    if (e->error) return(e->error);
+    if (e->size - e->len < n) {
+        if (e->fd >= 0) {
+            if (n > e->size) {
+                /* It would not fit even in an empty buffer. */
+                iov[0].iov_base = e->buf;
+                iov[0].iov_len = e->len;
+                iov[1].iov_base = (void *) s;
+                iov[1].iov_len = n;
+                e->len = 0;
+                return(write_all(e, iov, 2));
+            }
+            if (benc_flush(e) < 0) return(e->error);
+        } else if (e->grow) {
+            for (size = 2 * e->size; size - e->len < n; size *= 2)
+                ;
+            if ((buf = realloc(e->buf, size)) == NULL) return(e->error = BENC_NOMEM);
+            e->buf = buf;
+            e->size = size;
+        } else {
+            return(e->error = BENC_NOSPACE);
+        }
+    }
+    memcpy(e->buf + e->len, s, n);
+    e->len += n;
+    return(0);
+}
+
+/* The decimal digits of v, before end; returns where they start. */
+static char *digits(char *end, unsigned long long v)
+{
+    do {
+        *--end = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    return(end);
+}
+
+int benc_int(struct benc *e, long long v)
+{
+    char tmp[24], *p;
+    unsigned long long u = (v < 0 ? 0ULL - (unsigned long long) v : (unsigned long long) v);
+
+    tmp[sizeof(tmp) - 1] = 'e';
+    p = digits(tmp + sizeof(tmp) - 1, u);
+    if (v < 0) *--p = '-';
+    *--p = 'i';
+    return(put(e, p, tmp + sizeof(tmp) - p));
+}
+
+int benc_string(struct benc *e, const void *s, size_t n)
+{
+    char tmp[24], *p;
+    struct iovec iov[3];
+
+    tmp[sizeof(tmp) - 1] = ':';
+    p = digits(tmp + sizeof(tmp) - 1, n);
+    if (e->error == 0 && e->fd >= 0 && n >= BENC_DIRECT) {
+        iov[0].iov_base = e->buf;
+        iov[0].iov_len = e->len;
+        iov[1].iov_base = p;
+        iov[1].iov_len = tmp + sizeof(tmp) - p;
+        iov[2].iov_base = (void *) s;
+        iov[2].iov_len = n;
+        e->len = 0;
+        return(write_all(e, iov, 3));
+    }
+    if (put(e, p, tmp + sizeof(tmp) - p) < 0) return(e->error);
+    return(put(e, s, n));
+}
+
+int benc_list(struct benc *e)
+{
+    return(put(e, "l", 1));
+}
+
+int benc_dict(struct benc *e)
+{
+    return(put(e, "d", 1));
+}
+
+int benc_end(struct benc *e)
+{
+    return(put(e, "e", 1));
+}
+
+int benc_raw(struct benc *e, const void *s, size_t n)
+{
+    return(put(e, s, n));
+}
@@ -0,0 +1,66 @@
+/* A streaming bencode encoder.
+ *
+ * Values are written out as they are given, and nothing of their structure
+ * is kept: benc_list() and benc_dict() open a list or dict, benc_end()
+ * closes it, and between them come the values of a list, or the keys and
+ * values of a dict in turn.  Keys are strings, and must come in the order
+ * bencoding wants (bytewise increasing); they are neither sorted nor
+ * checked.
+ *
+ * The output goes into a buffer the caller gives, into one that grows, or
+ * to a file descriptor.  Writing to a file descriptor, small values are
+ * gathered in the buffer, and a string of BENC_DIRECT bytes or more (the
+ * pieces of a torrent, a compact peer list) goes out in one writev() with
+ * the bytes gathered before it, without being copied.
+ *
+ * Errors stick: after the first one nothing more is written, and every
+ * call returns it.
+ */
+
+#ifndef BENCODE_H
+#define BENCODE_H
+
+#include <stddef.h>
+
+/* What the functions return on failure; 0 is success. */
+#define BENC_NOSPACE -1		/* the caller's buffer is full */
+#define BENC_NOMEM   -2		/* a buffer could not grow */
+#define BENC_IO      -3		/* a write failed; errno says why */
+
+#define BENC_DIRECT 4096	/* strings this long are written, not copied */
+
+struct benc {
+    char *buf;
+    size_t len;			/* bytes in buf, not yet written if fd >= 0 */
+    size_t size;
+    int fd;			/* -1 if the output stays in buf */
+    int grow;			/* buf is malloc()ed here, and grows */
+    int error;
+};
+
+/* Into the size bytes at buf; the output is buf[0] to buf[len - 1]. */
+void benc_init(struct benc *e, char *buf, size_t size);
+
+/* Into a buffer of size bytes to begin with, twice as big whenever it is
+ * full; benc_free() frees it.  Returns 0 or BENC_NOMEM.
+ */
+int benc_init_grow(struct benc *e, size_t size);
+
+/* To fd, gathering small values in the size bytes at buf. */
+void benc_init_fd(struct benc *e, int fd, char *buf, size_t size);
+
+int benc_int(struct benc *e, long long v);
+int benc_string(struct benc *e, const void *s, size_t n);
+int benc_list(struct benc *e);
+int benc_dict(struct benc *e);
+int benc_end(struct benc *e);
+
+/* n bytes that are bencoded already, as they are. */
+int benc_raw(struct benc *e, const void *s, size_t n);
+
+/* Writes what is gathered to the file descriptor. */
+int benc_flush(struct benc *e);
+
+void benc_free(struct benc *e);
+
+#endif
@@ -4,11 +4,15 @@ __version__ = "1.1"
 __author__  = "Pawel Garbacki <pawelg@gmail.com> and Lucia D'Acunto"
 
 from sys import argv, exit
-from bencode import bencode, bdecode
+from bencode import bdecode
+from cbencode import Decoded
+from udp_tracker import announce_url
+from peers import PeerTable, compact
 from binascii import a2b_hex,b2a_hex
 from hashlib import sha1
 from urllib import quote,urlopen, urlencode,unquote
-from os.path import basename
+from os.path import basename, join
+from mmap import mmap, ACCESS_COPY
 from socket import *
 
 # connects to tracker specified by <code>url</code> and retrieves a list of 20
@@ -16,23 +20,28 @@ from socket import *
 #
 def get_random_peers(url):
     try:
-        handle = urlopen(full_url)
+        handle = urlopen(url)
         raw_response = handle.read()
         handle.close()
         response = bdecode(raw_response)
         peers = response.get('peers')
+        peers6 = response.get('peers6')
         random_peers = []
 
-        if type(peers) == type(''):
-            for peer in xrange(0, len(peers), 6):
-                ip = '.'.join([str(ord(i)) for i in peers[peer:peer+4]])
-                port = (ord(peers[peer+4]) << 8) | ord(peers[peer+5])
-                random_peers.append((ip, port))
-        elif peers is None:
+        # either may be a compact string or a list in the dictionary model;
+        # all go into one table, so a peer that several give is listed once
+        table = PeerTable()
+        for listed, ipv6 in [(peers, False), (peers6, True)]:
+            if type(listed) == type(''):
+                table.add(listed, ipv6)
+            elif type(listed) == type([]):
+                compact4, compact6 = compact(listed)
+                table.add(compact4)
+                table.add(compact6, True)
+        if peers is None and peers6 is None:
             print "No peers found in the announce"
-        else:
-            for peer in peers:
-                random_peers.append([peer.get('ip'), "%s" % peer.get('port')])
+        for ip, port, first_seen, last_seen, seen in table.peers():
+            random_peers.append((ip, port))
         return random_peers
     except TypeError as e:
         print "Result Failed Type error."
@@ -50,33 +59,141 @@ def dump_peers(torrent_file_name, peers):
     for peer in peers:
         print peer
 
+# whether name can be a component of a path under the download directory:
+# a non-empty string that does not lead out of it
+#
+def safe_name(name):
+    return type(name) == str and name not in ('', '.', '..') and \
+        '/' not in name and '\\' not in name and '\0' not in name
+
 # respresents the torrent file meta data
 #
 class FileMeta:
 # extracts meta data from a torrent file
 #
     def __init__(self, torrent_file_name):
+        # the file is only tokenized, in place in a private mapping, and the
+        # few values needed are read out of it; a key that is missing raises
+        # KeyError, and a value of the wrong type ValueError or TypeError
         torrent_file = open(torrent_file_name, 'rb')
-        meta = bdecode(torrent_file.read())
-        self.file_name = torrent_file_name
-        self.announce = meta['announce']
-        info = meta['info']
-        self.info_hash = sha1(bencode(info))
-        self.piece_length = info['piece length']
-        self.n_pieces = len(info['pieces']) / 20
-        if info.has_key('length'):
-            # let's assume we have a single file
-    #       file_length = info['length']
-            self.length = info['length']
-        else:
-            # let's assume we have a directory structure
-            file_length = 0;
-            for file in info['files']:
-                file_length += file['length']
-            self.length = file_length
+        data = mmap(torrent_file.fileno(), 0, access = ACCESS_COPY)
+        torrent_file.close()
+        meta = None
+        try:
+            meta = Decoded(data)
+            self.file_name = torrent_file_name
+            self.announce = meta.get(0, 'announce')
+            if type(self.announce) != str:
+                raise ValueError, "bad announce"
+            info = meta.find(0, 'info')
+            if info < 0:
+                raise ValueError, "torrent has no info"
+            # the info hash is that of the bytes of info as they are in the
+            # file; encoding the decoded dict again would give other bytes
+            # for a torrent that is not in canonical form
+            start, end = meta.span(info)
+            self.info_hash = sha1(buffer(data, start, end - start))
+            self.piece_length = meta.get(info, 'piece length')
+            # the 20-byte SHA-1 hashes of the pieces, one after the other
+            self.pieces = meta.get(info, 'pieces')
+            self.name = meta.get(info, 'name')
+            if type(self.piece_length) not in (int, long) or self.piece_length <= 0 or \
+                    type(self.pieces) != str or len(self.pieces) % 20 != 0 or \
+                    not safe_name(self.name):
+                raise ValueError, "bad info"
+            self.n_pieces = len(self.pieces) / 20
+            if meta.find(info, 'length') >= 0:
+                # let's assume we have a single file
+        #       file_length = info['length']
+                self.length = meta.get(info, 'length')
+                self.files = [(self.name, self.length)]
+            else:
+                # let's assume we have a directory structure, named after the
+                # torrent; files are (path, length) in the order of the
+                # payload
+                file_length = 0;
+                self.files = []
+                for file in meta.children(meta.find(info, 'files')):
+                    length = meta.get(file, 'length')
+                    path = meta.get(file, 'path')
+                    if type(length) not in (int, long) or length < 0:
+                        raise ValueError, "bad file length"
+                    if type(path) != list or len(path) == 0 or \
+                            not all([safe_name(part) for part in path]):
+                        raise ValueError, "bad file path"
+                    self.files.append((join(self.name, *path), length))
+                    file_length += length
+                self.length = file_length
+            if type(self.length) not in (int, long) or self.length < 0:
+                raise ValueError, "bad length"
+        finally:
+            # the tokens hold on to the mapping until they are let go of
+            if meta is not None:
+                meta.close()
+            data.close()
         dummy, self.last_piece_length = divmod(self.length, self.piece_length)
     #   piece_number, last_piece_length = divmod(file_length, piece_length)
 
+def test_get_random_peers():
+    from tempfile import mkstemp
+    from os import close, remove
+    from bencode import bencode
+    fd, name = mkstemp()
+    close(fd)
+    try:
+        def peers(response):
+            open(name, 'wb').write(bencode(response))
+            return sorted(get_random_peers(name))
+        v4 = inet_aton('10.0.0.1') + '\x1a\xe1'
+        v6 = inet_pton(AF_INET6, '::1') + '\x00\x02'
+        listed = [{'ip': '10.0.0.2', 'port': 2}, {'ip': '::2', 'port': 3}, {'ip': '10.0.0.1', 'port': 6881}]
+        assert peers({'peers': v4}) == [('10.0.0.1', 6881)]
+        assert peers({'peers': v4, 'peers6': v6}) == [('10.0.0.1', 6881), ('::1', 2)]
+        assert peers({'peers': listed, 'peers6': v6}) == \
+            [('10.0.0.1', 6881), ('10.0.0.2', 2), ('::1', 2), ('::2', 3)]
+        assert peers({'peers': v4, 'peers6': listed[1:2]}) == [('10.0.0.1', 6881), ('::2', 3)]
+        assert peers({'peers': listed}) == [('10.0.0.1', 6881), ('10.0.0.2', 2), ('::2', 3)]
+        assert peers({'interval': 1800}) == []
+    finally:
+        remove(name)
+
+def test_filemeta():
+    from tempfile import mkdtemp
+    from shutil import rmtree
+    from bencode import bencode
+    directory = mkdtemp()
+    try:
+        def meta(announce, info):
+            name = join(directory, 'x.torrent')
+            open(name, 'wb').write(bencode({'announce': announce, 'info': info}))
+            return FileMeta(name)
+        def bad(announce, info):
+            try:
+                meta(announce, info)
+            except ValueError:
+                return True
+            return False
+        def files(*entries):
+            return {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20,
+                    'files': [{'length': length, 'path': path} for length, path in entries]}
+        m = meta('http://localhost/', files((1, ['a', 'b']), (0, ['c'])))
+        assert m.files == [(join('x', 'a', 'b'), 1), (join('x', 'c'), 0)] and m.length == 1
+        single = {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20, 'length': 1}
+        assert bad(7, single) and bad(['http://localhost/'], single)
+        assert bad('http://localhost/', files((-1, ['a'])))
+        assert bad('http://localhost/', files(('1', ['a'])))
+        assert bad('http://localhost/', files((1, [])))
+        assert bad('http://localhost/', files((1, 'a')))
+        assert bad('http://localhost/', files((1, ['a', 7])))
+        for part in ['..', '.', '', 'a/b', '/etc']:
+            assert bad('http://localhost/', files((1, ['a', part]))), part
+        for name in ['..', '', '/etc']:
+            info = dict(single)
+            info['name'] = name
+            assert bad('http://localhost/', info), name
+    finally:
+        rmtree(directory)
+
 #
 # parses a torrent file to obtain the identity of a tracker, requests from the
 # tracker 20 random peers and sends those peers' identities to the buffer
@@ -89,6 +206,15 @@ if __name__ == '__main__':
     #init() # initialize the system
     torrent_file_name = argv[1]
     file_meta = FileMeta(torrent_file_name)
-    full_url = file_meta.announce + '?info_hash=' + quote(a2b_hex(file_meta.info_hash.hexdigest())) + '&peer_id=R520-----e7YcWsHfZfF&port=7760&uploaded=0&downloaded=0&left=' + str(file_meta.length) + '&no_peer_id=1&compact=1&event=started&key=iw10.t'
-    random_peers = get_random_peers(full_url)
+    if file_meta.announce.startswith('udp://'):
+        # a UDP tracker: one datagram each way instead of an HTTP request
+        try:
+            random_peers = announce_url(file_meta.announce, file_meta.info_hash.digest(),
+                                        'R520-----e7YcWsHfZfF', 7760, file_meta.length)['peers']
+        except IOError as e:
+            print "Result Failed: %s" % e
+            exit(2)
+    else:
+        full_url = file_meta.announce + '?info_hash=' + quote(a2b_hex(file_meta.info_hash.hexdigest())) + '&peer_id=R520-----e7YcWsHfZfF&port=7760&uploaded=0&downloaded=0&left=' + str(file_meta.length) + '&no_peer_id=1&compact=1&event=started&key=iw10.t'
+        random_peers = get_random_peers(full_url)
     dump_peers(basename(torrent_file_name), random_peers)
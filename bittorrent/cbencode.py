@@ -0,0 +1,476 @@
+# Native bencode decoding and encoding, on the tokenizer in bdecode.c and
+# the encoder in bencode.c (make builds libbt.so).  Decoded(x) tokenizes x
+# in one pass without copying anything; its values are only built when
+# asked for, so that e.g. the announce URL of a torrent can be read without
+# decoding its pieces.  x may be a string or a writable buffer such as an
+# mmap opened with ACCESS_COPY.  bdecode() is a drop-in replacement for the
+# one in bencode.py.  Encoder writes values into a buffer, or to a file
+# without the whole output ever being one string; a dict whose keys are in
+# order already can be given as Items, and is not sorted.
+
+from ctypes import CDLL, Structure, POINTER, c_int, c_size_t, c_char, c_char_p, c_void_p, \
+    c_longlong, byref, sizeof, create_string_buffer, string_at, get_errno
+from os import strerror
+from os.path import join, dirname, abspath
+from struct import unpack_from, calcsize
+from types import IntType, LongType, StringType, ListType, TupleType, DictType, BooleanType, \
+    UnicodeType
+from bencode import BencachedType
+
+BT_INT = 1
+BT_STRING = 2
+BT_LIST = 3
+BT_DICT = 4
+
+BDECODE_ERR = -1
+BDECODE_NOMEM = -2
+
+BENC_NOSPACE = -1
+BENC_NOMEM = -2
+BENC_IO = -3
+BENC_DIRECT = 4096
+
+class Token(Structure):
+    _fields_ = [('type', c_int),
+                ('children', c_int),
+                ('next', c_int),
+                ('start', c_size_t),
+                ('len', c_size_t)]
+
+# the fields of a token as struct.unpack_from() sees them
+TOKEN_FORMAT = '3i4x2Q' if sizeof(c_size_t) == 8 else '3i2I'
+assert calcsize('=' + TOKEN_FORMAT) == sizeof(Token)
+
+libbt = CDLL(join(dirname(abspath(__file__)), 'libbt.so'), use_errno = True)
+libbt.bdecode.argtypes = [c_void_p, c_size_t, POINTER(Token), c_int, c_int]
+libbt.bdecode_find.argtypes = [c_void_p, POINTER(Token), c_int, c_char_p]
+libbt.bdecode_int.argtypes = [c_void_p, POINTER(Token), POINTER(c_longlong)]
+
+class Benc(Structure):
+    _fields_ = [('buf', c_void_p),
+                ('len', c_size_t),
+                ('size', c_size_t),
+                ('fd', c_int),
+                ('grow', c_int),
+                ('error', c_int)]
+
+libbt.benc_init.argtypes = [POINTER(Benc), c_void_p, c_size_t]
+libbt.benc_init_grow.argtypes = [POINTER(Benc), c_size_t]
+libbt.benc_init_fd.argtypes = [POINTER(Benc), c_int, c_void_p, c_size_t]
+libbt.benc_int.argtypes = [POINTER(Benc), c_longlong]
+libbt.benc_string.argtypes = [POINTER(Benc), c_void_p, c_size_t]
+libbt.benc_raw.argtypes = [POINTER(Benc), c_void_p, c_size_t]
+for f in (libbt.benc_list, libbt.benc_dict, libbt.benc_end, libbt.benc_flush, libbt.benc_free):
+    f.argtypes = [POINTER(Benc)]
+
+# what get() is given when it has no default
+_MISSING = object()
+
+# holds bencoded data and its tokens
+#
+class Decoded:
+    def __init__(self, x, sloppy = 0):
+        # the C code reads a string in place, and other buffers through a
+        # ctypes array on top of them; value() slices them through a
+        # buffer(), which gives strings
+        if type(x) == str:
+            self.buf = x
+        else:
+            self.buf = (c_char * len(x)).from_buffer(x)
+            x = buffer(x)
+
+        # most of a torrent is its pieces, so few tokens will do; when they
+        # do not, try again with more, up to the most there can be
+        ntok = len(x) / 64 + 16
+        while True:
+            self.tokens = (Token * ntok)()
+            n = libbt.bdecode(self.buf, len(x), self.tokens, ntok, sloppy)
+            if n != BDECODE_NOMEM:
+                break
+            ntok = min(4 * ntok, len(x) / 2 + 1)
+        if n < 0:
+            self.buf = None
+            raise ValueError, "bad bencoded data"
+        self.x = x
+        self.n = n
+
+    # lets go of x, so that e.g. an mmap under it can be closed; nothing
+    # can be read after
+    def close(self):
+        self.buf = self.x = None
+
+    # the index of the value of key in dict i, or -1 (also when i is -1,
+    # a key that find() did not find)
+    def find(self, i, key):
+        if i < 0:
+            return -1
+        return libbt.bdecode_find(self.buf, self.tokens, i, key)
+
+    # the indices of the values in list i, or of the keys and values in
+    # dict i; KeyError if i is -1, as find() gives for a missing key, and
+    # TypeError if it is neither
+    def children(self, i):
+        if i < 0:
+            raise KeyError, i
+        tokens = self.tokens
+        if tokens[i].type != BT_LIST and tokens[i].type != BT_DICT:
+            raise TypeError, "not a list or dict"
+        return self._children(i)
+
+    def _children(self, i):
+        tokens = self.tokens
+        j = i + 1
+        for k in xrange(tokens[i].children):
+            yield j
+            j = tokens[j].next
+
+    # the value of key in dict i, or default if it has none; without a
+    # default, KeyError, as a dict would raise
+    def get(self, i, key, default = _MISSING):
+        j = self.find(i, key)
+        if j < 0:
+            if default is _MISSING:
+                raise KeyError, key
+            return default
+        return self.value(j)
+
+    # the offsets of the bytes of value i: from its 'd', 'l' or 'i' (or the
+    # first digit of its length) up to its end
+    def span(self, i = 0):
+        t = self.tokens[i]
+        if t.type == BT_LIST or t.type == BT_DICT:
+            return (t.start, t.start + t.len)
+        if t.type == BT_INT:
+            return (t.start - 1, t.start + t.len + 1)
+        return (t.start - len(str(t.len)) - 1, t.start + t.len)
+
+    # the value of token i as bencode.bdecode() gives it, built without
+    # recursion; only the strings are copied
+    def value(self, i = 0):
+        x = self.x
+        end = self.tokens[i].next
+        # the fields of all tokens at once: much faster than ctypes
+        fields = unpack_from('=' + TOKEN_FORMAT * (end - i), self.tokens, i * sizeof(Token))
+        stack = []
+        result = None
+        for j in xrange(0, len(fields), 5):
+            kind, children, dummy, start, n = fields[j:j + 5]
+            if kind == BT_STRING:
+                v = x[start:start + n]
+            elif kind == BT_INT:
+                v = int(x[start:start + n])
+            elif kind == BT_LIST:
+                v = []
+            else:
+                v = {}
+            if not stack:
+                result = v
+            else:
+                top = stack[-1]
+                if type(top[0]) == list:
+                    top[0].append(v)
+                elif top[2] is None:
+                    top[2] = v
+                else:
+                    top[0][top[2]] = v
+                    top[2] = None
+                top[1] -= 1
+            if (kind == BT_LIST or kind == BT_DICT) and children > 0:
+                stack.append([v, children, None])
+            while stack and stack[-1][1] == 0:
+                stack.pop()
+        return result
+
+def bdecode(x, sloppy = 0):
+    return Decoded(x, sloppy).value()
+
+# the (key, value) pairs of a dict, in the order of their keys already
+#
+class Items(list):
+    pass
+
+# writes bencoded values into a buffer that grows from size bytes, into
+# buffer (a writable buffer such as a bytearray or an mmap) if given, or to
+# the file descriptor fd if given, through a buffer of size bytes.  The
+# values come one by one (int(), string(), list() ... end()) or whole
+# (encode()); errors stick, and surface in getvalue() and flush().
+#
+# A call into libbt costs more than it takes Python to format a small
+# value, so encode() gathers the small parts of a value and hands them over
+# together; only strings of BENC_DIRECT bytes or more go by themselves, and
+# to a file descriptor they are not copied at all.
+#
+class Encoder:
+    def __init__(self, fd = None, buffer = None, size = 4096):
+        self.benc = Benc()
+        self.e = byref(self.benc)
+        if buffer is not None:
+            self.buf = (c_char * len(buffer)).from_buffer(buffer)
+            libbt.benc_init(self.e, self.buf, len(buffer))
+        elif fd is not None:
+            self.buf = create_string_buffer(size)
+            libbt.benc_init_fd(self.e, fd, self.buf, size)
+        elif libbt.benc_init_grow(self.e, size) < 0:
+            raise MemoryError
+
+    def __del__(self):
+        if hasattr(self, 'e'):
+            libbt.benc_free(self.e)
+
+    # the bytes in the buffer
+    def __len__(self):
+        return int(self.benc.len)
+
+    def _check(self):
+        error = self.benc.error
+        if error == BENC_NOSPACE:
+            raise ValueError, "the buffer is full"
+        elif error == BENC_NOMEM:
+            raise MemoryError
+        elif error == BENC_IO:
+            raise IOError(get_errno(), strerror(get_errno()))
+
+    def int(self, x):
+        if -2 ** 63 <= x < 2 ** 63:
+            libbt.benc_int(self.e, x)
+        else:
+            self.raw('i%de' % x)
+
+    def string(self, x):
+        libbt.benc_string(self.e, x, len(x))
+
+    def list(self):
+        libbt.benc_list(self.e)
+
+    def dict(self):
+        libbt.benc_dict(self.e)
+
+    def end(self):
+        libbt.benc_end(self.e)
+
+    # bytes that are bencoded already
+    def raw(self, x):
+        libbt.benc_raw(self.e, x, len(x))
+
+    # x, any value bencode.bencode() takes, or Items
+    def encode(self, x):
+        r = []
+        try:
+            encode_func[type(x)](x, r, self)
+        except (KeyError, TypeError):
+            raise ValueError, "could not encode type %s" % type(x)
+        self._hand_over(r)
+
+    # the parts gathered in r, which it empties
+    def _hand_over(self, r):
+        x = ''.join(r)
+        libbt.benc_raw(self.e, x, len(x))
+        del r[:]
+
+    # what is in the buffer, as a string
+    def getvalue(self):
+        self._check()
+        return string_at(self.benc.buf, self.benc.len)
+
+    # empties the buffer, to encode something else into it
+    def reset(self):
+        self._check()
+        self.benc.len = 0
+
+    # writes what is in the buffer to the file descriptor
+    def flush(self):
+        libbt.benc_flush(self.e)
+        self._check()
+
+# the encode functions append the parts of x to r, and give the long
+# strings to e, an Encoder
+#
+def encode_int(x, r, e):
+    r.extend(('i', str(x), 'e'))
+
+def encode_bool(x, r, e):
+    r.append(x and 'i1e' or 'i0e')
+
+def encode_string(x, r, e):
+    if len(x) >= BENC_DIRECT:
+        e._hand_over(r)
+        libbt.benc_string(e.e, x, len(x))
+    else:
+        r.extend((str(len(x)), ':', x))
+
+def encode_unicode(x, r, e):
+    encode_string(x.encode('UTF-8'), r, e)
+
+def encode_list(x, r, e):
+    r.append('l')
+    for v in x:
+        encode_func[type(v)](v, r, e)
+    r.append('e')
+
+def encode_dict(x, r, e):
+    r.append('d')
+    for k, v in sorted(x.iteritems()):
+        r.extend((str(len(k)), ':', k))
+        encode_func[type(v)](v, r, e)
+    r.append('e')
+
+def encode_items(x, r, e):
+    r.append('d')
+    for k, v in x:
+        r.extend((str(len(k)), ':', k))
+        encode_func[type(v)](v, r, e)
+    r.append('e')
+
+def encode_bencached(x, r, e):
+    r.append(x.bencoded)
+
+encode_func = {IntType: encode_int, LongType: encode_int, BooleanType: encode_bool,
+               StringType: encode_string, UnicodeType: encode_unicode,
+               ListType: encode_list, TupleType: encode_list, DictType: encode_dict,
+               Items: encode_items, BencachedType: encode_bencached}
+
+def test_bdecode():
+    for x in ['0:0:', 'ie', 'i341foo382e', 'i-0e', 'i123', '', 'i6easd',
+              '35208734823ljdahflajhdf', '2:abfdjslhfld', '02:xy', 'l',
+              'leanfdldjfh', 'relwjhrlewjh', 'd', 'defoobar', 'd3:fooe',
+              'di1e0:e', 'd1:b0:1:a0:e', 'd1:a0:1:a0:e', 'i03e', 'l01:ae',
+              '9999:x', 'l0:', 'd0:0:', 'd0:', 'i-03e', 'i-e', 'de0:',
+              'l' * 300 + 'e' * 300]:
+        try:
+            bdecode(x)
+            assert 0
+        except ValueError:
+            pass
+    assert bdecode('i4e') == 4L
+    assert bdecode('i0e') == 0L
+    assert bdecode('i123456789e') == 123456789L
+    assert bdecode('i-10e') == -10L
+    assert bdecode('i12345678901234567890e') == 12345678901234567890L
+    assert bdecode('0:') == ''
+    assert bdecode('3:abc') == 'abc'
+    assert bdecode('10:1234567890') == '1234567890'
+    assert bdecode('le') == []
+    assert bdecode('l0:0:0:e') == ['', '', '']
+    assert bdecode('li1ei2ei3ee') == [1, 2, 3]
+    assert bdecode('l3:asd2:xye') == ['asd', 'xy']
+    assert bdecode('ll5:Alice3:Bobeli2ei3eee') == [['Alice', 'Bob'], [2, 3]]
+    assert bdecode('de') == {}
+    assert bdecode('d3:agei25e4:eyes4:bluee') == {'age': 25, 'eyes': 'blue'}
+    assert bdecode('d8:spam.mp3d6:author5:Alice6:lengthi100000eee') == {'spam.mp3': {'author': 'Alice', 'length': 100000}}
+    assert bdecode('d1:a0:2:aa0:e') == {'a': '', 'aa': ''}
+    assert bdecode('i4eXX', 1) == 4
+
+    # the tokens themselves
+    d = Decoded('d3:agei25e4:eyes4:bluee')
+    assert d.n == 5
+    assert [(t.type, t.start, t.len, t.children, t.next) for t in d.tokens[:5]] == \
+        [(BT_DICT, 0, 23, 4, 5), (BT_STRING, 3, 3, 0, 2), (BT_INT, 7, 2, 0, 3),
+         (BT_STRING, 12, 4, 0, 4), (BT_STRING, 18, 4, 0, 5)]
+    assert d.find(0, 'eyes') == 4 and d.find(0, 'nose') == -1
+    assert d.span(0) == (0, 23) and d.span(2) == (6, 10) and d.span(4) == (16, 22)
+    d = Decoded('d1:ad1:bi1ee1:cli2eee')
+    assert d.find(0, 'c') == 6 and d.value(d.find(0, 'c')) == [2]
+    v = c_longlong()
+    d = Decoded('li-9223372036854775808ei9223372036854775808ee')
+    assert libbt.bdecode_int(d.buf, byref(d.tokens[1]), byref(v)) == 1 and v.value == -2 ** 63
+    assert libbt.bdecode_int(d.buf, byref(d.tokens[2]), byref(v)) == 0
+    assert list(d.children(0)) == [1, 2]
+
+    # buffers other than strings, and the byte span of a value
+    from array import array
+    x = 'd4:infod6:lengthi5ee4:name1:xe'
+    d = Decoded(array('c', x))
+    assert d.get(0, 'name') == 'x' and d.get(0, 'none', 7) == 7
+    start, end = d.span(d.find(0, 'info'))
+    assert x[start:end] == 'd6:lengthi5ee'
+
+    # missing keys, as a dict has them
+    for f in [lambda: d.get(0, 'none'), lambda: d.children(d.find(0, 'none')),
+              lambda: d.get(d.find(0, 'none'), 'length')]:
+        try:
+            f()
+            assert False
+        except KeyError:
+            pass
+    try:
+        d.children(d.find(0, 'name'))
+        assert False
+    except TypeError:
+        pass
+
+    # an mmap can be closed once its tokens are let go of
+    from mmap import mmap
+    m = mmap(-1, len(x))
+    m.write(x)
+    d = Decoded(m)
+    assert d.get(d.find(0, 'info'), 'length') == 5
+    d.close()
+    m.close()
+
+def test_bencode():
+    from bencode import bencode as pybencode, Bencached
+    def bencode(x):
+        e = Encoder()
+        e.encode(x)
+        return e.getvalue()
+    for x in [4, 0, -10, 2 ** 63 - 1, -2 ** 63, 12345678901234567890L, -2 ** 64, True, '', 'abc',
+              '1234567890', u'\xe9', [], [1, 2, 3], (1, 'a'), [['Alice', 'Bob'], [2, 3]], {},
+              {'age': 25, 'eyes': 'blue'}, {'spam.mp3': {'author': 'Alice', 'length': 100000}},
+              {'b': 1, 'a': 2, 'aa': [{}]}, 'x' * 100000]:
+        assert bencode(x) == pybencode(x), x
+    assert bencode([Bencached('i1e'), Items([('z', 1), ('a', 2)])]) == 'li1ed1:zi1e1:ai2eee'
+    for x in [{1: 'foo'}, 1.5, None, [object()]]:
+        try:
+            bencode(x)
+            assert 0
+        except ValueError:
+            pass
+
+    # value by value, into a buffer that grows from one byte, and reused
+    e = Encoder(size = 1)
+    e.dict()
+    e.string('k')
+    e.list()
+    e.int(-7)
+    e.string('v' * 5000)
+    e.end()
+    e.end()
+    assert e.getvalue() == 'd1:kli-7e5000:' + 'v' * 5000 + 'ee' and len(e) == 5016
+    e.reset()
+    e.encode({'a': 1, 'b': 'q' * 5000})
+    assert e.getvalue() == 'd1:ai1e1:b5000:' + 'q' * 5000 + 'e'
+
+    # a buffer of the caller's: what fits, and then an error
+    buf = bytearray(10)
+    e = Encoder(buffer = buf)
+    e.encode([1, 2])
+    assert e.getvalue() == 'li1ei2ee' and str(buf[:8]) == 'li1ei2ee'
+    e.encode('abc')
+    try:
+        e.getvalue()
+        assert 0
+    except ValueError:
+        pass
+
+    # a file, with strings long enough to go out without a copy; the
+    # buffer is smaller than some of the values
+    from tempfile import TemporaryFile
+    f = TemporaryFile()
+    x = {'announce': 'http://localhost/announce', 'info': {'name': 'x', 'pieces': 'p' * 20000,
+         'piece length': 16384, 'length': 20000 / 20 * 16384}, 'comment': 'c' * 100}
+    e = Encoder(f.fileno(), size = 64)
+    e.encode(x)
+    e.encode(Items([('a', 'y' * 4096), ('b', [1] * 100)]))
+    e.flush()
+    f.seek(0)
+    assert f.read() == pybencode(x) + pybencode({'a': 'y' * 4096, 'b': [1] * 100})
+    from os import open as os_open, close, devnull, O_RDONLY
+    fd = os_open(devnull, O_RDONLY)
+    e = Encoder(fd)
+    e.encode('z' * 5000)
+    close(fd)
+    try:
+        e.flush()
+        assert 0
+    except IOError:
+        pass
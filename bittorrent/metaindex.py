@@ -0,0 +1,299 @@
+#!/usr/bin/env python
+
+# An index of the metadata of a directory of torrents, in one file that
+# lookups read through mmap, so that nothing is decoded to answer them.
+# build_index() decodes only the torrents that are new or changed since the
+# index was last built (by size and modification time); the records of the
+# others are copied over as they are.  The new index is written beside the
+# old one and renamed over it, so readers never see half of it.
+#
+# The file, all little-endian:
+#
+#   header      magic, count, and the offsets of the two tables
+#   records     one a torrent: RECORD, then the torrent path, announce URL
+#               and name, the file lengths (8 bytes each), and the file
+#               paths, each after its length (4 bytes)
+#   hash table  count (info hash, record offset) entries, by info hash
+#   name table  count hash table indices, by name
+#
+# usage: metaindex.py build <torrent directory> <index>
+#        metaindex.py hash <index> <info hash in hex>
+#        metaindex.py name <index> <name prefix>
+
+from sys import argv, exit
+from os import listdir, stat, rename, fsync
+from os.path import join, exists
+from struct import pack, unpack_from, calcsize, error as StructError
+from mmap import mmap, ACCESS_READ
+from binascii import a2b_hex, b2a_hex
+from bittorrent_get_peers import FileMeta
+
+MAGIC = 'BTMIDX01'
+HEADER = '<8sIIQQ'		# magic, count, unused, hash table, name table
+RECORD = '<IQQIIQQIII'		# size, length, piece length, pieces, files,
+				# mtime (us), torrent size, path, announce and
+				# name lengths
+HASH_ENTRY = '<20s4xQ'		# info hash, record offset
+NAME_ENTRY = '<I'		# hash table index
+
+# an info hash that answers digest() and hexdigest() like the sha1 object
+# of a FileMeta
+#
+class InfoHash(str):
+    def digest(self):
+        return str(self)
+
+    def hexdigest(self):
+        return b2a_hex(self)
+
+# the metadata of a torrent, as FileMeta has it (without the piece hashes),
+# read from its record at offset in m
+#
+class IndexedMeta:
+    def __init__(self, m, offset, info_hash):
+        size, self.length, self.piece_length, self.n_pieces, nfiles, self.mtime, \
+            self.size, path_len, announce_len, name_len = unpack_from(RECORD, m, offset)
+        p = offset + calcsize(RECORD)
+        self.file_name = m[p:p + path_len]
+        p += path_len
+        self.announce = m[p:p + announce_len]
+        p += announce_len
+        self.name = m[p:p + name_len]
+        p += name_len
+        lengths = unpack_from('<%dQ' % nfiles, m, p)
+        p += 8 * nfiles
+        self.files = []
+        for length in lengths:
+            n, = unpack_from('<I', m, p)
+            self.files.append((m[p + 4:p + 4 + n], length))
+            p += 4 + n
+        self.info_hash = InfoHash(info_hash)
+        dummy, self.last_piece_length = divmod(self.length, self.piece_length)
+
+# the name in the record at offset in buf
+#
+def record_name(buf, offset):
+    path_len, announce_len, name_len = unpack_from('<III', buf, offset + calcsize(RECORD) - 12)
+    p = offset + calcsize(RECORD) + path_len + announce_len
+    return buf[p:p + name_len]
+
+# the record of meta, a FileMeta of a torrent of size bytes modified at
+# mtime
+#
+def make_record(meta, mtime, size):
+    tail = meta.file_name + meta.announce + meta.name + \
+        pack('<%dQ' % len(meta.files), *[length for path, length in meta.files]) + \
+        ''.join([pack('<I', len(path)) + path for path, length in meta.files])
+    return pack(RECORD, calcsize(RECORD) + len(tail), meta.length, meta.piece_length,
+                meta.n_pieces, len(meta.files), mtime, size, len(meta.file_name),
+                len(meta.announce), len(meta.name)) + tail
+
+# a metadata index, open for lookups
+#
+class MetaIndex:
+    def __init__(self, path):
+        f = open(path, 'rb')
+        self.m = mmap(f.fileno(), 0, access = ACCESS_READ)
+        f.close()
+        magic, self.count, dummy, self.hash_table, self.name_table = unpack_from(HEADER, self.m)
+        if magic != MAGIC:
+            raise ValueError, "not a metadata index"
+
+    def __len__(self):
+        return self.count
+
+    def close(self):
+        self.m.close()
+
+    def _hash(self, i):
+        p = self.hash_table + i * calcsize(HASH_ENTRY)
+        return self.m[p:p + 20]
+
+    # the info hash and record offset of hash table entry i
+    def _entry(self, i):
+        p = self.hash_table + i * calcsize(HASH_ENTRY)
+        return unpack_from(HASH_ENTRY, self.m, p)
+
+    def _meta(self, i):
+        info_hash, offset = self._entry(i)
+        return IndexedMeta(self.m, offset, info_hash)
+
+    # the hash table index and the name of name table entry j
+    def _name(self, j):
+        i, = unpack_from(NAME_ENTRY, self.m, self.name_table + j * calcsize(NAME_ENTRY))
+        return i, record_name(self.m, self._entry(i)[1])
+
+    # the metadata of the torrent with info_hash (20 bytes), or None
+    def lookup(self, info_hash):
+        lo, hi = 0, self.count
+        while lo < hi:
+            mid = (lo + hi) / 2
+            if self._hash(mid) < info_hash:
+                lo = mid + 1
+            else:
+                hi = mid
+        if lo < self.count and self._hash(lo) == info_hash:
+            return self._meta(lo)
+        return None
+
+    # the metadata of the torrents whose names start with prefix, by name
+    def prefix(self, prefix):
+        lo, hi = 0, self.count
+        while lo < hi:
+            mid = (lo + hi) / 2
+            if self._name(mid)[1] < prefix:
+                lo = mid + 1
+            else:
+                hi = mid
+        result = []
+        while lo < self.count:
+            i, name = self._name(lo)
+            if not name.startswith(prefix):
+                break
+            result.append(self._meta(i))
+            lo += 1
+        return result
+
+    # (torrent path, mtime, size, info hash, record) of each torrent
+    def records(self):
+        for i in xrange(self.count):
+            info_hash, offset = self._entry(i)
+            size, length, piece_length, n_pieces, nfiles, mtime, torrent_size, path_len = \
+                unpack_from(RECORD, self.m, offset)[:8]
+            p = offset + calcsize(RECORD)
+            yield self.m[p:p + path_len], mtime, torrent_size, info_hash, self.m[offset:offset + size]
+
+# indexes the torrents in directory into the index file at path; returns
+# how many torrents were decoded, how many kept from the old index, and how
+# many could not be read
+#
+def build_index(directory, path):
+    old = {}
+    if exists(path):
+        index = MetaIndex(path)
+        for torrent, mtime, size, info_hash, record in index.records():
+            old[torrent] = (mtime, size, info_hash, record)
+        index.close()
+
+    entries = {}		# info hash -> (name, record)
+    decoded = kept = bad = 0
+    for name in sorted(listdir(directory)):
+        if not name.endswith('.torrent'):
+            continue
+        torrent = join(directory, name)
+        st = stat(torrent)
+        mtime = int(st.st_mtime * 1000000)
+        if old.has_key(torrent) and old[torrent][:2] == (mtime, st.st_size):
+            info_hash, record = old[torrent][2:]
+            kept += 1
+        else:
+            # FileMeta rejects what does not fit a record; what it lets
+            # through by mistake fails here, one torrent and not the index
+            try:
+                meta = FileMeta(torrent)
+                info_hash, record = meta.info_hash.digest(), make_record(meta, mtime, st.st_size)
+            except (ValueError, TypeError, KeyError, AttributeError, StructError,
+                    EnvironmentError):
+                bad += 1
+                continue
+            decoded += 1
+        # two files of one torrent: the first one counts
+        if not entries.has_key(info_hash):
+            entries[info_hash] = (record_name(record, 0), record)
+
+    hashes = sorted(entries.keys())
+    f = open(path + '.new', 'wb')
+    f.write('\0' * calcsize(HEADER))
+    offsets = []
+    for info_hash in hashes:
+        offsets.append(f.tell())
+        f.write(entries[info_hash][1])
+    hash_table = f.tell()
+    f.write(''.join([pack(HASH_ENTRY, hashes[i], offsets[i]) for i in xrange(len(hashes))]))
+    name_table = f.tell()
+    by_name = sorted(xrange(len(hashes)), key = lambda i: entries[hashes[i]][0])
+    f.write(''.join([pack(NAME_ENTRY, i) for i in by_name]))
+    f.seek(0)
+    f.write(pack(HEADER, MAGIC, len(hashes), 0, hash_table, name_table))
+    f.flush()
+    fsync(f.fileno())
+    f.close()
+    rename(path + '.new', path)
+    return decoded, kept, bad
+
+def test_metaindex():
+    from tempfile import mkdtemp
+    from shutil import rmtree
+    from time import time
+    from os import utime, remove
+    from bencode import bencode
+    directory = mkdtemp()
+    try:
+        def torrent(name, info, announce = None):
+            if announce is None:
+                announce = 'http://localhost/' + name
+            open(join(directory, name + '.torrent'), 'wb').write(
+                bencode({'announce': announce, 'info': info}))
+        torrent('a', {'name': 'alpha', 'piece length': 1024, 'pieces': 'x' * 60, 'length': 3000})
+        torrent('b', {'name': 'alphabet', 'piece length': 1024, 'pieces': 'y' * 40,
+                      'files': [{'length': 1000, 'path': ['s', 'one']},
+                                {'length': 1000, 'path': ['two']}]})
+        torrent('c', {'name': 'beta', 'piece length': 512, 'pieces': 'z' * 20, 'length': 1})
+        open(join(directory, 'bad.torrent'), 'wb').write('d')
+        # well bencoded, but not torrents
+        torrent('bad1', {'name': 'x', 'pieces': 'x' * 20, 'length': 1})
+        torrent('bad2', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20})
+        torrent('bad3', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20,
+                         'files': [{'path': ['one']}]})
+        torrent('bad4', {'name': 'x', 'piece length': 1024, 'pieces': 7, 'length': 1})
+        torrent('bad5', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20, 'files': 1})
+        # these would not pack into a record
+        torrent('bad6', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20,
+                         'files': [{'length': -1, 'path': ['one']},
+                                   {'length': 2, 'path': ['two']}]})
+        torrent('bad7', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20, 'length': 1}, 7)
+        torrent('bad8', {'name': 'x', 'piece length': 1024, 'pieces': 'x' * 20,
+                         'files': [{'length': 1, 'path': ['one', 2]}]})
+        index = join(directory, 'index')
+        assert build_index(directory, index) == (3, 0, 9)
+
+        x = MetaIndex(index)
+        assert len(x) == 3
+        b = FileMeta(join(directory, 'b.torrent'))
+        m = x.lookup(b.info_hash.digest())
+        assert m.info_hash.hexdigest() == b.info_hash.hexdigest()
+        for field in ['file_name', 'announce', 'name', 'length', 'piece_length', 'n_pieces',
+                      'last_piece_length', 'files']:
+            assert getattr(m, field) == getattr(b, field), field
+        assert x.lookup('\0' * 20) is None and x.lookup('\xff' * 20) is None
+        assert [m.name for m in x.prefix('alpha')] == ['alpha', 'alphabet']
+        assert [m.name for m in x.prefix('b')] == ['beta'] and x.prefix('gamma') == []
+        x.close()
+
+        # only what changed is decoded again
+        utime(join(directory, 'c.torrent'), (time() + 10, time() + 10))
+        remove(join(directory, 'a.torrent'))
+        assert build_index(directory, index) == (1, 1, 9)
+        x = MetaIndex(index)
+        assert [m.name for m in x.prefix('')] == ['alphabet', 'beta']
+        x.close()
+    finally:
+        rmtree(directory)
+
+if __name__ == '__main__':
+    if len(argv) == 4 and argv[1] == 'build':
+        print "%d decoded, %d kept, %d bad" % build_index(argv[2], argv[3])
+    elif len(argv) == 4 and argv[1] in ('hash', 'name'):
+        index = MetaIndex(argv[2])
+        if argv[1] == 'hash':
+            metas = [index.lookup(a2b_hex(argv[3]))]
+        else:
+            metas = index.prefix(argv[3])
+        for meta in metas:
+            if meta is not None:
+                print meta.info_hash.hexdigest(), meta.name, meta.length, meta.announce
+    else:
+        print "Usage: metaindex.py build <torrent directory> <index>"
+        print "       metaindex.py hash <index> <info hash in hex>"
+        print "       metaindex.py name <index> <name prefix>"
+        exit(2)
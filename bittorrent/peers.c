@@ -0,0 +1,119 @@
+/* The peer table.  See peers.h. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "peers.h"
+
+static const unsigned char v4mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+static unsigned int hash_peer(const unsigned char addr[16], uint16_t port)
+{
+    uint64_t a, b;
+
+    /* Fold the address and port into one word, and mix it so that every
+     * bit counts in the low bits the table uses (the finalizer of
+     * MurmurHash3); addresses from one subnet differ in few bits.
+     */
+    memcpy(&a, addr, 8);
+    memcpy(&b, addr + 8, 8);
+    a ^= (b ^ port) * 0x9e3779b97f4a7c15ULL;
+    a ^= a >> 33;
+    a *= 0xff51afd7ed558ccdULL;
+    a ^= a >> 33;
+    a *= 0xc4ceb9fe1a85ec53ULL;
+    a ^= a >> 33;
+    return((unsigned int) a);
+}
+
+/* The slot of the peer, or the empty slot where it goes. */
+static struct peer *probe(const struct peer_table *t, const unsigned char addr[16], uint16_t port)
+{
+    unsigned int i = hash_peer(addr, port) & (t->size - 1);
+    struct peer *p;
+
+    for (;; i = (i + 1) & (t->size - 1)) {
+        p = &t->slots[i];
+        if (p->seen == 0 || (p->port == port && memcmp(p->addr, addr, 16) == 0)) return(p);
+    }
+}
+
+static int alloc_slots(struct peer_table *t, unsigned int size)
+{
+    if ((t->slots = calloc(size, sizeof(struct peer))) == NULL) return(-1);
+    t->size = size;
+    return(0);
+}
+
+int peer_table_init(struct peer_table *t, unsigned int n)
+{
+    unsigned int size = 16;
+
+    /* At most three quarters full. */
+    while (size / 4 * 3 < n && size < 0x80000000U) size *= 2;
+    t->count = 0;
+    return(alloc_slots(t, size));
+}
+
+void peer_table_free(struct peer_table *t)
+{
+    free(t->slots);
+    t->slots = NULL;
+}
+
+static int grow(struct peer_table *t)
+{
+    struct peer *old = t->slots;
+    unsigned int size = t->size, i;
+
+    if (size >= 0x80000000U || alloc_slots(t, size * 2) < 0) {
+        t->slots = old;
+        return(-1);
+    }
+    for (i = 0; i < size; i++) {
+        if (old[i].seen != 0) *probe(t, old[i].addr, old[i].port) = old[i];
+    }
+    free(old);
+    return(0);
+}
+
+long peer_table_add(struct peer_table *t, const unsigned char *list, size_t len, int ipv6,
+                    uint32_t now)
+{
+    size_t entry = (ipv6 ? 18 : 6), n = len / entry, i;
+    const unsigned char *e;
+    unsigned char addr[16];
+    uint16_t port;
+    struct peer *p;
+    long added = 0;
+
+    memcpy(addr, v4mapped, 12);
+    for (i = 0, e = list; i < n; i++, e += entry) {
+        if (ipv6) memcpy(addr, e, 16);
+        else memcpy(addr + 12, e, 4);
+        port = (uint16_t) (e[entry - 2] << 8 | e[entry - 1]);
+
+        p = probe(t, addr, port);
+        if (p->seen == 0) {
+            if ((t->count + 1) > t->size / 4 * 3) {
+                if (grow(t) < 0) return(-1);
+                p = probe(t, addr, port);
+            }
+            memcpy(p->addr, addr, 16);
+            p->port = port;
+            p->first_seen = now;
+            t->count++;
+            added++;
+        }
+        p->last_seen = now;
+        p->seen++;
+    }
+    return(added);
+}
+
+struct peer *peer_table_find(const struct peer_table *t, const unsigned char addr[16],
+                             uint16_t port)
+{
+    struct peer *p = probe(t, addr, port);
+
+    return(p->seen != 0 ? p : NULL);
+}
@@ -0,0 +1,52 @@
+/* A table of peers, filled from compact peer lists.
+ *
+ * Trackers give peers as compact lists: 6 bytes a peer for IPv4 ("peers"),
+ * an address and a port in network order, and 18 for IPv6 ("peers6").
+ * peer_table_add() decodes a whole list into the table at once.  The
+ * table is a hash set with open addressing and linear probing, keyed by
+ * address and port, so a peer that several trackers give, or one tracker
+ * again and again, is in it once; it holds when each peer was first and
+ * last seen, and how many times it was listed.  IPv4 addresses are kept as
+ * IPv4-mapped IPv6 addresses, ::ffff:a.b.c.d, so that all entries are the
+ * same 32 bytes.
+ */
+
+#ifndef PEERS_H
+#define PEERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct peer {
+    unsigned char addr[16];	/* IPv6, or IPv4-mapped */
+    uint32_t first_seen;	/* times as the caller gives them */
+    uint32_t last_seen;
+    uint32_t seen;		/* times listed; 0 in an empty slot */
+    uint16_t port;		/* in host order */
+};
+
+struct peer_table {
+    struct peer *slots;
+    unsigned int size;		/* slots, a power of two */
+    unsigned int count;		/* peers */
+};
+
+/* An empty table with room for n peers before it grows.  Returns 0, or -1
+ * if memory runs out.
+ */
+int peer_table_init(struct peer_table *t, unsigned int n);
+void peer_table_free(struct peer_table *t);
+
+/* Add the peers of the compact list of len bytes at list, 18-byte IPv6
+ * entries if ipv6 is set and 6-byte IPv4 ones if not, seen at time now; a
+ * piece of an entry at the end is ignored.  Returns the number of peers
+ * that were not in the table yet, or -1 if memory runs out.
+ */
+long peer_table_add(struct peer_table *t, const unsigned char *list, size_t len, int ipv6,
+                    uint32_t now);
+
+/* The peer at addr (IPv6 or IPv4-mapped) and port, or NULL. */
+struct peer *peer_table_find(const struct peer_table *t, const unsigned char addr[16],
+                             uint16_t port);
+
+#endif
@@ -0,0 +1,125 @@
+# A table of peers filled from compact peer lists, with the hash set of
+# peers.c (make builds libbt.so): each peer is in it once, however many
+# lists give it, with when it was first and last seen.
+
+from ctypes import Structure, POINTER, c_ubyte, c_uint, c_uint16, c_uint32, c_char_p, c_size_t, \
+    c_int, c_long, byref, sizeof, string_at
+from struct import pack, unpack_from
+from socket import inet_ntop, inet_pton, AF_INET, AF_INET6, error
+from time import time
+from cbencode import libbt
+
+V4MAPPED = '\x00' * 10 + '\xff\xff'
+
+class Peer(Structure):
+    _fields_ = [('addr', c_ubyte * 16),
+                ('first_seen', c_uint32),
+                ('last_seen', c_uint32),
+                ('seen', c_uint32),
+                ('port', c_uint16)]
+
+# the fields of a peer as struct.unpack_from() sees them
+PEER_FORMAT = '=16s3IH2x'
+
+class PeerTableStruct(Structure):
+    _fields_ = [('slots', POINTER(Peer)),
+                ('size', c_uint),
+                ('count', c_uint)]
+
+libbt.peer_table_init.argtypes = [POINTER(PeerTableStruct), c_uint]
+libbt.peer_table_free.argtypes = [POINTER(PeerTableStruct)]
+libbt.peer_table_add.argtypes = [POINTER(PeerTableStruct), c_char_p, c_size_t, c_int, c_uint32]
+libbt.peer_table_add.restype = c_long
+libbt.peer_table_find.argtypes = [POINTER(PeerTableStruct), c_char_p, c_uint16]
+libbt.peer_table_find.restype = POINTER(Peer)
+
+# an address as the table keeps it: IPv6, or IPv4-mapped
+#
+def packed_address(ip):
+    if ':' in ip:
+        return inet_pton(AF_INET6, ip)
+    return V4MAPPED + inet_pton(AF_INET, ip)
+
+# the peers of the dictionary model, as compact "peers" and "peers6"
+# strings; entries that are not peers are left out
+#
+def compact(peers):
+    result = {AF_INET: [], AF_INET6: []}
+    for p in peers:
+        if type(p) != dict or type(p.get('ip')) != str or type(p.get('port')) not in (int, long) or \
+                not 0 <= p['port'] < 65536:
+            continue
+        family = ':' in p['ip'] and AF_INET6 or AF_INET
+        try:
+            result[family].append(inet_pton(family, p['ip']) + pack('!H', p['port']))
+        except error:
+            continue
+    return ''.join(result[AF_INET]), ''.join(result[AF_INET6])
+
+class PeerTable:
+    def __init__(self, n = 0):
+        self.table = PeerTableStruct()
+        if libbt.peer_table_init(byref(self.table), n) < 0:
+            raise MemoryError
+        self.initialized = True
+
+    def __del__(self):
+        if hasattr(self, 'initialized'):
+            libbt.peer_table_free(byref(self.table))
+
+    def __len__(self):
+        return int(self.table.count)
+
+    # adds the peers of a compact list, "peers6" if ipv6 is set and "peers"
+    # if not, seen at now (the time in seconds if not given); returns how
+    # many were new
+    def add(self, peers, ipv6 = False, now = None):
+        if now is None:
+            now = int(time())
+        n = libbt.peer_table_add(byref(self.table), peers, len(peers), ipv6, now)
+        if n < 0:
+            raise MemoryError
+        return n
+
+    # (first seen, last seen, times listed) of a peer, or None
+    def find(self, ip, port):
+        p = libbt.peer_table_find(byref(self.table), packed_address(ip), port)
+        if not p:
+            return None
+        return (p[0].first_seen, p[0].last_seen, p[0].seen)
+
+    # the peers, as (ip, port, first seen, last seen, times listed), in no
+    # particular order
+    def peers(self):
+        slots = string_at(self.table.slots, self.table.size * sizeof(Peer))
+        result = []
+        for offset in xrange(0, len(slots), sizeof(Peer)):
+            addr, first_seen, last_seen, seen, port = unpack_from(PEER_FORMAT, slots, offset)
+            if seen == 0:
+                continue
+            if addr[:12] == V4MAPPED:
+                ip = inet_ntop(AF_INET, addr[12:])
+            else:
+                ip = inet_ntop(AF_INET6, addr)
+            result.append((ip, port, first_seen, last_seen, seen))
+        return result
+
+def test_peers():
+    from struct import calcsize, pack
+    assert calcsize(PEER_FORMAT) == sizeof(Peer) == 32
+    t = PeerTable()
+    assert t.add('\x7f\x00\x00\x01\x1a\xe1\x0a\x00\x00\x02\x00\x50\x7f\x00\x00', now = 10) == 2
+    assert t.add('\x0a\x00\x00\x02\x00\x50\x0a\x00\x00\x02\x00\x51', now = 20) == 1
+    assert t.add('\x00' * 15 + '\x01\x1a\xe1', True, now = 30) == 1
+    assert len(t) == 4
+    assert t.find('10.0.0.2', 80) == (10, 20, 2) and t.find('10.0.0.2', 81) == (20, 20, 1)
+    assert t.find('::1', 6881) == (30, 30, 1) and t.find('127.0.0.1', 6881) == (10, 10, 1)
+    assert t.find('127.0.0.2', 6881) is None
+    assert sorted(t.peers()) == [('10.0.0.2', 80, 10, 20, 2), ('10.0.0.2', 81, 20, 20, 1),
+                                 ('127.0.0.1', 6881, 10, 10, 1), ('::1', 6881, 30, 30, 1)]
+
+    # growing, from a list with every peer twice
+    peers = ''.join([pack('!IH', 0x0a000000 + i, 6881) for i in xrange(10000)])
+    t = PeerTable()
+    assert t.add(peers + peers, now = 1) == 10000 and len(t) == 10000
+    assert t.find('10.0.39.15', 6881) == (1, 1, 2)
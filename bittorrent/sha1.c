@@ -0,0 +1,185 @@
+/* SHA-1 (FIPS 180-4).  See sha1.h. */
+
+#include <string.h>
+#include "sha1.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SHA_NI
+#endif
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Round i of the portable code, with function f and constant k. */
+#define ROUND(f, k) do { \
+        t = ROL(a, 5) + (f) + e + (k) + w[i]; \
+        e = d; d = c; c = ROL(b, 30); b = a; a = t; \
+    } while (0)
+
+int sha1_ni;
+
+static void sha1_blocks_generic(uint32_t h[5], const unsigned char *p, size_t n)
+{
+    uint32_t w[80], a, b, c, d, e, t;
+    int i;
+
+    for (; n > 0; n--, p += 64) {
+        for (i = 0; i < 16; i++)
+            w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 |
+                   (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for (i = 0; i < 20; i++) ROUND((b & c) | (~b & d), 0x5a827999);
+        for (; i < 40; i++) ROUND(b ^ c ^ d, 0x6ed9eba1);
+        for (; i < 60; i++) ROUND((b & c) | (b & d) | (c & d), 0x8f1bbcdc);
+        for (; i < 80; i++) ROUND(b ^ c ^ d, 0xca62c1d6);
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+}
+
+#ifdef HAVE_SHA_NI
+
+/* Four rounds, group g of the twenty, on message words m; m1, m2 and m3
+ * are the words of the next groups, which the message schedule works on
+ * while the rounds run.  e feeds the rounds and f is set up for the next
+ * group, so the two swap from one group to the next.
+ */
+#define ROUNDS4(g, e, f, m, m1, m2, m3) do { \
+        e = (g == 0 ? _mm_add_epi32(e, m) : _mm_sha1nexte_epu32(e, m)); \
+        f = abcd; \
+        if (g >= 3 && g <= 18) m1 = _mm_sha1msg2_epu32(m1, m); \
+        abcd = _mm_sha1rnds4_epu32(abcd, e, g / 5); \
+        if (g >= 1 && g <= 16) m3 = _mm_sha1msg1_epu32(m3, m); \
+        if (g >= 2 && g <= 17) m2 = _mm_xor_si128(m2, m); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_blocks_ni(uint32_t h[5], const unsigned char *p, size_t n)
+{
+    const __m128i order = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1, m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0x1b);
+    e0 = _mm_set_epi32((int) h[4], 0, 0, 0);
+
+    for (; n > 0; n--, p += 64) {
+        abcd_save = abcd;
+        e0_save = e0;
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p), order);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 16)), order);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 32)), order);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 48)), order);
+
+        ROUNDS4(0, e0, e1, m0, m1, m2, m3);
+        ROUNDS4(1, e1, e0, m1, m2, m3, m0);
+        ROUNDS4(2, e0, e1, m2, m3, m0, m1);
+        ROUNDS4(3, e1, e0, m3, m0, m1, m2);
+        ROUNDS4(4, e0, e1, m0, m1, m2, m3);
+        ROUNDS4(5, e1, e0, m1, m2, m3, m0);
+        ROUNDS4(6, e0, e1, m2, m3, m0, m1);
+        ROUNDS4(7, e1, e0, m3, m0, m1, m2);
+        ROUNDS4(8, e0, e1, m0, m1, m2, m3);
+        ROUNDS4(9, e1, e0, m1, m2, m3, m0);
+        ROUNDS4(10, e0, e1, m2, m3, m0, m1);
+        ROUNDS4(11, e1, e0, m3, m0, m1, m2);
+        ROUNDS4(12, e0, e1, m0, m1, m2, m3);
+        ROUNDS4(13, e1, e0, m1, m2, m3, m0);
+        ROUNDS4(14, e0, e1, m2, m3, m0, m1);
+        ROUNDS4(15, e1, e0, m3, m0, m1, m2);
+        ROUNDS4(16, e0, e1, m0, m1, m2, m3);
+        ROUNDS4(17, e1, e0, m1, m2, m3, m0);
+        ROUNDS4(18, e0, e1, m2, m3, m0, m1);
+        ROUNDS4(19, e1, e0, m3, m0, m1, m2);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) h, _mm_shuffle_epi32(abcd, 0x1b));
+    h[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+__attribute__((constructor))
+static void sha1_detect(void)
+{
+    unsigned int a, b, c, d;
+
+    /* SSSE3 and SSE4.1 in leaf 1, SHA in leaf 7. */
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1)) return;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_SHA)) return;
+    sha1_ni = 1;
+}
+
+#endif
+
+static void sha1_blocks(uint32_t h[5], const unsigned char *p, size_t n)
+{
+#ifdef HAVE_SHA_NI
+    if (sha1_ni) {
+        sha1_blocks_ni(h, p, n);
+        return;
+    }
+#endif
+    sha1_blocks_generic(h, p, n);
+}
+
+void sha1_init(struct sha1_ctx *c)
+{
+    c->h[0] = 0x67452301;
+    c->h[1] = 0xefcdab89;
+    c->h[2] = 0x98badcfe;
+    c->h[3] = 0x10325476;
+    c->h[4] = 0xc3d2e1f0;
+    c->len = 0;
+}
+
+void sha1_update(struct sha1_ctx *c, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    size_t used = c->len % 64, k;
+
+    c->len += n;
+    if (used > 0) {
+        k = (n < 64 - used ? n : 64 - used);
+        memcpy(c->buf + used, p, k);
+        p += k;
+        n -= k;
+        if (used + k < 64) return;
+        sha1_blocks(c->h, c->buf, 1);
+    }
+    /* Whole blocks straight from the data. */
+    sha1_blocks(c->h, p, n / 64);
+    memcpy(c->buf, p + n / 64 * 64, n % 64);
+}
+
+void sha1_final(struct sha1_ctx *c, unsigned char digest[SHA1_LEN])
+{
+    uint64_t bits = c->len * 8;
+    size_t used = c->len % 64;
+    int i;
+
+    /* A one bit, zeros, and the length in bits, to a whole block. */
+    c->buf[used++] = 0x80;
+    if (used > 56) {
+        memset(c->buf + used, 0, 64 - used);
+        sha1_blocks(c->h, c->buf, 1);
+        used = 0;
+    }
+    memset(c->buf + used, 0, 56 - used);
+    for (i = 0; i < 8; i++) c->buf[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+    sha1_blocks(c->h, c->buf, 1);
+
+    for (i = 0; i < SHA1_LEN; i++) digest[i] = (unsigned char) (c->h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+void sha1(const void *data, size_t n, unsigned char digest[SHA1_LEN])
+{
+    struct sha1_ctx c;
+
+    sha1_init(&c);
+    sha1_update(&c, data, n);
+    sha1_final(&c, digest);
+}
@@ -0,0 +1,32 @@
+/* SHA-1, as BitTorrent hashes pieces and info dicts with it.
+ *
+ * On x86 CPUs with the SHA extensions the blocks are hashed with the
+ * SHA-NI instructions, several times faster than the portable code; the
+ * choice is made once, when the library is loaded.
+ */
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_LEN 20		/* bytes in a digest */
+
+struct sha1_ctx {
+    uint32_t h[5];
+    uint64_t len;		/* bytes hashed so far */
+    unsigned char buf[64];	/* a partial block, len % 64 bytes */
+};
+
+/* Nonzero if the SHA-NI code is used; clear it to use the portable code. */
+extern int sha1_ni;
+
+void sha1_init(struct sha1_ctx *c);
+void sha1_update(struct sha1_ctx *c, const void *data, size_t n);
+void sha1_final(struct sha1_ctx *c, unsigned char digest[SHA1_LEN]);
+
+/* The digest of the n bytes at data. */
+void sha1(const void *data, size_t n, unsigned char digest[SHA1_LEN]);
+
+#endif
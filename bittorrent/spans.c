@@ -0,0 +1,94 @@
+/* Piece to file spans.  See spans.h. */
+
+#include <stdlib.h>
+#include "spans.h"
+
+int span_index_init(struct span_index *x, const long long *lengths, int nfiles,
+                    long long piece_length)
+{
+    long long npieces;
+    int f;
+
+    if (nfiles <= 0 || piece_length <= 0) return(-1);
+    if ((x->start = malloc((nfiles + 1) * sizeof(long long))) == NULL) return(-1);
+    x->start[0] = 0;
+    for (f = 0; f < nfiles; f++) {
+        if (lengths[f] < 0 || lengths[f] > (1LL << 62) - x->start[f]) {
+            free(x->start);
+            return(-1);
+        }
+        x->start[f + 1] = x->start[f] + lengths[f];
+    }
+    x->nfiles = nfiles;
+    x->piece_length = piece_length;
+    x->total = x->start[nfiles];
+    npieces = (x->total + piece_length - 1) / piece_length;
+    if (npieces > 0x7fffffff) {
+        free(x->start);
+        return(-1);
+    }
+    x->npieces = (int) npieces;
+    return(0);
+}
+
+void span_index_free(struct span_index *x)
+{
+    free(x->start);
+    x->start = NULL;
+}
+
+int span_file(const struct span_index *x, long long offset)
+{
+    int lo = 0, hi = x->nfiles - 1, mid;
+
+    if (offset < 0 || offset >= x->total) return(-1);
+
+    /* The first file that ends after offset; empty files end where they
+     * start, so they are passed over.
+     */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (x->start[mid + 1] > offset) hi = mid;
+        else lo = mid + 1;
+    }
+    return(lo);
+}
+
+int span_range(const struct span_index *x, long long offset, long long length,
+               struct bt_span *spans, int max)
+{
+    long long end = offset + length, n;
+    int f, k = 0;
+
+    if (offset < 0 || length < 0 || offset > x->total - length) return(-1);
+    if (length == 0) return(0);
+
+    for (f = span_file(x, offset); offset < end; f++) {
+        n = (x->start[f + 1] < end ? x->start[f + 1] : end) - offset;
+        if (n == 0) continue;
+        if (k < max) {
+            spans[k].file = f;
+            spans[k].offset = offset - x->start[f];
+            spans[k].length = n;
+        }
+        k++;
+        offset += n;
+    }
+    return(k);
+}
+
+int span_piece(const struct span_index *x, int i, struct bt_span *spans, int max)
+{
+    long long offset = (long long) i * x->piece_length;
+
+    if (i < 0 || i >= x->npieces) return(-1);
+    return(span_range(x, offset, (x->total - offset < x->piece_length ?
+                                  x->total - offset : x->piece_length), spans, max));
+}
+
+void span_file_pieces(const struct span_index *x, int f, int *first, int *end)
+{
+    *first = (int) (x->start[f] / x->piece_length);
+    if (x->start[f + 1] == x->start[f]) *end = *first;
+    else *end = (int) ((x->start[f + 1] - 1) / x->piece_length + 1);
+}
@@ -0,0 +1,59 @@
+/* Where the pieces of a torrent are in its files.
+ *
+ * The payload of a torrent is its files one after the other, and pieces
+ * are cut from it without regard for where one file ends and the next
+ * starts: a piece may cover the end of one file, many small files and the
+ * start of another.  A span index holds where each file starts in the
+ * payload, one array of nfiles + 1 offsets, and finds the file that holds
+ * any byte by binary search; from there the files of a piece, or of any
+ * byte range, follow in order.
+ */
+
+#ifndef SPANS_H
+#define SPANS_H
+
+struct span_index {
+    int nfiles;
+    int npieces;
+    long long piece_length;
+    long long total;		/* bytes in the payload */
+    long long *start;		/* start[f] is where file f starts; start[nfiles]
+                                 * is total */
+};
+
+/* Part of one file: length bytes at offset in file. */
+struct bt_span {
+    int file;
+    long long offset;
+    long long length;
+};
+
+/* Index nfiles files of the given lengths.  Returns 0, or -1 if an argument
+ * is bad or memory runs out.
+ */
+int span_index_init(struct span_index *x, const long long *lengths, int nfiles,
+                    long long piece_length);
+void span_index_free(struct span_index *x);
+
+/* The file that holds byte offset of the payload, or -1 if there is none.
+ * An empty file holds no bytes and is never the one.
+ */
+int span_file(const struct span_index *x, long long offset);
+
+/* The spans of the length bytes at offset, in order and without empty
+ * files, in spans; only the first max are stored.  Returns the number of
+ * spans, which may be more than max, or -1 if the bytes are not all in the
+ * payload.
+ */
+int span_range(const struct span_index *x, long long offset, long long length,
+               struct bt_span *spans, int max);
+
+/* The spans of piece i, as span_range() gives them. */
+int span_piece(const struct span_index *x, int i, struct bt_span *spans, int max);
+
+/* The pieces that hold bytes of file f: *first up to, not including, *end.
+ * They are none, *first == *end, for an empty file.
+ */
+void span_file_pieces(const struct span_index *x, int f, int *first, int *end);
+
+#endif
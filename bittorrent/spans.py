@@ -0,0 +1,98 @@
+# Where the pieces of a torrent are in its files, with the span index of
+# spans.c (make builds libbt.so): one array of file offsets, searched in
+# O(log n), instead of a walk over the file list for every piece.
+
+from ctypes import Structure, POINTER, c_int, c_longlong, byref
+from cbencode import libbt
+
+class Span(Structure):
+    _fields_ = [('file', c_int),
+                ('offset', c_longlong),
+                ('length', c_longlong)]
+
+class SpanIndex(Structure):
+    _fields_ = [('nfiles', c_int),
+                ('npieces', c_int),
+                ('piece_length', c_longlong),
+                ('total', c_longlong),
+                ('start', POINTER(c_longlong))]
+
+libbt.span_index_init.argtypes = [POINTER(SpanIndex), POINTER(c_longlong), c_int, c_longlong]
+libbt.span_index_free.argtypes = [POINTER(SpanIndex)]
+libbt.span_file.argtypes = [POINTER(SpanIndex), c_longlong]
+libbt.span_range.argtypes = [POINTER(SpanIndex), c_longlong, c_longlong, POINTER(Span), c_int]
+libbt.span_piece.argtypes = [POINTER(SpanIndex), c_int, POINTER(Span), c_int]
+libbt.span_file_pieces.argtypes = [POINTER(SpanIndex), c_int, POINTER(c_int), POINTER(c_int)]
+
+# the layout of the files of meta, a FileMeta; files are numbered as in
+# meta.files, and spans are (file, offset in file, length)
+#
+class FileSpans:
+    def __init__(self, meta):
+        lengths = (c_longlong * len(meta.files))(*[length for path, length in meta.files])
+        self.index = SpanIndex()
+        if libbt.span_index_init(byref(self.index), lengths, len(lengths), meta.piece_length) < 0:
+            raise ValueError, "bad file lengths"
+        self.files = meta.files
+        self.spans = (Span * 16)()
+
+    def __del__(self):
+        if hasattr(self, 'files'):
+            libbt.span_index_free(byref(self.index))
+
+    # the span list of what find(spans, max) stores, with more room if
+    # there was too little
+    def _spans(self, find):
+        n = find(self.spans, len(self.spans))
+        if n < 0:
+            raise ValueError, "not in the payload"
+        if n > len(self.spans):
+            self.spans = (Span * n)()
+            find(self.spans, n)
+        return [(s.file, s.offset, s.length) for s in self.spans[:n]]
+
+    # the spans of the length bytes at offset in the payload
+    def range(self, offset, length):
+        return self._spans(lambda spans, n: libbt.span_range(byref(self.index), offset, length, spans, n))
+
+    # the spans of piece i
+    def piece(self, i):
+        return self._spans(lambda spans, n: libbt.span_piece(byref(self.index), i, spans, n))
+
+    # the file that holds byte offset of the payload, or -1
+    def file_at(self, offset):
+        return libbt.span_file(byref(self.index), offset)
+
+    # the pieces that hold bytes of file f, as an xrange
+    def file_pieces(self, f):
+        first, end = c_int(), c_int()
+        libbt.span_file_pieces(byref(self.index), f, byref(first), byref(end))
+        return xrange(first.value, end.value)
+
+def test_spans():
+    class Meta:
+        pass
+    meta = Meta()
+    meta.piece_length = 1024
+    meta.files = [('a', 3000), ('e', 0), ('b', 5000), ('c', 2000)]
+    x = FileSpans(meta)
+    assert x.index.npieces == 10 and x.index.total == 10000
+    assert x.piece(0) == [(0, 0, 1024)]
+    assert x.piece(2) == [(0, 2048, 952), (2, 0, 72)]
+    assert x.piece(9) == [(3, 1216, 784)]
+    assert [x.file_at(o) for o in [0, 2999, 3000, 7999, 8000, 9999, 10000, -1]] == \
+        [0, 0, 2, 2, 3, 3, -1, -1]
+    assert x.range(2999, 5002) == [(0, 2999, 1), (2, 0, 5000), (3, 0, 1)]
+    assert x.range(5, 0) == []
+    for offset, length in [(-1, 1), (9999, 2), (0, -1)]:
+        try:
+            x.range(offset, length)
+            assert 0
+        except ValueError:
+            pass
+    assert [list(x.file_pieces(f)) for f in range(4)] == [[0, 1, 2], [], [2, 3, 4, 5, 6, 7], [7, 8, 9]]
+
+    # more spans than fit at first
+    meta.files = [('f%d' % i, 10) for i in xrange(1000)]
+    x = FileSpans(meta)
+    assert x.piece(1) == [(102, 4, 6)] + [(i, 0, 10) for i in xrange(103, 204)] + [(204, 0, 8)]
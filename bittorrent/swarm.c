@@ -0,0 +1,733 @@
+/* The swarm simulator.  See swarm.h. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "swarm.h"
+
+#define WORDS(n) (((n) + 63) / 64)
+#define BIT(b, i) (((b)[(i) / 64] >> ((i) % 64)) & 1)
+#define SET(b, i) ((b)[(i) / 64] |= 1ULL << ((i) % 64))
+#define CLEAR(b, i) ((b)[(i) / 64] &= ~(1ULL << ((i) % 64)))
+
+#define RANDOM_FIRST 4		/* pieces a leecher gets at random */
+#define SCAN_STEPS 4		/* a wanted piece: steps through the pieces
+                                 * by availability, before going through
+                                 * all that are wanted */
+#define PARTIALS 32		/* partial pieces a peer keeps */
+
+enum { WAITING, ACTIVE, GONE };
+enum { EV_ARRIVE, EV_PIECE, EV_RECHOKE, EV_LEAVE };
+
+/* An upload to a neighbor that a peer has unchoked. */
+struct slot {
+    int to;			/* -1 if the slot is free */
+    int piece;			/* -1 if nothing is on its way */
+    double base;		/* bytes of it the receiver had already */
+    double start;
+    unsigned version;		/* events of earlier transfers are stale */
+};
+
+/* What a peer got of a piece before the transfer was choked. */
+struct partial {
+    int piece;
+    double bytes;
+};
+
+struct peer {
+    int state;
+    int leecher;		/* index in completion; -1 for a seed */
+    double up;			/* bytes/s */
+    double joined;
+    uint64_t *have;
+    uint64_t *pending;		/* on their way to it */
+    int count, npending;
+    int endgame;		/* some pieces may come twice */
+    struct partial partial[PARTIALS];	/* oldest first */
+    int npartial;
+    int *nbr, nnbr;		/* neighbors, at most 2 * neighbors */
+    double *got;		/* bytes from nbr[j] since the last rechoke */
+    struct slot *slots;
+    int optimistic;		/* the peer it unchoked optimistically, or -1 */
+    int optimistic_left;	/* rechokes until it changes */
+    int active_index;		/* in active[] */
+};
+
+struct event {
+    double t;
+    int type, peer, slot;
+    unsigned version;
+};
+
+struct swarm {
+    const struct swarm_params *p;
+    int words, npeers, maxnbr;
+    struct peer *peers;
+    int *active, nactive;
+    /* Availability: order[] holds the pieces by the number of peers that
+     * have them, those with a at order[first[a]] up to order[first[a + 1]];
+     * pos[] is where each piece is in order[].
+     */
+    int *avail, *order, *pos, *first;
+    struct event *heap;
+    int nheap, maxheap;
+    int *cand;			/* scratch, one entry a neighbor */
+    uint64_t *wanted;		/* scratch, a bitfield */
+    uint64_t rng;
+    double now;
+    int unfinished;		/* leechers not done */
+    double *completion;
+    struct swarm_stats *stats;
+    int nomem;
+};
+
+/* The bitfield loops are built for several x86 instruction sets, one of
+ * which is picked when libbt.so is loaded.  Elsewhere, and on macOS, whose
+ * loader cannot pick, they are plain functions.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__APPLE__)
+#define CLONES(...) __attribute__((target_clones(__VA_ARGS__)))
+#else
+#define CLONES(...)
+#endif
+
+/* The pieces in a that are in neither b nor c, into w; returns how many. */
+CLONES("avx2", "popcnt", "default")
+static int wanted(const uint64_t *a, const uint64_t *b, const uint64_t *c, uint64_t *w, int words)
+{
+    int i, n = 0;
+
+    for (i = 0; i < words; i++) {
+        w[i] = a[i] & ~b[i] & ~c[i];
+        n += __builtin_popcountll(w[i]);
+    }
+    return(n);
+}
+
+/* Whether a has a piece that b has not.  Without an early way out the loop
+ * vectorizes, and is faster for it than one that stops.
+ */
+CLONES("avx2", "default")
+static int has_more(const uint64_t *a, const uint64_t *b, int words)
+{
+    uint64_t any = 0;
+    int i;
+
+    for (i = 0; i < words; i++) any |= a[i] & ~b[i];
+    return(any != 0);
+}
+
+/* Piece k, counting from 0, of those in w. */
+static int nth_piece(const uint64_t *bits, int words, int k)
+{
+    uint64_t w;
+    int i, n;
+
+    for (i = 0; i < words; i++) {
+        w = bits[i];
+        n = __builtin_popcountll(w);
+        if (k < n) {
+            while (k-- > 0) w &= w - 1;
+            return(i * 64 + __builtin_ctzll(w));
+        }
+        k -= n;
+    }
+    return(-1);
+}
+
+static uint64_t rnd(struct swarm *s)
+{
+    /* xorshift64* */
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return(s->rng * 0x2545f4914f6cdd1dULL);
+}
+
+static int rnd_below(struct swarm *s, int n)
+{
+    return((int) ((rnd(s) >> 11) % (uint64_t) n));
+}
+
+static double rnd_exp(struct swarm *s, double rate)
+{
+    return(-log(1.0 - (rnd(s) >> 11) * (1.0 / 9007199254740992.0)) / rate);
+}
+
+static void push(struct swarm *s, double t, int type, int peer, int slot, unsigned version)
+{
+    struct event e, *heap;
+    int i;
+
+    if (s->nheap == s->maxheap) {
+        if ((heap = realloc(s->heap, 2 * s->maxheap * sizeof(struct event))) == NULL) {
+            s->nomem = 1;
+            return;
+        }
+        s->heap = heap;
+        s->maxheap *= 2;
+    }
+    e.t = t;
+    e.type = type;
+    e.peer = peer;
+    e.slot = slot;
+    e.version = version;
+    for (i = s->nheap++; i > 0 && s->heap[(i - 1) / 2].t > t; i = (i - 1) / 2)
+        s->heap[i] = s->heap[(i - 1) / 2];
+    s->heap[i] = e;
+}
+
+static struct event pop(struct swarm *s)
+{
+    struct event top = s->heap[0], last = s->heap[--s->nheap];
+    int i = 0, c;
+
+    while ((c = 2 * i + 1) < s->nheap) {
+        if (c + 1 < s->nheap && s->heap[c + 1].t < s->heap[c].t) c++;
+        if (last.t <= s->heap[c].t) break;
+        s->heap[i] = s->heap[c];
+        i = c;
+    }
+    s->heap[i] = last;
+    return(top);
+}
+
+static void move_piece(struct swarm *s, int piece, int to)
+{
+    int other = s->order[to], from = s->pos[piece];
+
+    s->order[to] = piece;
+    s->pos[piece] = to;
+    s->order[from] = other;
+    s->pos[other] = from;
+}
+
+static void avail_inc(struct swarm *s, int piece)
+{
+    int a = s->avail[piece];
+
+    /* To the end of its bucket, which becomes the start of the next. */
+    move_piece(s, piece, s->first[a + 1] - 1);
+    s->first[a + 1]--;
+    s->avail[piece]++;
+}
+
+static void avail_dec(struct swarm *s, int piece)
+{
+    int a = s->avail[piece];
+
+    move_piece(s, piece, s->first[a]);
+    s->first[a]++;
+    s->avail[piece]--;
+}
+
+static double piece_size(struct swarm *s, int piece)
+{
+    return(piece == s->p->npieces - 1 ? s->p->last_piece_length : s->p->piece_length);
+}
+
+static double slot_rate(struct swarm *s, struct peer *u)
+{
+    return(u->up / s->p->upload_slots);
+}
+
+/* When the first transfer of piece to d ends, or -1 if nobody is sending
+ * it.
+ */
+static double arrival(struct swarm *s, struct peer *d, int piece)
+{
+    struct peer *v;
+    struct slot *sl;
+    int j, k, id = (int) (d - s->peers);
+    double t, first = -1;
+
+    for (j = 0; j < d->nnbr; j++) {
+        v = &s->peers[d->nbr[j]];
+        for (k = 0; k < s->p->upload_slots; k++) {
+            sl = &v->slots[k];
+            if (sl->to != id || sl->piece != piece) continue;
+            t = sl->start + (piece_size(s, piece) - sl->base) / slot_rate(s, v);
+            if (first < 0 || t < first) first = t;
+        }
+    }
+    return(first);
+}
+
+/* The piece that d asks u for, or -1. */
+static int pick(struct swarm *s, struct peer *u, struct peer *d)
+{
+    uint64_t *want = s->wanted, w;
+    int n = wanted(u->have, d->have, d->pending, want, s->words);
+    int best = -1, ties = 0, i, piece;
+    double t, latest = 0;
+
+    /* A partial piece first, as clients finish them before they start
+     * others.
+     */
+    for (i = 0; i < d->npartial; i++) {
+        if (BIT(want, d->partial[i].piece)) return(d->partial[i].piece);
+    }
+    if (n > 0 && d->count < RANDOM_FIRST) return(nth_piece(want, s->words, rnd_below(s, n)));
+
+    if (n > 0) {
+        /* With many to choose from, one is soon found among the rarest;
+         * a step of this is cheaper than one of the loop after it.
+         */
+        for (i = 0; i < s->p->npieces && i < SCAN_STEPS * n; i++) {
+            piece = s->order[i];
+            if (BIT(want, piece)) return(piece);
+        }
+        for (i = 0; i < s->words; i++) {
+            for (w = want[i]; w != 0; w &= w - 1) {
+                piece = i * 64 + __builtin_ctzll(w);
+                if (best < 0 || s->avail[piece] < s->avail[best]) {
+                    best = piece;
+                    ties = 1;
+                } else if (s->avail[piece] == s->avail[best] && rnd_below(s, ++ties) == 0) {
+                    best = piece;
+                }
+            }
+        }
+        return(best);
+    }
+
+    /* Endgame: all it lacks is on its way.  It asks u too for the piece
+     * that comes last, if u would send it sooner.
+     */
+    if (d->npending == 0 || d->npending != s->p->npieces - d->count) return(-1);
+    if (wanted(u->have, d->have, d->have, want, s->words) == 0) return(-1);
+    for (i = 0; i < s->words; i++) {
+        for (w = want[i]; w != 0; w &= w - 1) {
+            piece = i * 64 + __builtin_ctzll(w);
+            t = arrival(s, d, piece) - piece_size(s, piece) / slot_rate(s, u);
+            if (t > s->now && (best < 0 || t > latest)) {
+                best = piece;
+                latest = t;
+            }
+        }
+    }
+    if (best >= 0) d->endgame = 1;
+    return(best);
+}
+
+/* Counts bytes that u sent to d. */
+static void credit(struct swarm *s, struct peer *u, struct peer *d, double bytes)
+{
+    int j, u_id = (int) (u - s->peers);
+
+    if (u->leecher < 0) s->stats->seed_bytes += bytes;
+    else s->stats->leecher_bytes += bytes;
+    for (j = 0; d->nbr[j] != u_id; j++)
+        ;
+    d->got[j] += bytes;
+}
+
+static void start(struct swarm *s, struct peer *u, int k)
+{
+    struct slot *sl = &u->slots[k];
+    struct peer *d = &s->peers[sl->to];
+    int i;
+
+    sl->piece = pick(s, u, d);
+    if (sl->piece < 0) return;
+    if (!BIT(d->pending, sl->piece)) {
+        SET(d->pending, sl->piece);
+        d->npending++;
+    }
+    sl->base = 0;
+    for (i = 0; i < d->npartial; i++) {
+        if (d->partial[i].piece == sl->piece) {
+            sl->base = d->partial[i].bytes;
+            d->npartial--;
+            memmove(&d->partial[i], &d->partial[i + 1], (d->npartial - i) * sizeof(struct partial));
+            break;
+        }
+    }
+    sl->start = s->now;
+    sl->version++;
+    push(s, s->now + (piece_size(s, sl->piece) - sl->base) / slot_rate(s, u), EV_PIECE,
+         (int) (u - s->peers), k, sl->version);
+}
+
+/* Stop what slot k of u is sending.  If keep is set and nobody else is
+ * sending the piece, the receiver keeps what it got as a partial piece;
+ * if not, that is wasted.
+ */
+static void cancel(struct swarm *s, struct peer *u, int k, int keep)
+{
+    struct slot *sl = &u->slots[k];
+    struct peer *d;
+    int piece = sl->piece;
+    double sent;
+
+    if (piece < 0) return;
+    d = &s->peers[sl->to];
+    sent = (s->now - sl->start) * slot_rate(s, u);
+    credit(s, u, d, sent);
+    sl->piece = -1;
+    sl->version++;
+    if (BIT(d->have, piece) || (d->endgame && arrival(s, d, piece) >= 0)) {
+        s->stats->wasted_bytes += sl->base + sent;
+        return;
+    }
+    CLEAR(d->pending, piece);
+    d->npending--;
+    if (!keep) {
+        s->stats->wasted_bytes += sl->base + sent;
+        return;
+    }
+    if (d->npartial == PARTIALS) {
+        s->stats->wasted_bytes += d->partial[0].bytes;
+        d->npartial--;
+        memmove(&d->partial[0], &d->partial[1], d->npartial * sizeof(struct partial));
+    }
+    d->partial[d->npartial].piece = piece;
+    d->partial[d->npartial++].bytes = sl->base + sent;
+}
+
+static int connected(struct peer *a, int b)
+{
+    int j;
+
+    for (j = 0; j < a->nnbr; j++) {
+        if (a->nbr[j] == b) return(1);
+    }
+    return(0);
+}
+
+/* Connects peer i to random peers, up to the number of neighbors, as
+ * announcing to the tracker would.
+ */
+static void connect_peers(struct swarm *s, int i)
+{
+    struct peer *a = &s->peers[i], *b;
+    int tries, j;
+
+    for (tries = 0; a->nnbr < s->p->neighbors && tries < 4 * s->p->neighbors && s->nactive > 0;
+         tries++) {
+        j = s->active[rnd_below(s, s->nactive)];
+        b = &s->peers[j];
+        if (j == i || b->nnbr == s->maxnbr || connected(a, j)) continue;
+        a->nbr[a->nnbr] = j;
+        a->got[a->nnbr++] = 0;
+        b->nbr[b->nnbr] = i;
+        b->got[b->nnbr++] = 0;
+    }
+}
+
+static void join(struct swarm *s, int i)
+{
+    struct peer *a = &s->peers[i];
+
+    a->state = ACTIVE;
+    a->joined = s->now;
+    connect_peers(s, i);
+    a->active_index = s->nactive;
+    s->active[s->nactive++] = i;
+}
+
+static void leave(struct swarm *s, int i)
+{
+    struct peer *a = &s->peers[i], *b;
+    int j, k, m, piece;
+    uint64_t w;
+
+    for (k = 0; k < s->p->upload_slots; k++) {
+        cancel(s, a, k, 1);
+        a->slots[k].to = -1;
+    }
+    for (j = 0; j < a->nnbr; j++) {
+        b = &s->peers[a->nbr[j]];
+        for (k = 0; k < s->p->upload_slots; k++) {
+            if (b->slots[k].to != i) continue;
+            cancel(s, b, k, 0);
+            b->slots[k].to = -1;
+        }
+        for (m = 0; m < b->nnbr && b->nbr[m] != i; m++)
+            ;
+        b->nnbr--;
+        b->nbr[m] = b->nbr[b->nnbr];
+        b->got[m] = b->got[b->nnbr];
+        if (b->optimistic == i) b->optimistic = -1;
+    }
+    a->nnbr = 0;
+    for (j = 0; j < s->words; j++) {
+        for (w = a->have[j]; w != 0; w &= w - 1) {
+            piece = j * 64 + __builtin_ctzll(w);
+            avail_dec(s, piece);
+        }
+    }
+    a->state = GONE;
+    s->active[a->active_index] = s->active[--s->nactive];
+    s->peers[s->active[a->active_index]].active_index = a->active_index;
+}
+
+/* Choose whom u uploads to. */
+static void rechoke_peer(struct swarm *s, int u_id)
+{
+    struct peer *u = &s->peers[u_id], *v;
+    int U = s->p->upload_slots, *cand = s->cand;
+    int n = 0, chosen = 0, j, k, m, best, t, keep;
+
+    /* The interested neighbors, in random order. */
+    for (j = 0; j < u->nnbr; j++) {
+        v = &s->peers[u->nbr[j]];
+        if (v->count == s->p->npieces || !has_more(u->have, v->have, s->words)) continue;
+        m = rnd_below(s, n + 1);
+        cand[n] = cand[m];
+        cand[m] = j;
+        n++;
+    }
+
+    if (u->count == s->p->npieces) {
+        /* A seed: U of them at random. */
+        chosen = (n < U ? n : U);
+    } else {
+        /* The U - 1 that gave most, by selection, and one optimistic. */
+        for (chosen = 0; chosen < U - 1 && chosen < n; chosen++) {
+            best = chosen;
+            for (m = chosen + 1; m < n; m++) {
+                if (u->got[cand[m]] > u->got[cand[best]]) best = m;
+            }
+            t = cand[chosen];
+            cand[chosen] = cand[best];
+            cand[best] = t;
+        }
+        keep = -1;
+        if (u->optimistic >= 0 && --u->optimistic_left > 0) {
+            for (m = chosen; m < n; m++) {
+                if (u->nbr[cand[m]] == u->optimistic) keep = m;
+            }
+        }
+        if (keep < 0 && chosen < n) {
+            keep = chosen + rnd_below(s, n - chosen);
+            u->optimistic = u->nbr[cand[keep]];
+            u->optimistic_left = s->p->optimistic_rounds;
+        }
+        if (keep >= 0) {
+            t = cand[chosen];
+            cand[chosen] = cand[keep];
+            cand[keep] = t;
+            chosen++;
+        }
+    }
+
+    /* Choke the slots no longer chosen, and fill the free ones. */
+    for (j = 0; j < chosen; j++) cand[j] = u->nbr[cand[j]];
+    for (k = 0; k < U; k++) {
+        if (u->slots[k].to < 0) continue;
+        for (j = 0; j < chosen && cand[j] != u->slots[k].to; j++)
+            ;
+        if (j == chosen) {
+            cancel(s, u, k, 1);
+            u->slots[k].to = -1;
+        } else {
+            cand[j] = -1;
+            if (u->slots[k].piece < 0) start(s, u, k);
+        }
+    }
+    for (j = 0, k = 0; j < chosen; j++) {
+        if (cand[j] < 0) continue;
+        while (u->slots[k].to >= 0) k++;
+        u->slots[k].to = cand[j];
+        start(s, u, k);
+    }
+    for (j = 0; j < u->nnbr; j++) u->got[j] = 0;
+}
+
+static void piece_done(struct swarm *s, int u_id, int k)
+{
+    struct peer *u = &s->peers[u_id], *d, *v;
+    struct slot *sl = &u->slots[k];
+    int piece = sl->piece, d_id = sl->to, j, m;
+
+    d = &s->peers[d_id];
+    sl->piece = -1;
+    credit(s, u, d, piece_size(s, piece) - sl->base);
+
+    SET(d->have, piece);
+    d->count++;
+    avail_inc(s, piece);
+    CLEAR(d->pending, piece);
+    d->npending--;
+
+    /* Endgame: the other transfers of the piece are cancelled. */
+    for (j = 0; d->endgame && j < d->nnbr; j++) {
+        v = &s->peers[d->nbr[j]];
+        for (m = 0; m < s->p->upload_slots; m++) {
+            if (v->slots[m].to == d_id && v->slots[m].piece == piece) {
+                cancel(s, v, m, 0);
+                start(s, v, m);
+            }
+        }
+    }
+
+    if (d->count == s->p->npieces) {
+        s->completion[d->leecher] = s->now - d->joined;
+        s->stats->finished++;
+        s->unfinished--;
+        if (s->p->linger >= 0) push(s, s->now + s->p->linger, EV_LEAVE, d_id, 0, 0);
+    } else {
+        /* It has something new for those it uploads to. */
+        for (m = 0; m < s->p->upload_slots; m++) {
+            if (d->slots[m].to >= 0 && d->slots[m].piece < 0) start(s, d, m);
+        }
+    }
+    start(s, u, k);
+}
+
+static int setup(struct swarm *s, const struct swarm_params *p)
+{
+    int i, k, U = p->upload_slots;
+    size_t words;
+    uint64_t *bits;
+
+    s->p = p;
+    s->words = WORDS(p->npieces);
+    s->npeers = p->seeds + p->leechers;
+    s->maxnbr = 2 * p->neighbors;
+    s->maxheap = 2 * s->npeers + 16;
+    words = (size_t) s->words;
+    s->peers = calloc(s->npeers, sizeof(struct peer));
+    s->active = malloc(s->npeers * sizeof(int));
+    s->avail = calloc(p->npieces, sizeof(int));
+    s->order = malloc(p->npieces * sizeof(int));
+    s->pos = malloc(p->npieces * sizeof(int));
+    s->first = malloc((s->npeers + 2) * sizeof(int));
+    s->heap = malloc(s->maxheap * sizeof(struct event));
+    s->cand = malloc(s->maxnbr * sizeof(int));
+    s->wanted = malloc(words * sizeof(uint64_t));
+    bits = calloc(2 * s->npeers * words, sizeof(uint64_t));
+    if (s->peers == NULL || s->active == NULL || s->avail == NULL || s->order == NULL ||
+        s->pos == NULL || s->first == NULL || s->heap == NULL || s->cand == NULL ||
+        s->wanted == NULL || bits == NULL) {
+        free(bits);
+        return(-1);
+    }
+
+    for (i = 0; i < p->npieces; i++) s->order[i] = s->pos[i] = i;
+    s->first[0] = 0;
+    for (i = 1; i < s->npeers + 2; i++) s->first[i] = p->npieces;
+
+    for (i = 0; i < s->npeers; i++) {
+        struct peer *a = &s->peers[i];
+
+        a->leecher = (i < p->seeds ? -1 : i - p->seeds);
+        a->up = (i < p->seeds ? p->seed_up : p->leecher_up);
+        a->have = bits + 2 * i * words;
+        a->pending = a->have + words;
+        a->nbr = malloc(s->maxnbr * sizeof(int));
+        a->got = malloc(s->maxnbr * sizeof(double));
+        a->slots = malloc(U * sizeof(struct slot));
+        if (a->nbr == NULL || a->got == NULL || a->slots == NULL) return(-1);
+        for (k = 0; k < U; k++) {
+            a->slots[k].to = -1;
+            a->slots[k].piece = -1;
+            a->slots[k].version = 0;
+        }
+        a->optimistic = -1;
+    }
+    return(0);
+}
+
+static void teardown(struct swarm *s)
+{
+    int i;
+
+    if (s->peers != NULL) {
+        free(s->peers[0].have);
+        for (i = 0; i < s->npeers; i++) {
+            free(s->peers[i].nbr);
+            free(s->peers[i].got);
+            free(s->peers[i].slots);
+        }
+    }
+    free(s->peers);
+    free(s->active);
+    free(s->avail);
+    free(s->order);
+    free(s->pos);
+    free(s->first);
+    free(s->heap);
+    free(s->cand);
+    free(s->wanted);
+}
+
+int swarm_run(const struct swarm_params *p, double *completion, struct swarm_stats *stats)
+{
+    struct swarm s;
+    struct event e;
+    int i, j, next_leecher;
+
+    if (p->npieces <= 0 || p->piece_length <= 0 || p->last_piece_length <= 0 ||
+        p->last_piece_length > p->piece_length || p->seeds < 1 || p->leechers < 0 ||
+        p->seed_up <= 0 || p->leecher_up <= 0 || p->arrival_rate < 0 || p->neighbors < 1 ||
+        p->upload_slots < 1 || p->rechoke_interval <= 0 || p->optimistic_rounds < 1 ||
+        p->max_time <= 0)
+        return(-1);
+
+    memset(&s, 0, sizeof(s));
+    memset(stats, 0, sizeof(*stats));
+    if (setup(&s, p) < 0) {
+        teardown(&s);
+        return(-1);
+    }
+    s.rng = p->random_seed * 2 + 1;
+    s.completion = completion;
+    s.stats = stats;
+    s.unfinished = p->leechers;
+    for (i = 0; i < p->leechers; i++) completion[i] = -1;
+
+    /* The seeds have it all; the leechers join at once, or one by one. */
+    for (i = 0; i < p->seeds; i++) {
+        for (j = 0; j < p->npieces; j++) {
+            SET(s.peers[i].have, j);
+            avail_inc(&s, j);
+        }
+        s.peers[i].count = p->npieces;
+        join(&s, i);
+    }
+    next_leecher = p->seeds;
+    if (p->arrival_rate == 0) {
+        for (; next_leecher < s.npeers; next_leecher++) join(&s, next_leecher);
+    } else if (next_leecher < s.npeers) {
+        push(&s, rnd_exp(&s, p->arrival_rate), EV_ARRIVE, next_leecher, 0, 0);
+    }
+    push(&s, 0, EV_RECHOKE, 0, 0, 0);
+
+    while (s.unfinished > 0 && s.nheap > 0 && !s.nomem) {
+        e = pop(&s);
+        if (e.t > p->max_time) break;
+        s.now = e.t;
+        stats->events++;
+        switch (e.type) {
+        case EV_ARRIVE:
+            join(&s, e.peer);
+            if (++next_leecher < s.npeers)
+                push(&s, s.now + rnd_exp(&s, p->arrival_rate), EV_ARRIVE, next_leecher, 0, 0);
+            break;
+        case EV_RECHOKE:
+            for (i = 0; i < s.nactive; i++) {
+                j = s.active[i];
+                /* Those that lost half their neighbors ask for more. */
+                if (s.peers[j].count < p->npieces && 2 * s.peers[j].nnbr < p->neighbors)
+                    connect_peers(&s, j);
+                rechoke_peer(&s, j);
+            }
+            push(&s, s.now + p->rechoke_interval, EV_RECHOKE, 0, 0, 0);
+            break;
+        case EV_PIECE:
+            if (s.peers[e.peer].slots[e.slot].version == e.version &&
+                s.peers[e.peer].slots[e.slot].piece >= 0)
+                piece_done(&s, e.peer, e.slot);
+            break;
+        case EV_LEAVE:
+            leave(&s, e.peer);
+            break;
+        }
+    }
+    stats->end_time = (s.unfinished == 0 ? s.now : p->max_time);
+    teardown(&s);
+    return(s.nomem ? -1 : 0);
+}
@@ -0,0 +1,65 @@
+/* A discrete-event simulation of a BitTorrent swarm.
+ *
+ * Seeds and leechers exchange the pieces of one torrent.  Each peer
+ * connects to some random peers when it joins, and uploads to a few of them
+ * at a time, each getting an equal share of its upload rate; download
+ * rates are not limited.  Every rechoke interval each peer chooses whom to
+ * upload to: a leecher the neighbors that gave it most in the last
+ * interval, plus one optimistic unchoke that changes every few intervals;
+ * a seed random interested neighbors.  A leecher asks for a random piece
+ * while it has fewer than four and for the rarest piece in the swarm after
+ * that; when all the pieces it lacks are on their way, it is in endgame
+ * and asks for them again from other peers, cancelling the other transfers
+ * of a piece when the first one ends.  A transfer that is choked leaves
+ * the receiver a partial piece, as the blocks of a piece come one by one,
+ * and it asks for its partial pieces first.  A leecher that has lost half
+ * its neighbors to peers leaving connects to more at the next rechoke.
+ *
+ * Have-bitfields are arrays of 64-bit words, and the piece choice and the
+ * interest test are word-wise AND and popcount, compiled for AVX2 and
+ * POPCNT where the CPU has them; the pieces are kept in the order of their
+ * availability, so the rarest wanted one is found without looking at all.
+ * 1000 leechers of a torrent of 10000 pieces, 10^7 piece transfers, take
+ * about ten seconds, and 10000 leechers about three minutes, on one core.
+ */
+
+#ifndef SWARM_H
+#define SWARM_H
+
+struct swarm_params {
+    int npieces;
+    double piece_length;	/* bytes, of all pieces but the last */
+    double last_piece_length;
+    int seeds;			/* there from the start, and staying */
+    int leechers;
+    double seed_up;		/* upload rate of a seed, bytes/s */
+    double leecher_up;
+    double arrival_rate;	/* leechers joining a second; 0: all at once */
+    double linger;		/* seconds a leecher seeds once it is done;
+                                 * < 0: for ever */
+    int neighbors;		/* peers a peer connects to when it joins */
+    int upload_slots;		/* peers a peer uploads to at once */
+    double rechoke_interval;	/* seconds */
+    int optimistic_rounds;	/* rechokes an optimistic unchoke lasts */
+    double max_time;		/* seconds the simulation may run */
+    unsigned long long random_seed;
+};
+
+struct swarm_stats {
+    double end_time;		/* when the last leecher was done, or max_time */
+    int finished;		/* leechers that were done by then */
+    long long events;
+    double seed_bytes;		/* uploaded by the seeds */
+    double leecher_bytes;	/* uploaded by leechers, done or not */
+    double wasted_bytes;	/* of those, the bytes of the transfers cut
+                                 * off in endgame, and of partial pieces
+                                 * that a peer had too many of */
+};
+
+/* Simulate a swarm.  Sets completion[i], for leecher i, to the seconds it
+ * took from joining to having all pieces, or -1 if it had not by max_time.
+ * Returns 0, or -1 if the parameters are bad or memory runs out.
+ */
+int swarm_run(const struct swarm_params *p, double *completion, struct swarm_stats *stats);
+
+#endif
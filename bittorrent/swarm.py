@@ -0,0 +1,145 @@
+#!/usr/bin/env python
+
+# Predicts how long the leechers of a torrent take to download it, with the
+# swarm simulator of swarm.c (make builds libbt.so): the pieces are those of
+# a real torrent, and the seeds, leechers and rates are what is asked.  Run
+# it for a few seed capacities before a release to see how many seeds it
+# needs.
+#
+# usage: swarm.py <torrent file> [<name>=<value> ...]
+#
+# with the names of the fields of SwarmParams; rates are in bytes/s, times
+# in seconds.
+
+from sys import argv, exit
+from time import time
+from ctypes import Structure, POINTER, c_int, c_double, c_longlong, c_ulonglong, byref
+from cbencode import libbt
+from bittorrent_get_peers import FileMeta
+
+class SwarmParams(Structure):
+    _fields_ = [('npieces', c_int),
+                ('piece_length', c_double),
+                ('last_piece_length', c_double),
+                ('seeds', c_int),
+                ('leechers', c_int),
+                ('seed_up', c_double),
+                ('leecher_up', c_double),
+                ('arrival_rate', c_double),
+                ('linger', c_double),
+                ('neighbors', c_int),
+                ('upload_slots', c_int),
+                ('rechoke_interval', c_double),
+                ('optimistic_rounds', c_int),
+                ('max_time', c_double),
+                ('random_seed', c_ulonglong)]
+
+class SwarmStats(Structure):
+    _fields_ = [('end_time', c_double),
+                ('finished', c_int),
+                ('events', c_longlong),
+                ('seed_bytes', c_double),
+                ('leecher_bytes', c_double),
+                ('wasted_bytes', c_double)]
+
+libbt.swarm_run.argtypes = [POINTER(SwarmParams), POINTER(c_double), POINTER(SwarmStats)]
+
+# a release of 100 leechers to 1 seed on a 1 MB/s line, with the choking
+# of the mainline client
+DEFAULTS = {'seeds': 1, 'leechers': 100, 'seed_up': 1000000, 'leecher_up': 100000,
+            'arrival_rate': 0, 'linger': -1, 'neighbors': 40, 'upload_slots': 4,
+            'rechoke_interval': 10, 'optimistic_rounds': 3, 'max_time': 30 * 86400,
+            'random_seed': 1}
+
+# simulates a swarm of the torrent of meta, a FileMeta; options override
+# DEFAULTS.  Returns the seconds each leecher took (None for those not
+# done by max_time) and a SwarmStats.
+#
+def simulate(meta, **options):
+    params = SwarmParams()
+    for name, value in DEFAULTS.items() + options.items():
+        if not hasattr(params, name):
+            raise ValueError, "no parameter " + name
+        setattr(params, name, value)
+    params.npieces = meta.n_pieces
+    params.piece_length = meta.piece_length
+    params.last_piece_length = meta.last_piece_length or meta.piece_length
+    completion = (c_double * max(params.leechers, 1))()
+    stats = SwarmStats()
+    if libbt.swarm_run(byref(params), completion, byref(stats)) < 0:
+        raise ValueError, "bad parameters, or out of memory"
+    return [t >= 0 and t or None for t in completion[:params.leechers]], stats
+
+# the p-th percentile of sorted times
+#
+def percentile(times, p):
+    return times[min(len(times) - 1, int(len(times) * p / 100.0))]
+
+def test_swarm():
+    class Meta:
+        n_pieces = 200
+        piece_length = 262144
+        last_piece_length = 1000
+    meta = Meta()
+    size = 199 * 262144 + 1000
+
+    # everyone is done, and every byte of each copy came from someone
+    times, stats = simulate(meta, seeds = 2, leechers = 50, seed_up = 500000,
+                            leecher_up = 100000, random_seed = 7)
+    assert stats.finished == 50 and None not in times
+    assert abs(stats.seed_bytes + stats.leecher_bytes - stats.wasted_bytes - 50 * size) < 1
+    assert stats.end_time == max(times)
+    # no faster than the whole swarm's upload allows, and the leechers help
+    assert min(times) >= size / 500000.0
+    assert stats.leecher_bytes > stats.seed_bytes
+
+    # the same seed, the same swarm
+    again, stats2 = simulate(meta, seeds = 2, leechers = 50, seed_up = 500000,
+                             leecher_up = 100000, random_seed = 7)
+    assert again == times and stats2.events == stats.events
+
+    # one seed with more upload than all: about one copy a leecher it sends
+    times, stats = simulate(meta, leechers = 4, seed_up = 10 ** 7, leecher_up = 1000,
+                            linger = 0)
+    assert stats.finished == 4 and stats.seed_bytes > 3 * size
+
+    # pieces that take longer than a rechoke interval still come, in parts
+    times, stats = simulate(meta, leechers = 20, seed_up = 100000, leecher_up = 20000,
+                            linger = 60)
+    assert stats.finished == 20
+    assert stats.wasted_bytes < 0.1 * (stats.seed_bytes + stats.leecher_bytes)
+
+    # arrivals over time, and too little time for all of them
+    times, stats = simulate(meta, leechers = 100, arrival_rate = 0.1, max_time = 600)
+    assert 0 < stats.finished < 100 and times.count(None) == 100 - stats.finished
+    assert stats.end_time == 600
+
+    try:
+        simulate(meta, upload_slots = 0)
+        assert False
+    except ValueError:
+        pass
+
+if __name__ == '__main__':
+    if len(argv) < 2:
+        print "Usage: swarm.py <torrent file> [<name>=<value> ...]"
+        exit(2)
+    options = {}
+    for arg in argv[2:]:
+        name, value = arg.split('=', 1)
+        options[name] = float(value)
+        if name in ('seeds', 'leechers', 'neighbors', 'upload_slots', 'optimistic_rounds',
+                    'random_seed'):
+            options[name] = int(value)
+    meta = FileMeta(argv[1])
+    start = time()
+    times, stats = simulate(meta, **options)
+    seconds = time() - start
+    done = sorted([t for t in times if t is not None])
+    print "%d pieces, %d of %d leechers done in %.0f s (%d events, %.2f s)" % \
+        (meta.n_pieces, stats.finished, len(times), stats.end_time, stats.events, seconds)
+    if done:
+        print "completion (s): min %.0f, 10%% %.0f, median %.0f, 90%% %.0f, max %.0f" % \
+            (done[0], percentile(done, 10), percentile(done, 50), percentile(done, 90), done[-1])
+    print "uploaded: seeds %.0f MB, leechers %.0f MB, wasted %.0f MB" % \
+        (stats.seed_bytes / 1e6, stats.leecher_bytes / 1e6, stats.wasted_bytes / 1e6)
@@ -0,0 +1,240 @@
+# The UDP tracker protocol (BEP 15): an announce is one datagram each way,
+# after a connect exchange whose connection ID is good for a minute and is
+# kept for the announces that follow.  A request that gets no answer is
+# sent again after 15 * 2 ^ n seconds, n = 0, 1, ..., as the BEP says.
+#
+# LocalTracker is a stand-in UDP tracker on the loopback interface, for
+# the tests.
+
+from struct import pack, unpack, unpack_from
+from socket import socket, getaddrinfo, inet_ntop, inet_pton, timeout, error, \
+    AF_INET, AF_INET6, SOCK_DGRAM
+from random import randrange
+from time import time
+from threading import Thread
+from urlparse import urlsplit
+
+PROTOCOL_ID = 0x41727101980
+
+ACTION_CONNECT = 0
+ACTION_ANNOUNCE = 1
+ACTION_ERROR = 3
+
+EVENT_NONE = 0
+EVENT_COMPLETED = 1
+EVENT_STARTED = 2
+EVENT_STOPPED = 3
+
+CONNECTION_ID_LIFETIME = 60	# seconds a client may use a connection ID
+
+# the (ip, port) pairs in a compact peer list: 6 bytes a peer for IPv4, 18
+# for IPv6
+#
+def compact_peers(peers, family = AF_INET):
+    size = family == AF_INET6 and 18 or 6
+    result = []
+    for i in xrange(0, len(peers) - size + 1, size):
+        result.append((inet_ntop(family, peers[i:i + size - 2]),
+                       unpack_from('!H', peers, i + size - 2)[0]))
+    return result
+
+# a UDP tracker, at host and port; timeout is the first wait for an answer,
+# which doubles with each of the retries
+#
+class UDPTracker:
+    def __init__(self, host, port, timeout = 15, retries = 8):
+        family, type, proto, name, address = getaddrinfo(host, port, 0, SOCK_DGRAM)[0]
+        self.family = family
+        self.address = address
+        self.sock = socket(family, SOCK_DGRAM)
+        self.timeout = timeout
+        self.retries = retries
+        self.connection_id = None
+        self.connected_at = 0
+
+    # sends a request of action with body, the connection ID and a fresh
+    # transaction ID in front, until an answer comes; returns what follows
+    # the action and transaction ID in the answer
+    def _request(self, action, body = ''):
+        transaction_id = randrange(1 << 32)
+        for n in xrange(self.retries + 1):
+            if action == ACTION_CONNECT:
+                connection_id = PROTOCOL_ID
+            else:
+                # the connection ID may have run out while retrying
+                self.connect()
+                connection_id = self.connection_id
+            self.sock.sendto(pack('!qiI', connection_id, action, transaction_id) + body, self.address)
+
+            # an answer to an earlier send of the same request will do
+            deadline = time() + self.timeout * 2 ** n
+            while time() < deadline:
+                self.sock.settimeout(deadline - time())
+                try:
+                    answer = self.sock.recv(65536)
+                except (timeout, error):
+                    break
+                if len(answer) < 8:
+                    continue
+                answer_action, answer_id = unpack_from('!iI', answer)
+                if answer_id != transaction_id:
+                    continue
+                if answer_action == ACTION_ERROR:
+                    raise IOError, "tracker error: " + answer[8:]
+                if answer_action == action:
+                    return answer[8:]
+        raise IOError, "no answer from tracker"
+
+    # gets a connection ID, unless the one there is still good
+    def connect(self):
+        if self.connection_id is not None and time() - self.connected_at < CONNECTION_ID_LIFETIME:
+            return
+        answer = self._request(ACTION_CONNECT)
+        if len(answer) < 8:
+            raise IOError, "bad connect answer from tracker"
+        self.connection_id = unpack_from('!q', answer)[0]
+        self.connected_at = time()
+
+    # announces a torrent; returns a dict with the interval, the numbers of
+    # leechers and seeders, and the peers as (ip, port) pairs
+    def announce(self, info_hash, peer_id, port, left, downloaded = 0, uploaded = 0,
+                 event = EVENT_STARTED, num_want = -1, key = 0):
+        answer = self._request(ACTION_ANNOUNCE,
+                               pack('!20s20sqqqiIIiH', info_hash, peer_id, downloaded, left,
+                                    uploaded, event, 0, key, num_want, port))
+        if len(answer) < 12:
+            raise IOError, "bad announce answer from tracker"
+        interval, leechers, seeders = unpack_from('!iii', answer)
+        return {'interval': interval, 'leechers': leechers, 'seeders': seeders,
+                'peers': compact_peers(answer[12:], self.family)}
+
+# one UDPTracker per tracker, so that connection IDs are kept
+trackers = {}
+
+# announces to the tracker at url, udp://host:port/...
+#
+def announce_url(url, *args, **kwargs):
+    parts = urlsplit(url)
+    if parts.scheme != 'udp' or parts.port is None:
+        raise ValueError, "not a UDP tracker: " + url
+    key = (parts.hostname, parts.port)
+    if not trackers.has_key(key):
+        trackers[key] = UDPTracker(parts.hostname, parts.port)
+    return trackers[key].announce(*args, **kwargs)
+
+# a UDP tracker on the loopback interface, serving in a thread of its own;
+# it drops the next drop requests it gets, and counts the connects and
+# announces it answers
+#
+class LocalTracker(Thread):
+    def __init__(self, family = AF_INET, interval = 1800):
+        Thread.__init__(self)
+        self.daemon = True
+        self.family = family
+        self.sock = socket(family, SOCK_DGRAM)
+        self.sock.bind((family == AF_INET6 and '::1' or '127.0.0.1', 0))
+        self.port = self.sock.getsockname()[1]
+        self.interval = interval
+        self.swarms = {}	# info hash -> {(ip, port): bytes left}
+        self.connections = {}	# connection ID -> time given out
+        self.drop = 0
+        self.connects = 0
+        self.announces = 0
+        self.stopped = False
+        self.start()
+
+    def run(self):
+        while True:
+            request, address = self.sock.recvfrom(65536)
+            if self.stopped:
+                break
+            if self.drop > 0:
+                self.drop -= 1
+                continue
+            answer = self.answer(request, address)
+            if answer is not None:
+                self.sock.sendto(answer, address)
+        self.sock.close()
+
+    def answer(self, request, address):
+        if len(request) < 16:
+            return None
+        connection_id, action, transaction_id = unpack_from('!qiI', request)
+        if action == ACTION_CONNECT and connection_id == PROTOCOL_ID:
+            connection_id = randrange(1 << 62)
+            self.connections[connection_id] = time()
+            self.connects += 1
+            return pack('!iIq', ACTION_CONNECT, transaction_id, connection_id)
+        if action != ACTION_ANNOUNCE or len(request) < 98:
+            return pack('!iI', ACTION_ERROR, transaction_id) + 'bad request'
+        # a tracker takes a connection ID for two minutes
+        if time() - self.connections.get(connection_id, 0) > 2 * CONNECTION_ID_LIFETIME:
+            return pack('!iI', ACTION_ERROR, transaction_id) + 'bad connection ID'
+
+        info_hash, peer_id, downloaded, left, uploaded, event, ip, key, num_want, port = \
+            unpack_from('!20s20sqqqiIIiH', request, 16)
+        self.announces += 1
+        swarm = self.swarms.setdefault(info_hash, {})
+        peer = (address[0], port)
+        if event == EVENT_STOPPED:
+            swarm.pop(peer, None)
+        else:
+            swarm[peer] = left
+        others = [p for p in swarm if p != peer][:num_want < 0 and 50 or num_want]
+        seeders = len([p for p in swarm if swarm[p] == 0])
+        return pack('!iIiii', ACTION_ANNOUNCE, transaction_id, self.interval,
+                    len(swarm) - seeders, seeders) + \
+            ''.join([inet_pton(self.family, ip) + pack('!H', port) for ip, port in others])
+
+    def stop(self):
+        self.stopped = True
+        socket(self.family, SOCK_DGRAM).sendto('', self.sock.getsockname())
+        self.join()
+
+def test_compact_peers():
+    assert compact_peers('\x7f\x00\x00\x01\x1a\xe1\x0a\x00\x00\x02\x00\x50') == \
+        [('127.0.0.1', 6881), ('10.0.0.2', 80)]
+    assert compact_peers('\x00' * 15 + '\x01\x1a\xe1', AF_INET6) == [('::1', 6881)]
+    assert compact_peers('\x7f\x00\x00\x01\x1a') == []
+
+def test_udp_tracker():
+    info_hash = 'h' * 20
+    for family, host in [(AF_INET, '127.0.0.1'), (AF_INET6, '::1')]:
+        try:
+            local = LocalTracker(family)
+        except error:
+            continue	# no IPv6 here
+        try:
+            tracker = UDPTracker(host, local.port, timeout = 0.05, retries = 3)
+            r = tracker.announce(info_hash, 'a' * 20, 6881, 100)
+            assert r['peers'] == [] and r['leechers'] == 1 and r['interval'] == 1800
+            r = tracker.announce(info_hash, 'b' * 20, 6882, 0)
+            assert r['peers'] == [(host, 6881)] and r['leechers'] == 1 and r['seeders'] == 1
+            # one connect for both announces
+            assert local.connects == 1 and local.announces == 2
+
+            # lost requests are sent again
+            local.drop = 2
+            r = tracker.announce(info_hash, 'a' * 20, 6881, 100, event = EVENT_STOPPED)
+            assert r['leechers'] == 0 and local.announces == 3
+
+            # a stale connection ID gets a new one; a bad one an error
+            tracker.connected_at -= CONNECTION_ID_LIFETIME
+            tracker.announce(info_hash, 'b' * 20, 6882, 0, event = EVENT_NONE)
+            assert local.connects == 2
+            tracker.connection_id += 1
+            try:
+                tracker.announce(info_hash, 'b' * 20, 6882, 0)
+                assert 0
+            except IOError:
+                pass
+        finally:
+            local.stop()
+
+        # and no tracker, no answer
+        tracker = UDPTracker(host, local.port, timeout = 0.01, retries = 1)
+        try:
+            tracker.announce(info_hash, 'a' * 20, 6881, 100)
+            assert 0
+        except IOError:
+            pass
@@ -0,0 +1,150 @@
+/* Piece hash checking on a thread pool.  See verify.h. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sha1.h"
+#include "spans.h"
+#include "verify.h"
+
+/* A file of the payload, mapped. */
+struct mapping {
+    const unsigned char *p;	/* NULL if empty or bad */
+    long long length;
+    int ok;			/* there, and long enough */
+};
+
+/* What the threads share. */
+struct job {
+    struct span_index index;
+    struct mapping *map;
+    const unsigned char *hashes;
+    unsigned char *bitfield;
+    int next;			/* the first piece not yet taken */
+    int good;
+};
+
+static void map_file(struct mapping *m, const char *path)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    m->p = NULL;
+    m->ok = 0;
+    if ((unsigned long long) m->length > (size_t) -1) return;
+    if ((fd = open(path, O_RDONLY)) < 0) return;
+    if (fstat(fd, &st) == 0 && st.st_size >= m->length) {
+        if (m->length == 0) {
+            m->ok = 1;
+        } else if ((p = mmap(NULL, m->length, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+            /* Each thread reads its pieces front to back, and together
+             * they move through the file in order: let the kernel read
+             * ahead far.
+             */
+            madvise(p, m->length, MADV_SEQUENTIAL);
+            m->p = p;
+            m->ok = 1;
+        }
+    }
+    close(fd);
+}
+
+static int check_piece(struct job *j, int i)
+{
+    const struct span_index *x = &j->index;
+    long long off = i * x->piece_length, end = off + x->piece_length, n;
+    unsigned char digest[SHA1_LEN];
+    struct sha1_ctx c;
+    int f;
+
+    if (end > x->total) end = x->total;
+
+    /* The files of the piece, found without making a list of them: a
+     * piece of a torrent of small files may lie in thousands.
+     */
+    sha1_init(&c);
+    for (f = span_file(x, off); off < end; f++) {
+        if (j->map[f].length == 0) continue;
+        if (!j->map[f].ok) return(0);
+        n = (x->start[f + 1] < end ? x->start[f + 1] : end) - off;
+        sha1_update(&c, j->map[f].p + (off - x->start[f]), n);
+        off += n;
+    }
+    sha1_final(&c, digest);
+    return(memcmp(digest, j->hashes + (size_t) i * SHA1_LEN, SHA1_LEN) == 0);
+}
+
+static void *worker(void *arg)
+{
+    struct job *j = arg;
+    int i;
+
+    while ((i = __sync_fetch_and_add(&j->next, 1)) < j->index.npieces) {
+        if (check_piece(j, i)) {
+            __sync_fetch_and_or(&j->bitfield[i / 8], 0x80 >> (i % 8));
+            __sync_fetch_and_add(&j->good, 1);
+        }
+    }
+    return(NULL);
+}
+
+int verify_pieces(const struct bt_file *files, int nfiles, long long piece_length,
+                  const unsigned char *hashes, int npieces, int nthreads,
+                  unsigned char *bitfield)
+{
+    struct job j;
+    pthread_t *threads;
+    long long *lengths;
+    int i, started;
+
+    if (nfiles <= 0) return(-1);
+    if ((lengths = malloc(nfiles * sizeof(long long))) == NULL) return(-1);
+    for (i = 0; i < nfiles; i++) lengths[i] = files[i].length;
+    i = span_index_init(&j.index, lengths, nfiles, piece_length);
+    free(lengths);
+    if (i < 0) return(-1);
+    if (j.index.npieces != npieces) {
+        span_index_free(&j.index);
+        return(-1);
+    }
+
+    if ((j.map = malloc(nfiles * sizeof(struct mapping))) == NULL) {
+        span_index_free(&j.index);
+        return(-1);
+    }
+    for (i = 0; i < nfiles; i++) {
+        j.map[i].length = files[i].length;
+        map_file(&j.map[i], files[i].path);
+    }
+    j.hashes = hashes;
+    j.bitfield = bitfield;
+    j.next = 0;
+    j.good = 0;
+    memset(bitfield, 0, (npieces + 7) / 8);
+
+    /* The calling thread is one of the pool; if some threads cannot be
+     * started, the others do their share.
+     */
+    if (nthreads <= 0) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > npieces) nthreads = npieces;
+    if (nthreads < 1) nthreads = 1;
+    threads = malloc(nthreads * sizeof(pthread_t));
+    for (started = 0; threads != NULL && started < nthreads - 1; started++) {
+        if (pthread_create(&threads[started], NULL, worker, &j) != 0) break;
+    }
+    worker(&j);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    for (i = 0; i < nfiles; i++) {
+        if (j.map[i].p != NULL) munmap((void *) j.map[i].p, j.map[i].length);
+    }
+    free(j.map);
+    span_index_free(&j.index);
+    return(j.good);
+}
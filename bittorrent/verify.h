@@ -0,0 +1,29 @@
+/* Checking downloaded data against the piece hashes of its torrent.
+ *
+ * The payload is the files of the torrent one after the other; piece i is
+ * bytes i * piece_length up to (i + 1) * piece_length of it, the last one
+ * shorter.  verify_pieces() maps the files and hashes the pieces on a pool
+ * of threads, each taking the next piece not yet taken, so that a large
+ * download is checked as fast as the disk can read it.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+struct bt_file {
+    const char *path;
+    long long length;		/* as the torrent gives it */
+};
+
+/* Check the npieces pieces of the nfiles files against hashes, 20 bytes
+ * each, on nthreads threads (all CPUs if nthreads <= 0).  Sets bit i of
+ * bitfield, (npieces + 7) / 8 bytes with the high bit of the first byte
+ * for piece 0 as in the BitTorrent protocol, iff piece i is good.  A piece
+ * is bad if any file it lies in is missing or shorter than its length.
+ * Returns the number of good pieces, or -1 if the arguments do not agree.
+ */
+int verify_pieces(const struct bt_file *files, int nfiles, long long piece_length,
+                  const unsigned char *hashes, int npieces, int nthreads,
+                  unsigned char *bitfield);
+
+#endif
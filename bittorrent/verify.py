@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+
+# Checks downloaded data against the piece hashes of its torrent, with
+# verify_pieces() in verify.c (make builds libbt.so): the files are mapped
+# and the pieces hashed on all CPUs, with the SHA-NI instructions where the
+# CPU has them.
+#
+# usage: verify.py <torrent file> [<download directory>]
+
+from sys import argv, exit
+from time import time
+from os.path import join
+from ctypes import Structure, POINTER, c_int, c_longlong, c_char_p, c_void_p, c_size_t, \
+    create_string_buffer
+from cbencode import libbt
+from bittorrent_get_peers import FileMeta
+
+class BtFile(Structure):
+    _fields_ = [('path', c_char_p),
+                ('length', c_longlong)]
+
+libbt.verify_pieces.argtypes = [POINTER(BtFile), c_int, c_longlong, c_char_p, c_int, c_int,
+                                c_char_p]
+libbt.sha1.argtypes = [c_void_p, c_size_t, c_char_p]
+
+# checks the files of meta, a FileMeta, in directory and returns the
+# bitfield of the good pieces, as the BitTorrent protocol sends it
+#
+def verify_pieces(meta, directory = '.', nthreads = 0):
+    files = (BtFile * len(meta.files))()
+    for i in xrange(len(meta.files)):
+        path, length = meta.files[i]
+        files[i].path = join(directory, path)
+        files[i].length = length
+    bitfield = create_string_buffer((meta.n_pieces + 7) / 8)
+    if libbt.verify_pieces(files, len(files), meta.piece_length, meta.pieces,
+                           meta.n_pieces, nthreads, bitfield) < 0:
+        raise ValueError, "the files do not agree with the pieces"
+    return bitfield.raw
+
+# whether piece i is good in bitfield
+#
+def have(bitfield, i):
+    return ord(bitfield[i / 8]) & (0x80 >> (i % 8)) != 0
+
+def test_sha1():
+    from hashlib import sha1
+    from ctypes import c_int
+    sha1_ni = c_int.in_dll(libbt, 'sha1_ni')
+    ni = sha1_ni.value
+    x = ''.join([chr(i * 7 % 256) for i in xrange(70000)])
+    digest = create_string_buffer(20)
+    try:
+        for sha1_ni.value in set([0, ni]):
+            for n in range(200) + [4095, 4096, 4097, 70000]:
+                libbt.sha1(x, n, digest)
+                assert digest.raw == sha1(x[:n]).digest()
+    finally:
+        sha1_ni.value = ni
+
+def test_verify():
+    from tempfile import mkdtemp
+    from shutil import rmtree
+    from hashlib import sha1
+    from os import mkdir
+    from bencode import bencode
+    directory = mkdtemp()
+    try:
+        # three files, the pieces across them, and an empty one between
+        data = ''.join([chr(i % 251) for i in xrange(10000)])
+        pieces = ''.join([sha1(data[i:i + 1024]).digest() for i in xrange(0, len(data), 1024)])
+        torrent = join(directory, 't.torrent')
+        open(torrent, 'wb').write(bencode({'announce': 'http://localhost/announce',
+            'info': {'name': 'd', 'piece length': 1024, 'pieces': pieces,
+                     'files': [{'length': 3000, 'path': ['a']}, {'length': 0, 'path': ['e']},
+                               {'length': 5000, 'path': ['s', 'b']},
+                               {'length': 2000, 'path': ['c']}]}}))
+        meta = FileMeta(torrent)
+        assert meta.files == [('d/a', 3000), ('d/e', 0), ('d/s/b', 5000), ('d/c', 2000)]
+        mkdir(join(directory, 'd'))
+        mkdir(join(directory, 'd', 's'))
+        open(join(directory, 'd', 'a'), 'wb').write(data[:3000])
+        open(join(directory, 'd', 'e'), 'wb').write('')
+        open(join(directory, 'd', 's', 'b'), 'wb').write(data[3000:8000])
+        open(join(directory, 'd', 'c'), 'wb').write(data[8000:])
+        for nthreads in [1, 4]:
+            assert verify_pieces(meta, directory, nthreads) == '\xff\xc0'
+
+        # a bad byte in piece 4, and a file too short for pieces 7 to 9
+        open(join(directory, 'd', 's', 'b'), 'wb').write(data[3000:4500] + 'x' + data[4501:8000])
+        open(join(directory, 'd', 'c'), 'wb').write(data[8000:9999])
+        bitfield = verify_pieces(meta, directory)
+        assert [i for i in xrange(meta.n_pieces) if have(bitfield, i)] == [0, 1, 2, 3, 5, 6]
+    finally:
+        rmtree(directory)
+
+if __name__ == '__main__':
+    if len(argv) not in (2, 3):
+        print "Usage: verify.py <torrent file> [<download directory>]"
+        exit(2)
+    meta = FileMeta(argv[1])
+    start = time()
+    bitfield = verify_pieces(meta, len(argv) == 3 and argv[2] or '.')
+    seconds = time() - start
+    good = len([i for i in xrange(meta.n_pieces) if have(bitfield, i)])
+    print "%d of %d pieces good (%d bytes) in %.2f s" % (good, meta.n_pieces, meta.length, seconds)
@@ -0,0 +1,76 @@
+/* Batch means: confidence intervals for the steady state of a run.  See
+ * batch.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "batch.h"
+
+/* Two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom. */
+static const double t95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double student(long df)
+{
+    if (df <= 30) return t95[df - 1];
+    return 1.960 + 2.4 / df;	/* within 0.1% of the true value */
+}
+
+void batch_init(struct batch_means *b, double rel, long events, int delays)
+{
+    memset(b, 0, sizeof(*b));
+    b->rel = rel;
+    b->events = events;
+    b->nmetrics = (delays ? 3 : 2);
+}
+
+int batch_end(struct batch_means *b)
+{
+    double x[BATCH_METRICS], d;
+    int i;
+
+    x[BATCH_EFFICIENCY] = (b->sent > 0 ? b->accepted / b->sent : 0);
+    x[BATCH_GOODPUT] = b->accepted / b->events;
+    x[BATCH_DELAY] = (b->delays > 0 ? b->delay_sum / b->delays : 0);
+    b->accepted = b->sent = b->delay_sum = b->delays = 0;
+
+    /* Welford's update of the mean and the sum of squared deviations. */
+    b->n++;
+    for (i = 0; i < b->nmetrics; i++) {
+        d = x[i] - b->mean[i];
+        b->mean[i] += d / b->n;
+        b->m2[i] += d * (x[i] - b->mean[i]);
+    }
+
+    if (b->n < BATCH_MIN) return(0);
+    for (i = 0; i < b->nmetrics; i++)
+        if (batch_halfwidth(b, i) > b->rel * fabs(b->mean[i])) return(0);
+    return(1);
+}
+
+double batch_halfwidth(const struct batch_means *b, int metric)
+{
+    if (b->n < 2) return(-1);
+    return student(b->n - 1) * sqrt(b->m2[metric] / (b->n - 1) / b->n);
+}
+
+void batch_print(const struct batch_means *b, FILE *f)
+{
+    static const char *name[BATCH_METRICS] = {
+        "Efficiency:           ", "Goodput (pkts/event): ", "Delivery delay:       "
+    };
+    int i;
+
+    fprintf(f, "\nBatch means over %ld batches of %ld events, 95%% confidence:\n", b->n, b->events);
+    for (i = 0; i < b->nmetrics; i++) {
+        if (b->n < 2)
+            fprintf(f, "\t%s %9.4f\n", name[i], b->mean[i]);
+        else
+            fprintf(f, "\t%s %9.4f +- %.4f (%.2f%%)\n", name[i], b->mean[i], batch_halfwidth(b, i),
+                    b->mean[i] != 0 ? 100 * batch_halfwidth(b, i) / fabs(b->mean[i]) : 0.0);
+    }
+}
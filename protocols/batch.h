@@ -0,0 +1,51 @@
+/* Batch means: confidence intervals for the steady state of a run.
+ *
+ * The run is cut into batches of a fixed number of events.  For each batch
+ * the efficiency (payloads accepted per data frame sent), the goodput
+ * (payloads accepted per event) and, with a traffic generator, the mean
+ * delivery delay are computed.  The batch means are taken to be independent,
+ * so the mean over the batches has a Student-t confidence interval.  With
+ * the option ci=REL[:BATCH] the run stops as soon as the 95% interval of
+ * every metric is within REL times its mean, e.g. ci=0.01 for +-1%.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#define BATCH_EFFICIENCY 0
+#define BATCH_GOODPUT    1
+#define BATCH_DELAY      2
+#define BATCH_METRICS    3
+
+#define BATCH_MIN 10		/* batches needed before a run may stop */
+
+struct batch_means {
+    double rel;			/* wanted half width relative to the mean, 0 if off */
+    long events;		/* events per batch */
+    int nmetrics;		/* 2, or 3 if delays are measured */
+
+    long n;			/* batches completed */
+    double mean[BATCH_METRICS];	/* running means of the batch means */
+    double m2[BATCH_METRICS];	/* running sums of squared deviations */
+
+    /* Totals of the current batch. */
+    double accepted, sent, delay_sum, delays;
+};
+
+/* Start batches of events events for a run that measures delays or not. */
+void batch_init(struct batch_means *b, double rel, long events, int delays);
+
+/* Close the current batch.  Returns 1 if the intervals are narrow enough. */
+int batch_end(struct batch_means *b);
+
+/* Half width of the 95% confidence interval of a metric, or -1 if there are
+ * fewer than two batches.
+ */
+double batch_halfwidth(const struct batch_means *b, int metric);
+
+/* Print the means and their intervals. */
+void batch_print(const struct batch_means *b, FILE *f);
+
+#endif
@@ -0,0 +1,430 @@
+/* Benchmarks for the simulator.
+ *
+ * To run: make bench
+ *    or:  benchmark [-n events] [-r repeats] [-o out.json] [-b base.json] [-t pct]
+ *
+ * The macro benchmarks run each protocol plug-in (p2.so-p6.so) with fixed
+ * parameters and seed through dlsim_run(), and report events per second,
+ * nanoseconds per event, and system calls and bytes logged per event.  The
+ * micro benchmarks time the core functions of one worker in isolation: the
+ * pipes to main and the peer are replaced by /dev/null and by pipes filled
+ * in advance.  Every benchmark is run several times (-r, default 5) and
+ * the median run counts, so that one run slowed down by the machine does
+ * not fail the comparison, nor one lucky run set the baseline.
+ *
+ * The results are written as JSON, one benchmark per line.  Given a
+ * baseline from an earlier run (make bench-baseline), every benchmark that
+ * got more than pct percent (default 10) slower is reported, and the exit
+ * status is 1.  Benchmarks found on one side only are reported too.
+ *
+ * The macro benchmarks also report their efficiency, the payloads accepted
+ * per frame sent (data, acknowledgement and parity frames), averaged over
+ * the runs.  Every benchmark named X_fec... must be at least as efficient
+ * as benchmark X, the same protocol without forward error correction, or
+ * the exit status is 1 as well.  They use protocol 5, whose go-back-n
+ * resends a whole window for each lost frame, and no garbled frames,
+ * which forward error correction cannot repair.
+ *
+ * The benchmark links libdlsim.a, and the micro benchmarks reach the
+ * worker state through simulator.h; the plug-ins call the simulator
+ * through -rdynamic.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dlfcn.h>
+#include "simulator.h"
+
+#define MAX_BENCH 32		/* max number of benchmarks */
+#define MAX_REPEATS 99		/* max number of runs of a benchmark */
+#define BATCH 256		/* frames or ticks put in a pipe at once */
+
+struct result {
+    char name[32];		/* e.g. "p6" or "micro_timers" */
+    int macro;			/* 1 for a whole simulation */
+    double ops;			/* events or calls timed */
+    double ns;			/* nanoseconds per event or call, median run */
+    double run_ns[MAX_REPEATS];	/* nanoseconds per event or call of each run */
+    int runs;			/* number of runs so far */
+    double syscalls;		/* system calls per event */
+    double log_bytes;		/* bytes logged per event */
+    double efficiency;		/* payloads accepted per frame sent, mean */
+};
+
+struct config {
+    char *name;			/* name of the benchmark */
+    char *plugin;		/* protocol plug-in */
+    int timeout, loss, cksum;	/* parameters */
+    char *options;		/* extra options separated by spaces, or NULL */
+};
+
+struct config configs[] = {
+    {"p2", "./p2.so", 40, 0, 0, NULL},	/* utopia cannot handle errors */
+    {"p3", "./p3.so", 40, 10, 10, NULL},
+    {"p4", "./p4.so", 40, 10, 10, NULL},
+    {"p5", "./p5.so", 40, 10, 10, NULL},
+    {"p6", "./p6.so", 40, 10, 10, NULL},
+    {"p6_nolog", "./p6.so", 40, 10, 10, "log=none"},
+    {"p5_loss", "./p5.so", 40, 20, 0, NULL},
+    {"p5_loss_fec", "./p5.so", 40, 20, 0, "fec=xor:4"},
+    {"p5_loss_fec_wide", "./p5.so", 40, 20, 0, "fec=rs:16:2"},	/* k > window */
+    {"p6_uring", "./p6.so", 40, 10, 10, "log=none io=uring"},
+};
+
+struct result results[MAX_BENCH];
+int nresults;
+
+double now(void)
+{
+    /* Monotonic time in nanoseconds. */
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+struct result *new_result(char *name, int macro)
+{
+    struct result *r = &results[nresults++];
+
+    memset(r, 0, sizeof(*r));
+    strcpy(r->name, name);
+    r->macro = macro;
+    return(r);
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return(x < y ? -1 : x > y);
+}
+
+void keep_run(struct result *r, double ops, double ns, double syscalls,
+              double log_bytes)
+{
+    /* Add a run of ops events or calls that took ns nanoseconds, with its
+     * costs per event, and take the median of the runs so far.
+     */
+
+    double sorted[MAX_REPEATS];
+    int n;
+
+    r->ops = ops;
+    r->syscalls = syscalls;
+    r->log_bytes = log_bytes;
+    r->run_ns[r->runs++] = ns / ops;
+    n = r->runs;
+    memcpy(sorted, r->run_ns, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmp_double);
+    r->ns = (n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2);
+}
+
+int macro_bench(struct config *c, long events, int repeats)
+{
+    /* Run one protocol configuration repeats times. */
+
+    const struct dlsim_plugin *plugin;
+    struct result *r;
+    struct dlsim *s;
+    char log[64], file[80], options[128], *opt[8];
+    const struct dlsim_stats *st[2];
+    dlsim_count syscalls, log_bytes;
+    double t, ran, frames;
+    void *handle;
+    int i, nopt;
+
+    if ((handle = dlopen(c->plugin, RTLD_NOW | RTLD_LOCAL)) == NULL ||
+        (plugin = dlsym(handle, "dlsim_plugin")) == NULL) {
+        printf("cannot load %s\n", c->plugin);
+        return(0);
+    }
+    r = new_result(c->name, 1);
+    for (i = 0; i < repeats; i++) {
+        if ((s = dlsim_new()) == NULL) return(0);
+        sprintf(log, "log=bench-%s.", c->name);
+        opt[0] = "seed=1";
+        opt[1] = log;
+        nopt = 2;
+        if (c->options != NULL) {
+            strcpy(options, c->options);
+            for (opt[nopt] = strtok(options, " "); opt[nopt] != NULL && nopt < 7;
+                 opt[nopt] = strtok(NULL, " ")) nopt++;
+        }
+        dlsim_parameters(s, events, c->timeout, c->loss, c->cksum, 0);
+        if (!dlsim_options(s, nopt, opt)) return(0);
+        dlsim_protocol(s, plugin->proc1, plugin->proc2,
+                       plugin->max_seq > 0 ? plugin->max_seq + 1 : 0);
+        dlsim_event_map(s, plugin->event_map);
+
+        t = now();
+        if (dlsim_run(s) == DLSIM_ERROR) {
+            printf("%s stopped on an error\n", c->name);
+            return(0);
+        }
+        t = now() - t;
+        ran = s->tick / DELTA;	/* a deadlock ends a run early */
+        dlsim_cost(s, &syscalls, &log_bytes);
+        st[0] = dlsim_statistics(s, 0);
+        st[1] = dlsim_statistics(s, 1);
+        frames = (double) st[0]->data_sent + st[0]->acks_sent + st[0]->fec_parity_sent +
+                 st[1]->data_sent + st[1]->acks_sent + st[1]->fec_parity_sent;
+        if (frames > 0)
+            r->efficiency += (st[0]->payloads_accepted + st[1]->payloads_accepted) /
+                             frames / repeats;
+        keep_run(r, ran, t, syscalls / ran, log_bytes / ran);
+        sprintf(file, "bench-%s.M", c->name); unlink(file);
+        sprintf(file, "bench-%s.0", c->name); unlink(file);
+        sprintf(file, "bench-%s.1", c->name); unlink(file);
+        dlsim_free(s);
+    }
+    return(1);
+}
+
+struct dlsim *micro_setup(int *frames_fd, int *ticks_fd)
+{
+    /* Set up worker M0 of a simulation without main and without a peer.
+     * Its replies and frames go to /dev/null; frames and ticks written
+     * to *frames_fd and *ticks_fd reach it as if sent by M1 and main.
+     */
+
+    struct dlsim *s;
+    int frames[2], ticks[2], devnull;
+
+    if ((s = dlsim_new()) == NULL) return(NULL);
+    s->log_prefix[0] = '\0';
+    dlsim_parameters(s, 0, 40, 0, 0, 0);
+    if (pipe(frames) < 0 || pipe(ticks) < 0) return(NULL);
+    if ((devnull = open("/dev/null", O_WRONLY)) < 0) return(NULL);
+    s->r2 = frames[0];
+    s->r3 = ticks[0];
+    s->w1 = s->w4 = devnull;
+    init_worker(s, 0);
+    set_worker(&s->worker[0]);
+    *frames_fd = frames[1];
+    *ticks_fd = ticks[1];
+    return(s);
+}
+
+void micro_teardown(struct dlsim *s, int frames_fd, int ticks_fd)
+{
+    close(s->r2);
+    close(s->r3);
+    close(s->w1);
+    close(frames_fd);
+    close(ticks_fd);
+    set_worker(NULL);
+    dlsim_free(s);
+}
+
+int micro_bench(long calls, int repeats)
+{
+    struct result *timers, *tophys, *queue, *wait;
+    struct dlsim *s;
+    struct dlsim_worker *w;
+    int frames_fd, ticks_fd, rep, i;
+    long n;
+    wire batch[BATCH];
+    bigint tick[BATCH];
+    event_type event;
+    frame f;
+    double t, total;
+
+    timers = new_result("micro_timers", 0);
+    tophys = new_result("micro_to_physical_layer", 0);
+    queue = new_result("micro_queue_frames", 0);
+    wait = new_result("micro_wait_for_event", 0);
+    memset(batch, 0, sizeof(batch));
+
+    for (rep = 0; rep < repeats; rep++) {
+        if ((s = micro_setup(&frames_fd, &ticks_fd)) == NULL) return(0);
+        w = &s->worker[0];
+
+        /* start_timer() and stop_timer(), with half the timers running. */
+        w->tick = DELTA;
+        t = now();
+        for (n = 0; n < calls; n++) {
+            start_timer(n % NR_TIMERS);
+            stop_timer((n + NR_TIMERS/2) % NR_TIMERS);
+        }
+        keep_run(timers, 2.0 * calls, now() - t, 0, 0);
+        for (i = 0; i < NR_TIMERS; i++) stop_timer(i);
+
+        /* to_physical_layer(), without loss. */
+        init_frame(&f);
+        f.kind = data;
+        t = now();
+        for (n = 0; n < calls; n++) {
+            f.seq = n % NR_TIMERS;
+            to_physical_layer(&f);
+        }
+        keep_run(tophys, calls, now() - t, 0, 0);
+
+        /* queue_frames(), BATCH frames at a time. */
+        total = 0;
+        for (n = 0; n < calls; n += BATCH) {
+            write(frames_fd, batch, sizeof(batch));
+            t = now();
+            queue_frames();
+            total += now() - t;
+            w->nframes = 0;
+            w->inp = w->outp = w->queue;
+        }
+        keep_run(queue, n, total, 0, 0);
+
+        /* wait_for_event(), with a packet always ready to send. */
+        enable_network_layer();
+        total = 0;
+        for (n = 0; n < calls; n += BATCH) {
+            for (i = 0; i < BATCH; i++) tick[i] = (n + i + 1) * DELTA;
+            write(ticks_fd, tick, sizeof(tick));
+            t = now();
+            for (i = 0; i < BATCH; i++) wait_for_event(&event);
+            total += now() - t;
+        }
+        keep_run(wait, n, total, 0, 0);
+
+        micro_teardown(s, frames_fd, ticks_fd);
+    }
+    return(1);
+}
+
+void write_json(FILE *f)
+{
+    int i;
+    struct result *r;
+
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (i = 0; i < nresults; i++) {
+        r = &results[i];
+        if (r->macro)
+            fprintf(f, "    {\"name\": \"%s\", \"events\": %.0f, \"ns_per_op\": %.1f, "
+                    "\"events_per_sec\": %.0f, \"syscalls_per_event\": %.3f, "
+                    "\"log_bytes_per_event\": %.1f, \"efficiency\": %.3f}",
+                    r->name, r->ops, r->ns, 1e9 / r->ns, r->syscalls, r->log_bytes,
+                    r->efficiency);
+        else
+            fprintf(f, "    {\"name\": \"%s\", \"calls\": %.0f, \"ns_per_op\": %.1f}",
+                    r->name, r->ops, r->ns);
+        fprintf(f, "%s\n", i < nresults - 1 ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int compare(char *file, double pct)
+{
+    /* Compare with a baseline written by write_json().  Returns the number
+     * of benchmarks that got slower by more than pct percent.  Those that
+     * are only in the baseline, or only in this run, are reported.
+     */
+
+    FILE *f;
+    char line[512], name[32], *p;
+    double ns;
+    int i, found, seen[MAX_BENCH], slower = 0;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        printf("No baseline %s; make bench-baseline stores one.\n", file);
+        return(0);
+    }
+    memset(seen, 0, sizeof(seen));
+    printf("\n%-26s %12s %12s %8s\n", "benchmark", "baseline ns", "ns", "change");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if ((p = strstr(line, "\"name\": \"")) == NULL ||
+            sscanf(p + 9, "%31[^\"]", name) != 1 ||
+            (p = strstr(line, "\"ns_per_op\": ")) == NULL ||
+            sscanf(p + 13, "%lf", &ns) != 1) continue;
+        found = 0;
+        for (i = 0; i < nresults; i++) {
+            if (strcmp(results[i].name, name) != 0) continue;
+            found = seen[i] = 1;
+            printf("%-26s %12.1f %12.1f %+7.1f%%%s\n", name, ns, results[i].ns,
+                   100 * (results[i].ns - ns) / ns,
+                   results[i].ns > ns * (1 + pct / 100) ? "  SLOWER" : "");
+            if (results[i].ns > ns * (1 + pct / 100)) slower++;
+        }
+        if (!found) printf("%-26s %12.1f %12s %8s  NOT RUN\n", name, ns, "-", "");
+    }
+    for (i = 0; i < nresults; i++)
+        if (!seen[i]) printf("%-26s %12s %12.1f %8s  NOT IN BASELINE\n", results[i].name, "-",
+                             results[i].ns, "");
+    fclose(f);
+    return(slower);
+}
+
+int check_fec(void)
+{
+    /* Check that no benchmark X_fec... is less efficient than X, i.e. that
+     * forward error correction saves more frames than its parity costs.
+     * Returns the number that are.
+     */
+
+    char *fec;
+    int i, j, n, worse = 0;
+
+    for (i = 0; i < nresults; i++) {
+        if (!results[i].macro || (fec = strstr(results[i].name, "_fec")) == NULL) continue;
+        n = fec - results[i].name;
+        for (j = 0; j < nresults; j++)
+            if (strlen(results[j].name) == (size_t) n &&
+                strncmp(results[j].name, results[i].name, n) == 0) break;
+        if (j == nresults || results[i].efficiency >= results[j].efficiency) continue;
+        printf("%s is less efficient than %s: %.3f instead of %.3f payloads per frame\n",
+               results[i].name, results[j].name, results[i].efficiency, results[j].efficiency);
+        worse++;
+    }
+    return(worse);
+}
+
+int main(int argc, char *argv[])
+{
+    long events = 100000;
+    int repeats = 5, c, i;
+    char *out = NULL, *base = NULL;
+    double pct = 10;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "n:r:o:b:t:")) != -1) {
+        switch (c) {
+            case 'n': events = atol(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'b': base = optarg; break;
+            case 't': pct = atof(optarg); break;
+            default:
+                printf("Usage: benchmark [-n events] [-r repeats] [-o out.json] [-b base.json] [-t pct]\n");
+                exit(1);
+        }
+    }
+    if (events <= 0 || repeats <= 0 || repeats > MAX_REPEATS) {
+        printf("events must be positive, and repeats between 1 and %d\n", MAX_REPEATS);
+        exit(1);
+    }
+
+    for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+        if (!macro_bench(&configs[i], events, repeats)) exit(1);
+    if (!micro_bench(events, repeats)) exit(1);
+    if (check_fec() > 0) exit(1);
+
+    if (out == NULL) {
+        write_json(stdout);
+    } else {
+        if ((f = fopen(out, "w")) == NULL) {
+            printf("cannot write %s\n", out);
+            exit(1);
+        }
+        write_json(f);
+        fclose(f);
+        printf("Results written to %s\n", out);
+    }
+    if (base != NULL && compare(base, pct) > 0) {
+        printf("\nSome benchmarks are more than %.0f%% slower than %s\n", pct, base);
+        exit(1);
+    }
+    return(0);
+}
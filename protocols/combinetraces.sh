@@ -0,0 +1,6 @@
+# Merge the traces of M0 and M1 (option trace=PREFIX, default trace) into
+# PREFIX.json, for chrome://tracing or ui.perfetto.dev.
+p=${1:-trace}
+echo '[' > $p.json
+grep -hv '^[][]$' ${p}0.json ${p}1.json | sed 's/,$//; $!s/$/,/' >> $p.json
+echo ']' >> $p.json
@@ -0,0 +1,187 @@
+/* The dlsim driver: runs protocols that are loaded from plug-ins.
+ *
+ * To run: dlsim plugin[,plugin...] events timeout pct_loss pct_cksum
+ *               debug_flags [options]
+ *
+ * Each plug-in is a shared object built from one of p2.c-p6.c with
+ * -DDLSIM_PLUGIN (make plugins).  When several are given, their
+ * simulations run side by side, each on its own threads, with the same
+ * parameters and options.  Their files then have the name of the plug-in
+ * in front, e.g. trace=out/t gives out/p6.t0.json for p6.so, so that runs
+ * do not write over each other.  A plug-in without a '/' in its name is
+ * looked for in the current directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include "dlsim.h"
+
+#define MAX_RUNS 16		/* max number of plug-ins in one sweep */
+
+int parse_first_five_parameters(int argc, char *argv[], long *event,
+                                int *timeout_interval, int *pkt_loss,
+                                int *garbled, int *debug_flags);
+
+struct run {
+    char path[256];			/* file name of the plug-in */
+    char name[64];			/* plug-in name without .so, e.g. p6 */
+    const struct dlsim_plugin *plugin;	/* what the plug-in registered */
+    struct dlsim *sim;			/* its simulation */
+    int status;				/* how the simulation ended */
+    pthread_t thread;
+};
+
+char *end_message[] = {"End of simulation", "A deadlock has been detected",
+                       "The simulation was stopped by an error",
+                       "A livelock has been detected"};
+
+/* Options that name files, which side by side runs must not share. */
+char *file_options[] = {"log=", "trace=", "checkpoint=", "restore=", "record=", "replay="};
+
+int load_plugin(struct run *r, char *name);
+char *run_option(struct run *r, char *arg);
+void *run_thread(void *arg);
+
+int main(int argc, char *argv[])
+{
+    struct run runs[MAX_RUNS];
+    int timeout_interval, pkt_loss, garbled, debug_flags;
+    int nruns = 0, nopt = argc - 7, i, j, bad = 0;
+    long event;
+    char *name, **opt;
+
+    if (argc < 2 || !parse_first_five_parameters(argc - 1, argv + 1, &event,
+                                                 &timeout_interval, &pkt_loss,
+                                                 &garbled, &debug_flags)) {
+        printf("Usage: dlsim plugin[,plugin...] events timeout loss cksum debug [options]\n");
+        exit(1);
+    }
+    setvbuf(stdout, (char *) 0, _IONBF, (size_t) 0);	/* disable buffering*/
+
+    for (name = strtok(argv[1], ","); name != NULL; name = strtok(NULL, ",")) {
+        if (nruns == MAX_RUNS) {
+            printf("At most %d plug-ins can run at once\n", MAX_RUNS);
+            exit(1);
+        }
+        if (!load_plugin(&runs[nruns], name)) exit(1);
+        nruns++;
+    }
+
+    if ((opt = malloc((nopt + 1) * sizeof(char *))) == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < nruns; i++) {
+        if ((runs[i].sim = dlsim_new()) == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        dlsim_parameters(runs[i].sim, event, timeout_interval, pkt_loss, garbled, debug_flags);
+
+        /* Side by side runs get files of their own: log files p6.logM,
+         * ... unless a log= option comes later, and the plug-in name in
+         * front of those the options name.
+         */
+        if (nruns > 1) {
+            opt[0] = run_option(&runs[i], "log=log");
+            for (j = 0; j < nopt; j++) opt[j + 1] = run_option(&runs[i], argv[7 + j]);
+            if (!dlsim_options(runs[i].sim, nopt + 1, opt)) exit(1);
+            for (j = 0; j <= nopt; j++) if (opt[j] != argv[6 + j]) free(opt[j]);
+        } else if (!dlsim_options(runs[i].sim, nopt, argv + 7)) {
+            exit(1);
+        }
+        dlsim_protocol(runs[i].sim, runs[i].plugin->proc1, runs[i].plugin->proc2,
+                       runs[i].plugin->max_seq > 0 ? runs[i].plugin->max_seq + 1 : 0);
+        dlsim_event_map(runs[i].sim, runs[i].plugin->event_map);
+    }
+
+    printf("\n\nEvents: %ld    Parameters: %d %d %d\n", event, timeout_interval, pkt_loss, garbled);
+    for (i = 0; i < nruns; i++) {
+        printf(" Simulating %s\n", runs[i].plugin->name);
+        if (pthread_create(&runs[i].thread, NULL, run_thread, &runs[i]) != 0) {
+            printf("could not start simulation of %s\n", runs[i].plugin->name);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < nruns; i++) {
+        pthread_join(runs[i].thread, NULL);
+        printf("\n\n%s (%s)\n", runs[i].plugin->name, runs[i].path);
+        dlsim_print_statistics(runs[i].sim, stdout);
+        printf("%s.\n", end_message[runs[i].status]);
+        if (runs[i].status == DLSIM_ERROR) bad = 1;
+        dlsim_free(runs[i].sim);
+    }
+    return(bad);
+}
+
+int load_plugin(struct run *r, char *name)
+{
+    /* Open plug-in name and fetch its registration. */
+
+    void *handle;
+    char *base, *dot;
+
+    if (strlen(name) + 3 > sizeof(r->path)) {
+        printf("Plug-in name too long: %s\n", name);
+        return(0);
+    }
+    sprintf(r->path, "%s%s", strchr(name, '/') == NULL ? "./" : "", name);
+    if ((handle = dlopen(r->path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        printf("%s\n", dlerror());
+        return(0);
+    }
+    r->plugin = dlsym(handle, "dlsim_plugin");
+    if (r->plugin == NULL) {
+        printf("%s is not a dlsim plug-in\n", r->path);
+        return(0);
+    }
+    if (r->plugin->abi != DLSIM_PLUGIN_ABI) {
+        printf("%s was built for plug-in ABI %d, not %d\n", r->path,
+               r->plugin->abi, DLSIM_PLUGIN_ABI);
+        return(0);
+    }
+
+    base = strrchr(r->path, '/') + 1;
+    snprintf(r->name, sizeof(r->name), "%s", base);
+    if ((dot = strrchr(r->name, '.')) != NULL && strcmp(dot, ".so") == 0) *dot = '\0';
+    return(1);
+}
+
+char *run_option(struct run *r, char *arg)
+{
+    /* The option arg for run r of several: an option that names a file
+     * gets the plug-in name in front of the last part of the file name,
+     * e.g. checkpoint=dir/warm:100 becomes checkpoint=dir/p6.warm:100.
+     * Other options, and log=none, stay as they are.
+     */
+
+    char *value, *base, *opt;
+    int i, n;
+
+    for (i = 0; i < sizeof(file_options) / sizeof(file_options[0]); i++) {
+        n = strlen(file_options[i]);
+        if (strncmp(arg, file_options[i], n) == 0) break;
+    }
+    if (i == sizeof(file_options) / sizeof(file_options[0]) || strcmp(arg, "log=none") == 0)
+        return(arg);
+    value = arg + n;
+    if ((opt = malloc(strlen(arg) + strlen(r->name) + 2)) == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    base = strrchr(value, '/') == NULL ? value : strrchr(value, '/') + 1;
+    sprintf(opt, "%.*s%s.%s", (int) (base - arg), arg, r->name, base);
+    return(opt);
+}
+
+void *run_thread(void *arg)
+{
+    struct run *r = arg;
+
+    r->status = dlsim_run(r->sim);
+    return(NULL);
+}
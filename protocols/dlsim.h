@@ -0,0 +1,153 @@
+/* libdlsim: the datalink simulator as a library.
+ *
+ * All state of a simulation lives in a struct dlsim, so any number of
+ * independent simulations can run in one process, also at the same time on
+ * different threads. In a run started with dlsim_run(), main, M0 and M1 are
+ * three threads of the calling process that talk over the same pipes as the
+ * forked simulator of start_simulator(). The protocol functions find their
+ * own end of the link through a thread-local binding, so p2-p6 run
+ * unmodified under either.
+ *
+ * A typical run:
+ *
+ *   struct dlsim *s = dlsim_new();
+ *   dlsim_parameters(s, 100000, 40, 20, 10, 0);
+ *   dlsim_protocol(s, protocol6, protocol6, MAX_SEQ + 1);
+ *   status = dlsim_run(s);
+ *   dlsim_print_statistics(s, stdout);
+ *   dlsim_free(s);
+ */
+
+#ifndef DLSIM_H
+#define DLSIM_H
+
+#include <stdio.h>
+
+/* Result of a run. */
+#define DLSIM_END        0	/* ran for the requested number of events */
+#define DLSIM_DEADLOCK   1	/* both workers idle for too long */
+#define DLSIM_ERROR      2	/* a worker stopped on a protocol or simulator error */
+#define DLSIM_LIVELOCK   3	/* no payload accepted within the watchdog window */
+
+/* Counters are 64 bits wide, so runs of billions of events do not overflow. */
+typedef unsigned long long dlsim_count;
+
+/* Statistics gathered by one worker. */
+struct dlsim_stats {
+    dlsim_count data_sent;		/* number of data frames sent */
+    dlsim_count data_retransmitted;	/* number of data frames retransmitted */
+    dlsim_count data_lost;		/* number of data frames lost */
+    dlsim_count data_not_lost;		/* number of data frames not lost */
+    dlsim_count good_data_recd;		/* number of data frames received */
+    dlsim_count cksum_data_recd;	/* number of bad data frames received */
+
+    dlsim_count acks_sent;		/* number of ack frames sent */
+    dlsim_count acks_lost;		/* number of ack frames lost */
+    dlsim_count acks_not_lost;		/* number of ack frames not lost */
+    dlsim_count good_acks_recd;		/* number of ack frames received */
+    dlsim_count cksum_acks_recd;	/* number of bad ack frames received */
+
+    dlsim_count payloads_accepted;	/* number of pkts passed to network layer */
+    dlsim_count timeouts;		/* number of timeouts */
+    dlsim_count ack_timeouts;		/* number of ack timeouts */
+
+    dlsim_count fec_parity_sent;	/* number of FEC parity frames sent */
+    dlsim_count fec_parity_lost;	/* number of FEC parity frames lost */
+    dlsim_count fec_recovered;		/* number of lost frames rebuilt by FEC */
+    dlsim_count fec_unrecovered;	/* number of lost frames FEC could not rebuild */
+
+    dlsim_count queue_wait_sum;		/* ticks packets waited to be fetched */
+    dlsim_count delay_sum;		/* ticks from enqueue to delivery */
+    dlsim_count delay_max;		/* longest delivery delay */
+    dlsim_count delays;			/* number of delivery delays summed */
+
+    dlsim_count syscalls;		/* pipe reads and writes and log flushes */
+    dlsim_count log_bytes;		/* size of the log file (dlsim_run only) */
+};
+
+struct dlsim;
+
+/* The events of the simulator, in the order of an event map. */
+#define DLSIM_FRAME_ARRIVAL        0
+#define DLSIM_CKSUM_ERR            1
+#define DLSIM_TIMEOUT              2
+#define DLSIM_NETWORK_LAYER_READY  3
+#define DLSIM_ACK_TIMEOUT          4
+#define DLSIM_NR_EVENTS            5
+
+/* A protocol built as a plug-in (a .so made with -DDLSIM_PLUGIN) describes
+ * itself to the dlsim driver with a struct dlsim_plugin named dlsim_plugin.
+ * Each protocol declares its own event_type, so event_map gives, for each
+ * simulator event above, the value wait_for_event() must return for it, or
+ * -1 for an event the protocol cannot handle. A NULL map means the
+ * protocol numbers its events like the simulator.
+ */
+#define DLSIM_PLUGIN_ABI 1
+
+struct dlsim_plugin {
+    int abi;			/* DLSIM_PLUGIN_ABI */
+    const char *name;		/* e.g. "Protocol 6" */
+    void (*proc1)(void);	/* run by M0 */
+    void (*proc2)(void);	/* run by M1 */
+    unsigned int max_seq;	/* MAX_SEQ, or 0 if sequence numbers are unused */
+    const int *event_map;	/* DLSIM_NR_EVENTS entries, or NULL */
+};
+
+/* Create a simulation with default settings, or NULL if out of memory. */
+struct dlsim *dlsim_new(void);
+
+/* Release a simulation that is not running. */
+void dlsim_free(struct dlsim *s);
+
+/* Set the five basic parameters; see start_simulator() in protocol.h.
+ * Returns 0 if one is out of range.
+ */
+int dlsim_parameters(struct dlsim *s, long events, int tm_out, int pk_loss,
+                     int grb, int d_flags);
+
+/* Apply name=value options; see parse_simulator_options() in protocol.h.
+ * Returns 0 on a bad option.
+ */
+int dlsim_options(struct dlsim *s, int argc, char *argv[]);
+
+/* Set the protocol functions run by M0 and M1, and the number of sequence
+ * numbers (see init_max_seqnr() in protocol.h; 0 keeps the default).
+ */
+void dlsim_protocol(struct dlsim *s, void (*p1)(void), void (*p2)(void),
+                    unsigned int nseqs);
+
+/* Translate the events returned by wait_for_event(); see struct
+ * dlsim_plugin. NULL (the default) returns the simulator's own numbers.
+ */
+void dlsim_event_map(struct dlsim *s, const int *map);
+
+/* Run the simulation on two worker threads and the calling thread, and
+ * return one of the DLSIM_ results above. A simulation can be run once.
+ */
+int dlsim_run(struct dlsim *s);
+
+/* Statistics of worker 0 (M0) or 1 (M1) after a run. */
+const struct dlsim_stats *dlsim_statistics(struct dlsim *s, int id);
+
+/* The cost of a run made with dlsim_run(), over main and both workers: the
+ * number of pipe reads and writes and log flushes, and the bytes logged.
+ */
+void dlsim_cost(struct dlsim *s, dlsim_count *syscalls, dlsim_count *log_bytes);
+
+/* Metrics of the batch means, computed with the option ci=REL[:BATCH]. */
+#define DLSIM_EFFICIENCY 0	/* payloads accepted per data frame sent */
+#define DLSIM_GOODPUT    1	/* payloads accepted per event */
+#define DLSIM_DELAY      2	/* delivery delay in events (traffic= only) */
+
+/* The mean of a metric over the batches of a run and the half width of its
+ * 95% confidence interval (-1 if unknown).  Returns the number of batches,
+ * 0 if batch means were off.  *converged tells whether the run stopped
+ * because the intervals were narrow enough.
+ */
+long dlsim_batch_means(struct dlsim *s, int metric, double *mean,
+                       double *halfwidth, int *converged);
+
+/* Print the statistics of both workers in the format of the simulator. */
+void dlsim_print_statistics(struct dlsim *s, FILE *f);
+
+#endif
@@ -0,0 +1,274 @@
+/* Forward error correction: XOR parity and Reed-Solomon over GF(2^8).
+ *
+ * The field uses the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d). Parity
+ * block i is the sum over j of coef[i][j] * data[j], where coef is a Cauchy
+ * matrix, so every k x k submatrix of [identity; coef] is invertible and any
+ * k surviving blocks of a group are enough to rebuild the data.
+ *
+ * Multiplying a block by a constant is done with the split-table method: the
+ * product of c with a byte is c*(low nibble) ^ c*(high nibble << 4), and both
+ * halves are looked up in 16-entry tables, which PSHUFB does 16 or 32 bytes
+ * at a time.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "fec.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define FEC_X86 1
+#endif
+
+static unsigned char gf_exp[512];	/* anti-log table, doubled to skip a mod */
+static unsigned char gf_log[256];	/* log table; gf_log[0] is unused */
+static unsigned char gf_lo[256][16];	/* c * x for x in 0..15 */
+static unsigned char gf_hi[256][16];	/* c * (x << 4) for x in 0..15 */
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;	/* tables are built once */
+
+static void (*mul_region)(unsigned char *, const unsigned char *, unsigned char, size_t);
+static void (*xor_region)(unsigned char *, const unsigned char *, size_t);
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0) return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+static void mul_region_c(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    const unsigned char *lo = gf_lo[c], *hi = gf_hi[c];
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+static void xor_region_c(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) dst[i] ^= src[i];
+}
+
+#ifdef FEC_X86
+__attribute__((target("ssse3")))
+static void mul_region_ssse3(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    __m128i tlo = _mm_loadu_si128((const __m128i *) gf_lo[c]);
+    __m128i thi = _mm_loadu_si128((const __m128i *) gf_hi[c]);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i s, l, h, d;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        s = _mm_loadu_si128((const __m128i *) (src + i));
+        l = _mm_and_si128(s, mask);
+        h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+        d = _mm_loadu_si128((const __m128i *) (dst + i));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(tlo, l));
+        d = _mm_xor_si128(d, _mm_shuffle_epi8(thi, h));
+        _mm_storeu_si128((__m128i *) (dst + i), d);
+    }
+    if (i < len) mul_region_c(dst + i, src + i, c, len - i);
+}
+
+__attribute__((target("sse2")))
+static void xor_region_sse2(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    __m128i d;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        d = _mm_loadu_si128((const __m128i *) (dst + i));
+        d = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *) (src + i)));
+        _mm_storeu_si128((__m128i *) (dst + i), d);
+    }
+    if (i < len) xor_region_c(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void mul_region_avx2(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) gf_lo[c]));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) gf_hi[c]));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i s, l, h, d;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        s = _mm256_loadu_si256((const __m256i *) (src + i));
+        l = _mm256_and_si256(s, mask);
+        h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+        d = _mm256_loadu_si256((const __m256i *) (dst + i));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(tlo, l));
+        d = _mm256_xor_si256(d, _mm256_shuffle_epi8(thi, h));
+        _mm256_storeu_si256((__m256i *) (dst + i), d);
+    }
+    if (i < len) mul_region_ssse3(dst + i, src + i, c, len - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_region_avx2(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    __m256i d;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        d = _mm256_loadu_si256((const __m256i *) (dst + i));
+        d = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *) (src + i)));
+        _mm256_storeu_si256((__m256i *) (dst + i), d);
+    }
+    if (i < len) xor_region_sse2(dst + i, src + i, len - i);
+}
+#endif
+
+static void gf_build(void)
+{
+    int i, x;
+
+    x = 1;
+    for (i = 0; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= 0x11d;
+    }
+    gf_exp[510] = gf_exp[0];
+    for (i = 0; i < 256; i++) {
+        for (x = 0; x < 16; x++) {
+            gf_lo[i][x] = gf_mul(i, x);
+            gf_hi[i][x] = gf_mul(i, x << 4);
+        }
+    }
+
+    /* Pick the widest block routines this CPU can run. */
+    mul_region = mul_region_c;
+    xor_region = xor_region_c;
+#ifdef FEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        mul_region = mul_region_avx2;
+        xor_region = xor_region_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        mul_region = mul_region_ssse3;
+        xor_region = xor_region_sse2;
+    }
+#endif
+}
+
+static void gf_setup(void)
+{
+    /* Simulations on several threads may share the tables. */
+    pthread_once(&gf_once, gf_build);
+}
+
+void fec_xor_region(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    gf_setup();
+    (*xor_region)(dst, src, len);
+}
+
+void fec_mul_region(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    gf_setup();
+    if (c == 0) return;
+    if (c == 1) (*xor_region)(dst, src, len);
+    else (*mul_region)(dst, src, c, len);
+}
+
+int fec_init(struct fec_code *c, int mode, int k, int m)
+{
+    int i, j;
+
+    gf_setup();
+    memset(c, 0, sizeof(*c));
+    if (mode == FEC_NONE) return 1;
+    if (k < 1 || k > FEC_MAX_K) return 0;
+    if (mode == FEC_XOR) m = 1;
+    if (m < 1 || m > FEC_MAX_M) return 0;
+
+    c->mode = mode;
+    c->k = k;
+    c->m = m;
+    for (i = 0; i < m; i++) {
+        for (j = 0; j < k; j++) {
+            /* Cauchy element 1/(x_i + y_j) with x_i = i and y_j = m + j. */
+            c->coef[i][j] = (mode == FEC_XOR ? 1 : gf_inv(i ^ (m + j)));
+        }
+    }
+    return 1;
+}
+
+int fec_parity_blocks(const struct fec_code *c, int n)
+{
+    return (c->m * n + c->k - 1) / c->k;
+}
+
+void fec_encode(const struct fec_code *c, unsigned char *data[], unsigned char *parity[], size_t len)
+{
+    int i, j;
+
+    for (i = 0; i < c->m; i++) {
+        memset(parity[i], 0, len);
+        for (j = 0; j < c->k; j++)
+            fec_mul_region(parity[i], data[j], c->coef[i][j], len);
+    }
+}
+
+int fec_decode(const struct fec_code *c, unsigned char *blocks[], const int present[], size_t len)
+{
+    unsigned char a[FEC_MAX_K][2 * FEC_MAX_K];	/* [A | I], reduced to [I | A^-1] */
+    int rows[FEC_MAX_K];	/* which block supplies each row of A */
+    int k = c->k, missing = 0, n = 0;
+    int i, j, r, p;
+    unsigned char t;
+
+    for (i = 0; i < k; i++)
+        if (!present[i]) missing++;
+    if (missing == 0) return 1;
+
+    /* Take every data block that survived, then parity blocks to make k. */
+    for (i = 0; i < k + c->m && n < k; i++)
+        if (present[i]) rows[n++] = i;
+    if (n < k) return 0;
+
+    memset(a, 0, sizeof(a));
+    for (r = 0; r < k; r++) {
+        if (rows[r] < k) a[r][rows[r]] = 1;
+        else memcpy(a[r], c->coef[rows[r] - k], k);
+        a[r][k + r] = 1;
+    }
+
+    /* Gauss-Jordan elimination over GF(2^8). */
+    for (j = 0; j < k; j++) {
+        for (p = j; p < k && a[p][j] == 0; p++) ;
+        if (p == k) return 0;	/* cannot happen with a Cauchy matrix */
+        if (p != j) {
+            for (i = 0; i < 2 * k; i++) {
+                t = a[p][i]; a[p][i] = a[j][i]; a[j][i] = t;
+            }
+        }
+        t = gf_inv(a[j][j]);
+        for (i = 0; i < 2 * k; i++) a[j][i] = gf_mul(a[j][i], t);
+        for (r = 0; r < k; r++) {
+            if (r == j || a[r][j] == 0) continue;
+            t = a[r][j];
+            for (i = 0; i < 2 * k; i++) a[r][i] ^= gf_mul(t, a[j][i]);
+        }
+    }
+
+    /* data[j] = sum over r of A^-1[j][r] * rows[r], only for the lost ones. */
+    for (j = 0; j < k; j++) {
+        if (present[j]) continue;
+        memset(blocks[j], 0, len);
+        for (r = 0; r < k; r++)
+            fec_mul_region(blocks[j], blocks[rows[r]], a[j][k + r], len);
+    }
+    return 1;
+}
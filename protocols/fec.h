@@ -0,0 +1,66 @@
+/* Forward error correction for the simulated channel.
+ *
+ * Frames are collected into groups of k. After the k-th frame of a group has
+ * been sent, m parity blocks are computed over the group and sent as well.
+ * A receiver that gets any k of the k + m blocks of a group can rebuild the
+ * missing frames without asking for a retransmission.  A group may also be
+ * sent with n < k frames, the rest counting as zero blocks; it then gets
+ * only as many parity blocks as fec_parity_blocks() says.
+ *
+ * Two codes are supported:
+ *   FEC_XOR  one parity block, the XOR of the k frames (m is always 1).
+ *   FEC_RS   systematic Reed-Solomon over GF(2^8) with a Cauchy matrix,
+ *            m parity blocks, any m lost blocks of a group can be recovered.
+ *
+ * The block operations are vectorized with SSSE3 or AVX2 when the CPU has
+ * them (checked at run time), and fall back to plain C otherwise.
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+
+#define FEC_NONE 0		/* no forward error correction */
+#define FEC_XOR  1		/* XOR parity over k frames */
+#define FEC_RS   2		/* Reed-Solomon over GF(2^8) */
+
+#define FEC_MAX_K 32		/* max data blocks per group */
+#define FEC_MAX_M 8		/* max parity blocks per group */
+
+struct fec_code {
+    int mode;			/* FEC_NONE, FEC_XOR or FEC_RS */
+    int k;			/* data blocks per group */
+    int m;			/* parity blocks per group */
+    unsigned char coef[FEC_MAX_M][FEC_MAX_K];	/* parity = coef * data */
+};
+
+/* Prepare a code. Returns 0 if the parameters are invalid. */
+int fec_init(struct fec_code *c, int mode, int k, int m);
+
+/* The number of parity blocks of a group of n data blocks: m for a full
+ * group, and for a shorter one m * n / k rounded up, so that parity never
+ * costs more per data block than in a full group, except for rounding.
+ */
+int fec_parity_blocks(const struct fec_code *c, int n);
+
+/* Compute the m parity blocks of a group from its k data blocks. Each block
+ * is len bytes long.
+ */
+void fec_encode(const struct fec_code *c, unsigned char *data[],
+                unsigned char *parity[], size_t len);
+
+/* Rebuild the missing data blocks of a group. blocks[0..k-1] are the data
+ * blocks, blocks[k..k+m-1] the parity blocks, and present[i] tells whether
+ * block i has arrived. Missing data blocks are written in place. Returns 1 if
+ * all data blocks are available afterwards, 0 if too many blocks were lost.
+ */
+int fec_decode(const struct fec_code *c, unsigned char *blocks[],
+               const int present[], size_t len);
+
+/* Block primitives, exposed for benchmarking: dst ^= src and dst ^= c * src. */
+void fec_xor_region(unsigned char *dst, const unsigned char *src, size_t len);
+void fec_mul_region(unsigned char *dst, const unsigned char *src,
+                    unsigned char c, size_t len);
+
+#endif
@@ -19,6 +19,9 @@ typedef enum {frame_arrival} event_type;
 #include <stdio.h>
 #include <stdlib.h>
 #include "protocol.h"
+#ifdef DLSIM_PLUGIN
+#include "dlsim.h"
+#endif
 
 
 void sender2(void)
@@ -26,15 +29,20 @@ void sender2(void)
     frame s;	/* buffer for an outbound frame */
     packet buffer;	/* buffer for an outbound packet */
     event_type event;	/* frame_arrival is the only possibility */
+    boolean restored;	/* go on from a checkpoint, made in wait_for_event */
 
+    restored = restored_from_checkpoint();	/* no variables outlive a frame */
     while (true) {
-        from_network_layer(&buffer);	/* go get something to send */
-        /* printf("procesid=%d, sender2, got_from_network\n", getpid()); */
-        init_frame(&s);
-        s.info = buffer;	/* copy it into s for transmission */
-        /* printf("procesid=%d, sender2, calls to_physical\n", getpid()); */
-        to_physical_layer(&s);	/* bye bye little frame */
-        /* printf("procesid=%d, sender2, back from physical\n", getpid()); */
+        if (!restored) {
+            from_network_layer(&buffer);	/* go get something to send */
+            /* printf("procesid=%d, sender2, got_from_network\n", getpid()); */
+            init_frame(&s);
+            s.info = buffer;	/* copy it into s for transmission */
+            /* printf("procesid=%d, sender2, calls to_physical\n", getpid()); */
+            to_physical_layer(&s);	/* bye bye little frame */
+            /* printf("procesid=%d, sender2, back from physical\n", getpid()); */
+        }
+        restored = false;
         wait_for_event(&event);	/* do not proceed until given the go ahead */
         /* printf("procesid=%d, sender2, back from wait_for_event\n", getpid()); */
     }
@@ -58,18 +66,26 @@ void receiver2(void)
     }
 }
 
+#ifdef DLSIM_PLUGIN
+/* Registration for the dlsim driver. */
+const struct dlsim_plugin dlsim_plugin = {
+    DLSIM_PLUGIN_ABI, "Protocol 2", sender2, receiver2, 0, NULL
+};
+#else
 int main(int argc, char *argv[])
 {
     int timeout_interval, pkt_loss, garbled, debug_flags;
     long event;
 
     if (!parse_first_five_parameters(argc, argv, &event, &timeout_interval,
-                                     &pkt_loss, &garbled, &debug_flags))  {
-        printf ("Usage: p2 events timeout loss cksum debug\n");
+                                     &pkt_loss, &garbled, &debug_flags)
+        || !parse_simulator_options(argc - 6, argv + 6))  {
+        printf ("Usage: p2 events timeout loss cksum debug [options]\n");
         exit(1);
     }
 
     printf("\n\n Simulating Protocol 2\n");
     start_simulator(sender2, receiver2, event, timeout_interval, pkt_loss, garbled, debug_flags);
 }
+#endif
 
@@ -18,24 +18,36 @@ typedef enum  {frame_arrival, cksum_err, timeout} event_type;
 #include <stdlib.h>
 #include <unistd.h>
 #include "protocol.h"
+#ifdef DLSIM_PLUGIN
+#include "dlsim.h"
+#endif
 
 void sender3(void);
 void receiver3(void);
 
+#ifdef DLSIM_PLUGIN
+/* Registration for the dlsim driver. */
+static const int events[DLSIM_NR_EVENTS] = {frame_arrival, cksum_err, timeout, -1, -1};
+const struct dlsim_plugin dlsim_plugin = {
+    DLSIM_PLUGIN_ABI, "Protocol 3", sender3, receiver3, MAX_SEQ, events
+};
+#else
 int main(int argc, char *argv[])
 {
     int timeout_interval, pkt_loss, garbled, debug_flags;
     long event;
 
     if (!parse_first_five_parameters(argc, argv, &event, &timeout_interval,
-                                     &pkt_loss, &garbled, &debug_flags))  {
-        printf ("Usage: p3 events timeout loss cksum debug\n");
+                                     &pkt_loss, &garbled, &debug_flags)
+        || !parse_simulator_options(argc - 6, argv + 6))  {
+        printf ("Usage: p3 events timeout loss cksum debug [options]\n");
         exit(1);
     }
 
     printf("\n\n Simulating Protocol 3\n");
     start_simulator(sender3, receiver3, event, timeout_interval, pkt_loss, garbled, debug_flags);
 }
+#endif
 
 void sender3(void)
 {
@@ -43,19 +55,28 @@ void sender3(void)
     frame s;		/* scratch variable */
     packet buffer;	/* buffer for an outbound packet */
     event_type event;
+    boolean restored;	/* go on from a checkpoint, made in wait_for_event */
 
     /* put protocolnumber and process id in log */                /*JH*/
     sprintf(logbuf,"XXX3 protocol3 Sender, pid=%d\n", getpid()); /*JH*/
     flog_string(logbuf);                                         /*JH*/
 
-    next_frame_to_send = 0;	/* initialize outbound sequence numbers */
-    from_network_layer(&buffer);	/* fetch first packet */
+    checkpoint_variable(&next_frame_to_send, sizeof(next_frame_to_send));
+    checkpoint_variable(&buffer, sizeof(buffer));
+    restored = restored_from_checkpoint();
+    if (!restored) {
+        next_frame_to_send = 0;	/* initialize outbound sequence numbers */
+        from_network_layer(&buffer);	/* fetch first packet */
+    }
     while (true) {
-        init_frame(&s);
-        s.info = buffer;	/* construct a frame for transmission */
-        s.seq = next_frame_to_send;	/* insert sequence number in frame */
-        to_physical_layer(&s);	/* send it on its way */
-        start_timer(s.seq);	/* if answer takes too long, time out */
+        if (!restored) {
+            init_frame(&s);
+            s.info = buffer;	/* construct a frame for transmission */
+            s.seq = next_frame_to_send;	/* insert sequence number in frame */
+            to_physical_layer(&s);	/* send it on its way */
+            start_timer(s.seq);	/* if answer takes too long, time out */
+        }
+        restored = false;
         wait_for_event(&event);	/* frame_arrival, cksum_err, timeout */
         if (event == frame_arrival) {
             from_physical_layer(&s);	/* get the acknowledgement */
@@ -78,7 +99,8 @@ void receiver3(void)
     sprintf(logbuf,"XXX3 protocol3 Receiver, pid=%d\n", getpid()); /*JH*/
     flog_string(logbuf);                                         /*JH*/
 
-    frame_expected = 0;
+    checkpoint_variable(&frame_expected, sizeof(frame_expected));
+    if (!restored_from_checkpoint()) frame_expected = 0;
     while (true) {
         wait_for_event(&event);	/* possibilities: frame_arrival, cksum_err */
         if (event == frame_arrival) {
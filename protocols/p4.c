@@ -15,6 +15,9 @@ typedef enum {frame_arrival, cksum_err, timeout} event_type;
 #include <unistd.h>
 #include <stdlib.h>
 #include "protocol.h"
+#ifdef DLSIM_PLUGIN
+#include "dlsim.h"
+#endif
 
 /**
  * With Wait For Peer, wait for the first ACK before sending.
@@ -31,23 +34,28 @@ void protocol4 (_Bool wait_for_peer)
     sprintf(logbuf,"XXX4 protocol4, pid=%d\n", getpid());
     flog_string(logbuf);
 
-    next_frame_to_send = 0;	/* next frame on the outbound stream */
-    frame_expected = 0;	/* number of frame arriving frame expected */
-    from_network_layer(&buffer);	/* fetch a packet from the network layer */
-
-    /**
-     * If we wait for the peer, we do not send a packet until
-     * we received a packet from the peer. This way, no no-payload packets are
-     * needed for acking.
-     */
-    if(!wait_for_peer) {
-        init_frame(&s);
-        s.kind = data;
-        s.info = buffer;	/* prepare to send the initial frame */
-        s.seq = next_frame_to_send;	/* insert sequence number into frame */
-        s.ack = 1 - frame_expected;	/* piggybacked ack */
-        to_physical_layer(&s);	/* transmit the frame */
-        start_timer(s.seq);	/* start the timer running */
+    checkpoint_variable(&next_frame_to_send, sizeof(next_frame_to_send));
+    checkpoint_variable(&frame_expected, sizeof(frame_expected));
+    checkpoint_variable(&buffer, sizeof(buffer));
+    if (!restored_from_checkpoint()) {
+        next_frame_to_send = 0;	/* next frame on the outbound stream */
+        frame_expected = 0;	/* number of frame arriving frame expected */
+        from_network_layer(&buffer);	/* fetch a packet from the network layer */
+
+        /**
+         * If we wait for the peer, we do not send a packet until
+         * we received a packet from the peer. This way, no no-payload packets are
+         * needed for acking.
+         */
+        if(!wait_for_peer) {
+            init_frame(&s);
+            s.kind = data;
+            s.info = buffer;	/* prepare to send the initial frame */
+            s.seq = next_frame_to_send;	/* insert sequence number into frame */
+            s.ack = 1 - frame_expected;	/* piggybacked ack */
+            to_physical_layer(&s);	/* transmit the frame */
+            start_timer(s.seq);	/* start the timer running */
+        }
     }
 
     while (true) {
@@ -92,14 +100,22 @@ void protocol4_nwfp() {
     return protocol4(false);
 }
 
+#ifdef DLSIM_PLUGIN
+/* Registration for the dlsim driver. */
+static const int events[DLSIM_NR_EVENTS] = {frame_arrival, cksum_err, timeout, -1, -1};
+const struct dlsim_plugin dlsim_plugin = {
+    DLSIM_PLUGIN_ABI, "Protocol 4", protocol4_wfp, protocol4_nwfp, MAX_SEQ, events
+};
+#else
 int main (int argc, char *argv[])
 {
     int timeout_interval, pkt_loss, garbled, debug_flags;
     long event;
 
     if (!parse_first_five_parameters(argc, argv, &event, &timeout_interval,
-                                     &pkt_loss, &garbled, &debug_flags))  {
-        printf ("Usage: p4 events timeout loss cksum debug\n");
+                                     &pkt_loss, &garbled, &debug_flags)
+        || !parse_simulator_options(argc - 6, argv + 6))  {
+        printf ("Usage: p4 events timeout loss cksum debug [options]\n");
         exit(1);
     }
 
@@ -108,4 +124,5 @@ int main (int argc, char *argv[])
 
     return 0;
 }
+#endif
 
@@ -15,6 +15,9 @@
 typedef enum {frame_arrival, cksum_err, timeout, network_layer_ready} event_type;
 #include <unistd.h>
 #include "protocol.h"
+#ifdef DLSIM_PLUGIN
+#include "dlsim.h"
+#endif
 
 static boolean between(seq_nr a, seq_nr b, seq_nr c)
 {
@@ -55,11 +58,18 @@ void protocol5(void)
     flog_string(logbuf);                                  /*JH*/
 
 
-    enable_network_layer();	/* allow network_layer_ready events */
-    ack_expected = 0;	/* next ack expected inbound */
-    next_frame_to_send = 0;	/* next frame going out */
-    frame_expected = 0;	/* number of frame expected inbound */
-    nbuffered = 0;	/* initially no packets are buffered */
+    checkpoint_variable(&next_frame_to_send, sizeof(next_frame_to_send));
+    checkpoint_variable(&ack_expected, sizeof(ack_expected));
+    checkpoint_variable(&frame_expected, sizeof(frame_expected));
+    checkpoint_variable(buffer, sizeof(buffer));
+    checkpoint_variable(&nbuffered, sizeof(nbuffered));
+    if (!restored_from_checkpoint()) {
+        enable_network_layer();	/* allow network_layer_ready events */
+        ack_expected = 0;	/* next ack expected inbound */
+        next_frame_to_send = 0;	/* next frame going out */
+        frame_expected = 0;	/* number of frame expected inbound */
+        nbuffered = 0;	/* initially no packets are buffered */
+    }
 
     while (true) {
         wait_for_event(&event);	/* four possibilities: see event_type above */
@@ -109,14 +119,22 @@ void protocol5(void)
     }
 }
 
+#ifdef DLSIM_PLUGIN
+/* Registration for the dlsim driver. */
+static const int events[DLSIM_NR_EVENTS] = {frame_arrival, cksum_err, timeout, network_layer_ready, -1};
+const struct dlsim_plugin dlsim_plugin = {
+    DLSIM_PLUGIN_ABI, "Protocol 5", protocol5, protocol5, MAX_SEQ, events
+};
+#else
 int main(int argc, char *argv[])
 {
     int timeout_interval, pkt_loss, garbled, debug_flags;
     long event;
 
     if (!parse_first_five_parameters(argc, argv, &event, &timeout_interval,
-                                     &pkt_loss, &garbled, &debug_flags))  {
-        printf ("Usage: p5 events timeout loss cksum debug\n");
+                                     &pkt_loss, &garbled, &debug_flags)
+        || !parse_simulator_options(argc - 6, argv + 6))  {
+        printf ("Usage: p5 events timeout loss cksum debug [options]\n");
         exit(1);
     }
     
@@ -125,4 +143,5 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+#endif
 
@@ -16,7 +16,9 @@
 typedef enum {frame_arrival, cksum_err, timeout, network_layer_ready, ack_timeout} event_type;
 #include <unistd.h>
 #include "protocol.h"
-boolean no_nak = true;	/* no nak has been sent yet */
+#ifdef DLSIM_PLUGIN
+#include "dlsim.h"
+#endif
 
 static boolean between(seq_nr a, seq_nr b, seq_nr c)
 {
@@ -24,7 +26,7 @@ static boolean between(seq_nr a, seq_nr b, seq_nr c)
     return ((a <= b) && (b < c)) || ((c < a) && (a <= b)) || ((b < c) && (c < a));
 }
 
-static void send_frame(frame_kind fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[])
+static void send_frame(frame_kind fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[], boolean *no_nak)
 {
     /* Construct and send a data, ack, or nak frame. */
     frame s;	/* scratch variable */
@@ -33,7 +35,7 @@ static void send_frame(frame_kind fk, seq_nr frame_nr, seq_nr frame_expected, pa
     if (fk == data) s.info = buffer[frame_nr % NR_BUFS];
     s.seq = frame_nr;	/* only meaningful for data frames */
     s.ack = (frame_expected + MAX_SEQ) % (MAX_SEQ + 1);
-    if (fk == nak) no_nak = false;	/* one nak per frame, please */
+    if (fk == nak) *no_nak = false;	/* one nak per frame, please */
     to_physical_layer(&s);	/* transmit the frame */
     /*  if (fk == data) start_timer(frame_nr % NR_BUFS); */
     if (fk == data) start_timer(frame_nr); /*JH*/
@@ -54,26 +56,38 @@ void protocol6(void)
     boolean arrived[NR_BUFS];	/* inbound bit map */
     seq_nr nbuffered;	/* how many output buffers currently used */
     event_type event;
+    boolean no_nak = true;	/* no nak has been sent yet */
 
     /* put protocolnumber and process id in logfile */      /*JH*/
     sprintf(logbuf,"XXX6 protocol6, pid=%d\n", getpid()); /*JH*/
     flog_string(logbuf);                                  /*JH*/
 
-    enable_network_layer();	/* initialize */
-    ack_expected = 0;	/* next ack expected on the inbound stream */
-    next_frame_to_send = 0;	/* number of next outgoing frame */
-    frame_expected = 0;	/* frame number expected */
-    too_far = NR_BUFS;	/* receiver's upper window + 1 */
-    nbuffered = 0;	/* initially no packets are buffered */
-
-    for (i = 0; i < NR_BUFS; i++) arrived[i] = false;
+    checkpoint_variable(&ack_expected, sizeof(ack_expected));
+    checkpoint_variable(&next_frame_to_send, sizeof(next_frame_to_send));
+    checkpoint_variable(&frame_expected, sizeof(frame_expected));
+    checkpoint_variable(&too_far, sizeof(too_far));
+    checkpoint_variable(out_buf, sizeof(out_buf));
+    checkpoint_variable(in_buf, sizeof(in_buf));
+    checkpoint_variable(arrived, sizeof(arrived));
+    checkpoint_variable(&nbuffered, sizeof(nbuffered));
+    checkpoint_variable(&no_nak, sizeof(no_nak));
+    if (!restored_from_checkpoint()) {
+        enable_network_layer();	/* initialize */
+        ack_expected = 0;	/* next ack expected on the inbound stream */
+        next_frame_to_send = 0;	/* number of next outgoing frame */
+        frame_expected = 0;	/* frame number expected */
+        too_far = NR_BUFS;	/* receiver's upper window + 1 */
+        nbuffered = 0;	/* initially no packets are buffered */
+
+        for (i = 0; i < NR_BUFS; i++) arrived[i] = false;
+    }
     while (true) {
         wait_for_event(&event);	/* five possibilities: see event_type above */
         switch(event) {
             case network_layer_ready:	/* accept, save, and transmit a new frame */
                 nbuffered = nbuffered + 1;	/* expand the window */
                 from_network_layer(&out_buf[next_frame_to_send % NR_BUFS]); /* fetch new packet */
-                send_frame(data, next_frame_to_send, frame_expected, out_buf);	/* transmit the frame */
+                send_frame(data, next_frame_to_send, frame_expected, out_buf, &no_nak);	/* transmit the frame */
                 inc(next_frame_to_send);	/* advance upper window edge */
                 break;
 
@@ -82,7 +96,7 @@ void protocol6(void)
                 if (r.kind == data) {
                     /* An undamaged frame has arrived. */
                     if ((r.seq != frame_expected) && no_nak)
-                        send_frame(nak, 0, frame_expected, out_buf); else start_ack_timer();
+                        send_frame(nak, 0, frame_expected, out_buf, &no_nak); else start_ack_timer();
 
                     if (between(frame_expected, r.seq, too_far) && (arrived[r.seq%NR_BUFS] == false)) {
                         /* Frames may be accepted in any order. */
@@ -102,7 +116,7 @@ void protocol6(void)
                     }
                 }
                 if((r.kind==nak) && between(ack_expected,(r.ack+1)%(MAX_SEQ+1),next_frame_to_send))
-                    send_frame(data, (r.ack+1) % (MAX_SEQ + 1), frame_expected, out_buf);
+                    send_frame(data, (r.ack+1) % (MAX_SEQ + 1), frame_expected, out_buf, &no_nak);
 
                 while (between(ack_expected, r.ack, next_frame_to_send)) {
                     nbuffered = nbuffered - 1;	/* handle piggybacked ack */
@@ -111,23 +125,30 @@ void protocol6(void)
                 }
                 break;
 
-            case cksum_err: if (no_nak) send_frame(nak, 0, frame_expected, out_buf); break;	/* damaged frame */
-            case timeout: send_frame(data, get_timedout_seqnr(), frame_expected, out_buf); break;	/* we timed out */
-            case ack_timeout: send_frame(ack,0,frame_expected, out_buf);	/* ack timer expired; send ack */
+            case cksum_err: if (no_nak) send_frame(nak, 0, frame_expected, out_buf, &no_nak); break;	/* damaged frame */
+            case timeout: send_frame(data, get_timedout_seqnr(), frame_expected, out_buf, &no_nak); break;	/* we timed out */
+            case ack_timeout: send_frame(ack,0,frame_expected, out_buf, &no_nak);	/* ack timer expired; send ack */
         }
 
         if (nbuffered < NR_BUFS) enable_network_layer(); else disable_network_layer();
     }
 }
 
+#ifdef DLSIM_PLUGIN
+/* Registration for the dlsim driver. */
+const struct dlsim_plugin dlsim_plugin = {
+    DLSIM_PLUGIN_ABI, "Protocol 6", protocol6, protocol6, MAX_SEQ, NULL
+};
+#else
 int main (int argc, char *argv[])
 {
     int timeout_interval, pkt_loss, garbled, debug_flags;
     long event;
 
     if (!parse_first_five_parameters(argc, argv, &event, &timeout_interval,
-                                     &pkt_loss, &garbled, &debug_flags)) {
-        printf ("Usage: p6 events timeout loss cksum debug\n");
+                                     &pkt_loss, &garbled, &debug_flags)
+        || !parse_simulator_options(argc - 6, argv + 6)) {
+        printf ("Usage: p6 events timeout loss cksum debug [options]\n");
         exit(1);
     }
 
@@ -137,3 +158,4 @@ int main (int argc, char *argv[])
 
     return 0;
 }
+#endif
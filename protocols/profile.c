@@ -0,0 +1,65 @@
+/* Hot-path profiling counters for the simulator.  See profile.h. */
+
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+
+#ifdef DLSIM_PROFILE
+
+__thread struct prof_counter prof_counters[PF_COUNT];
+__thread int prof_depth;
+__thread unsigned long long prof_entered;
+__thread unsigned long long prof_inside;
+__thread unsigned long long prof_io_t0;
+__thread long prof_io_ret;
+static __thread unsigned long long prof_begin;	/* when the counters were reset */
+
+static const char *prof_names[PF_COUNT] = {
+    "wait_for_event", "pick_event", "queue_frames", "frametype",
+    "to_physical_layer", "from_physical_layer", "recalc_timers",
+    "check_timers", "read control pipe", "write control pipe",
+    "read frame pipe", "write frame pipe", "logging"
+};
+
+void prof_reset(void)
+{
+    memset(prof_counters, 0, sizeof(prof_counters));
+    prof_depth = 0;
+    prof_inside = 0;
+    prof_begin = prof_clock();
+}
+
+void prof_report(FILE *f, const char *who, const char *own)
+{
+    /* The report is put together first and printed at once, so that the
+     * reports of threads that end together do not get mixed up.
+     */
+
+    char buf[2048];
+    int i, n;
+    unsigned long long total, inside;
+    struct prof_counter *c;
+
+    total = prof_clock() - prof_begin;
+    inside = prof_inside + (prof_depth > 0 ? prof_clock() - prof_entered : 0);
+    if (total == 0) total = 1;
+
+    n = snprintf(buf, sizeof(buf), "\nProfile of %s (TSC cycles, inclusive):\n"
+                 "\t%-22s %12s %12s %12s %7s\n", who, "function", "calls",
+                 "Mcycles", "cycles/call", "%");
+    for (i = 0; i < PF_COUNT; i++) {
+        c = &prof_counters[i];
+        if (c->calls == 0) continue;
+        n += snprintf(buf + n, sizeof(buf) - n, "\t%-22s %12llu %12.2f %12.1f %7.2f\n",
+                      prof_names[i], c->calls, c->cycles / 1e6,
+                      (double) c->cycles / c->calls, 100.0 * c->cycles / total);
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "\t%-22s %12s %12.2f %12s %7.2f\n",
+                  "all of the above", "", inside / 1e6, "", 100.0 * inside / total);
+    n += snprintf(buf + n, sizeof(buf) - n, "\t%-22s %12s %12.2f %12s %7.2f\n",
+                  own, "", (total - inside) / 1e6, "", 100.0 * (total - inside) / total);
+    snprintf(buf + n, sizeof(buf) - n, "\t%-22s %12s %12.2f\n", "total", "", total / 1e6);
+    fputs(buf, f);
+}
+
+#endif
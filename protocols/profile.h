@@ -0,0 +1,109 @@
+/* Hot-path profiling counters for the simulator.
+ *
+ * Built with -DDLSIM_PROFILE (make PROFILE=1), the simulator counts the
+ * calls of its core functions and the time stamp counter (TSC) cycles spent
+ * in them, including the time blocked in read() and write() on the pipes.
+ * Each thread (or process) of a simulation, main, M0 and M1, keeps its own
+ * counters and prints them when it ends.  Cycles are inclusive: e.g. the
+ * cycles of pick_event() are part of those of wait_for_event().  The cycles
+ * a worker spends outside all of the instrumented functions are the
+ * protocol's own.
+ *
+ * Without -DDLSIM_PROFILE the macros below expand to nothing.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+/* Instrumented functions. */
+#define PF_WAIT_FOR_EVENT     0
+#define PF_PICK_EVENT         1
+#define PF_QUEUE_FRAMES       2
+#define PF_FRAMETYPE          3
+#define PF_TO_PHYSICAL        4
+#define PF_FROM_PHYSICAL      5
+#define PF_RECALC_TIMERS      6
+#define PF_CHECK_TIMERS       7
+#define PF_CONTROL_READ       8	/* waiting for the go-ahead or a reply */
+#define PF_CONTROL_WRITE      9	/* sending the go-ahead or a reply */
+#define PF_FRAME_READ        10	/* reading frames from the peer */
+#define PF_FRAME_WRITE       11	/* writing frames to the peer */
+#define PF_LOG               12	/* writing and flushing log files */
+#define PF_COUNT             13
+
+#ifdef DLSIM_PROFILE
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+struct prof_counter {
+    unsigned long long calls;	/* number of calls */
+    unsigned long long cycles;	/* cycles spent in them */
+};
+
+extern __thread struct prof_counter prof_counters[PF_COUNT];
+extern __thread int prof_depth;			/* nesting of instrumented calls */
+extern __thread unsigned long long prof_entered;	/* when depth went from 0 to 1 */
+extern __thread unsigned long long prof_inside;	/* cycles at depth > 0 */
+extern __thread unsigned long long prof_io_t0;	/* start of a timed read or write */
+extern __thread long prof_io_ret;		/* its result */
+
+static inline unsigned long long prof_clock(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;		/* nanoseconds stand in for cycles */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline unsigned long long prof_enter(void)
+{
+    unsigned long long t = prof_clock();
+
+    if (prof_depth++ == 0) prof_entered = t;
+    return t;
+}
+
+static inline void prof_leave(int f, unsigned long long t0)
+{
+    unsigned long long t = prof_clock();
+
+    prof_counters[f].calls++;
+    prof_counters[f].cycles += t - t0;
+    if (--prof_depth == 0) prof_inside += t - prof_entered;
+}
+
+/* Zero the counters of the calling thread and start its clock. */
+void prof_reset(void);
+
+/* Print the counters of the calling thread, which runs who (e.g. "Main").
+ * Own is what the cycles outside the instrumented functions are spent on.
+ */
+void prof_report(FILE *f, const char *who, const char *own);
+
+/* Time the rest of a function from its declarations on, or an expression. */
+#define PROF_BEGIN() unsigned long long prof_t0 = prof_enter()
+#define PROF_END(f) prof_leave(f, prof_t0)
+#define PROF_IO(f, call) \
+    (prof_io_t0 = prof_enter(), prof_io_ret = (call), prof_leave(f, prof_io_t0), prof_io_ret)
+
+#else
+
+#define PROF_BEGIN()
+#define PROF_END(f)
+#define PROF_IO(f, call) (call)
+#define prof_reset()
+#define prof_report(f, who, own)
+
+#endif
+
+#endif
@@ -89,6 +89,19 @@ void disable_network_layer(void);
 void init_max_seqnr(unsigned int o);
 unsigned int get_timedout_seqnr(void);
 
+/* A checkpoint (option checkpoint=) saves the state of a simulation, and a
+ * later run can go on from it (option restore=).  The simulator saves its
+ * own state, but the protocol has to tell it which of its variables make up
+ * its state: its window edges, buffers and the like, not scratch frames.  A
+ * protocol calls checkpoint_variable() for each of them once, before its
+ * main loop, and then restored_from_checkpoint().  That function gives the
+ * variables their saved values and returns true when the run is restored;
+ * the protocol must then skip its initialization and continue as if
+ * wait_for_event() returned, because that is where the checkpoint was made.
+ */
+void checkpoint_variable(void *var, unsigned int size);
+boolean restored_from_checkpoint(void);
+
 /* Help function for protocol designers to parse first five command-line
  * parameters that the simulator needs. This assumes that the first five
  * command-line parameters are the simulator parameters. If a protocol needs
@@ -98,10 +111,49 @@ int parse_first_five_parameters(int argc, char *argv[], long *event,
                                 int *timeout_interval, int *pkt_loss,
                                 int *garbled, int *debug_flags);
 
+/* Help function to parse the optional simulator options that may follow the
+ * first five command-line parameters, each written as name=value:
+ *   fec=xor:K      forward error correction, XOR parity over K frames
+ *   fec=rs:K:M     forward error correction, Reed-Solomon with M parity
+ *                  frames per K frames; any M lost frames can be rebuilt
+ *   traffic=poisson:RATE        packets arrive from the network layer as a
+ *   traffic=onoff:RATE:ON:OFF   Poisson process, in on-off bursts, or at the
+ *   traffic=trace:FILE[,FILE1]  times (in events) listed in a file; by
+ *                               default a packet is always ready
+ *   log=PREFIX     name the log files PREFIXM, PREFIX0 and PREFIX1 instead of
+ *                  logM, log0 and log1; log=none turns logging off
+ *   seed=N         seed of the random number generators (default 1)
+ *   checkpoint=FILE[:N]  save the state of the simulation in FILE when it
+ *                  ends, and every N events if N is given
+ *   restore=FILE   go on from the state saved in FILE; the number of
+ *                  events counts from the start of the first run, and the
+ *                  timeout, loss and cksum parameters may differ from
+ *                  those of that run
+ *   record=PREFIX  write the random decisions (which process runs, which
+ *                  frames are lost or garbled) to PREFIX.sched, .lost0,
+ *                  .lost1, .garbled0 and .garbled1
+ *   replay=PREFIX  take the decisions from such a record instead of the
+ *                  random number generators, and write no logs
+ *   ci=REL[:BATCH] stop once the 95% confidence intervals of the batch
+ *                  means (BATCH events per batch, default 1000) are within
+ *                  REL times the means; events is then only a cap
+ *   watchdog=N     stop when no payload has been accepted for N events
+ *   transport=udp[:USEC]  send the frames over loopback UDP sockets and
+ *                  run on the wall clock, USEC microseconds per event
+ *   io=uring       read and write the pipes through io_uring
+ *   trace=PREFIX   write timelines to PREFIX0.json and PREFIX1.json
+ *   link0=LOSS:CKSUM[:DELAY[:RATE]]  loss and cksum percentages, delay in
+ *                  events and frames per event of the frames M0 sends;
+ *                  link1= for those of M1
+ * Pass the remaining arguments (argc - 6, argv + 6). Returns 0 on a bad
+ * option. This function must be called before start_simulator().
+ */
+int parse_simulator_options(int argc, char *argv[]);
+
 /* copy a buffer to the log file of the process */
 void flog_string(char *logbuf);
 
 /* Macro inc is expanded in-line: Increment k circularly. */
 #define inc(k) if (k < MAX_SEQ) k = k + 1; else k = 0
 
-char logbuf[255];      /* a buffer to present strings to flog_string */
+extern __thread char logbuf[255];      /* a buffer to present strings to flog_string */
@@ -0,0 +1,34 @@
+/* Recording and replay of the random decisions of a simulation.  See
+ * record.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "record.h"
+
+int bits_open(struct bitstream *b, int mode, const char *file)
+{
+    memset(b, 0, sizeof(*b));
+    if ((b->f = fopen(file, mode == BITS_RECORD ? "wb" : "rb")) == NULL) return(0);
+    if (mode == BITS_RECORD) {
+        fwrite(&b->n, sizeof(b->n), 1, b->f);	/* filled in by bits_close() */
+    } else if (fread(&b->n, sizeof(b->n), 1, b->f) != 1) {
+        fclose(b->f);
+        b->f = NULL;
+        return(0);
+    }
+    b->mode = mode;
+    return(1);
+}
+
+void bits_close(struct bitstream *b)
+{
+    if (b->mode == BITS_RECORD) {
+        if (b->nbits > 0) putc(b->byte, b->f);
+        rewind(b->f);
+        fwrite(&b->n, sizeof(b->n), 1, b->f);
+    }
+    if (b->f != NULL) fclose(b->f);
+    b->f = NULL;
+    b->mode = BITS_OFF;
+}
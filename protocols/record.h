@@ -0,0 +1,73 @@
+/* Recording and replay of the random decisions of a simulation.
+ *
+ * A simulation makes three kinds of random decisions: which process main
+ * runs at each tick, whether each frame sent is lost, and whether each
+ * frame received is garbled.  With record=PREFIX each kind of decision is
+ * written to a bit stream of its own: main's to PREFIX.sched, and those of
+ * M0 to PREFIX.lost0 and PREFIX.garbled0 (M1 to ...1).  With replay=PREFIX
+ * they are read back instead of drawn, so that a changed protocol meets the
+ * same channel: its n-th frame is lost if the n-th frame of the recorded
+ * run was.  When a stream runs out, the decisions are drawn again.
+ *
+ * A stream file holds the number of bits (8 bytes, in the byte order of the
+ * machine), followed by the bits, 8 per byte, lowest bit first.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+
+#define BITS_OFF    0		/* decisions are neither recorded nor replayed */
+#define BITS_RECORD 1		/* decisions are written to the stream */
+#define BITS_REPLAY 2		/* decisions are read from the stream */
+
+struct bitstream {
+    int mode;			/* one of the BITS_ values above */
+    FILE *f;			/* the stream file */
+    unsigned long long n;	/* bits written, or bits left to read */
+    unsigned int byte;		/* bits not yet written, or not yet used */
+    int nbits;			/* number of those bits */
+};
+
+/* Open stream file for mode BITS_RECORD or BITS_REPLAY.  Returns 0 if the
+ * file cannot be opened; the stream is then off.
+ */
+int bits_open(struct bitstream *b, int mode, const char *file);
+
+/* Write the bits still buffered and the count, and close the file. */
+void bits_close(struct bitstream *b);
+
+/* Record one decision, if the stream records. */
+static inline void bits_put(struct bitstream *b, int bit)
+{
+    if (b->mode != BITS_RECORD) return;
+    b->byte |= (bit & 1) << b->nbits;
+    b->n++;
+    if (++b->nbits == 8) {
+        putc(b->byte, b->f);
+        b->byte = 0;
+        b->nbits = 0;
+    }
+}
+
+/* The next replayed decision, or -1 if the stream does not replay or has
+ * run out.
+ */
+static inline int bits_get(struct bitstream *b)
+{
+    int bit;
+
+    if (b->mode != BITS_REPLAY || b->n == 0) return(-1);
+    if (b->nbits == 0) {
+        b->byte = getc(b->f);
+        b->nbits = 8;
+    }
+    bit = b->byte & 1;
+    b->byte >>= 1;
+    b->nbits--;
+    b->n--;
+    return(bit);
+}
+
+#endif
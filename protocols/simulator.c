@@ -5,6 +5,8 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -14,13 +16,11 @@
 #include <errno.h>  /*JH*/
 #include <time.h>   /*JH*/
 #include "simulator.h"
+#include "profile.h"
 
-#define NR_TIMERS 8             /* number of timers; this should be greater
-than half the number of sequence numbers. */
-#define MAX_QUEUE 1000            /* max number of buffered frames */
 #define FRAME_SIZE (sizeof(frame))
+#define WIRE_SIZE (sizeof(wire))
 #define BYTE 0377               /* byte mask */
-#define UINT_MAX  0xFFFFFFFF    /* maximum value of an unsigned 32-bit int */
 #define INTERVAL 100000         /* interval for periodic printing */
 #define AUX 2                   /* aux timeout is main timeout/AUX */
 
@@ -30,77 +30,141 @@ than half the number of sequence numbers. */
 #define TIMEOUTS     0x0004     /* timeouts */
 #define PERIODIC     0x0008     /* periodic printout for use with long runs */
 
-#define DEADLOCK (3 * timeout_interval)	/* defines what a deadlock is */
+#define DEADLOCK(s) (3 * (s)->timeout_interval)	/* defines what a deadlock is */
 #define MANY 256		/* big enough to clear pipe at the end */
 
-/* Status variables used by the workers, M0 and M1. */
-bigint ack_timer[NR_TIMERS];    /* ack timers */
-unsigned int seqs[NR_TIMERS];   /* last sequence number sent per timer */
-bigint lowest_timer;            /* lowest of the timers */
-bigint aux_timer;               /* value of the auxiliary timer */
-int network_layer_status;       /* 0 is disabled, 1 is enabled */
-unsigned int next_net_pkt;      /* seq of next network packet to fetch */
-unsigned int last_pkt_given= 0xFFFFFFFF;        /* seq of last pkt delivered*/
-frame last_frame;               /* arrive frames are kept here */
-int offset;                     /* to prevent multiple timeouts on same tick*/
-bigint tick;                    /* current time */
-int retransmitting;             /* flag that is set on a timeout */
-int nseqs = NR_TIMERS;          /* must be MAX_SEQ + 1 after startup */
-unsigned int oldest_frame = NR_TIMERS;  /* tells which frame timed out */
+/* Size of the part of struct dlsim_worker from field first up to field end. */
+#define SPAN(first, end) \
+    (offsetof(struct dlsim_worker, end) - offsetof(struct dlsim_worker, first))
+
+/* A worker's section of a checkpoint: its reply to main, the fields from
+ * ack_timer up to the queue (timers, seqs[], sequence state, RNG and
+ * statistics), the number of queued frames and the frames, the FEC state,
+ * the traffic generators, and the protocol's variables, each preceded by
+ * its size.
+ */
+#define SECTION_SIZE (TICK_SIZE + SPAN(ack_timer, queue) + sizeof(int) + \
+                      SPAN(fec_tx, fec_in) + SPAN(traffic_out, vars) + sizeof(int))
+#define CHECKPOINT_MAGIC "dlsimck2"
+
+/* Write to a log file, unless logging is turned off. */
+#define LOG(f, ...) do { if (f) { PROF_BEGIN(); fprintf(f, __VA_ARGS__); PROF_END(PF_LOG); } } while (0)
+#define FLUSH(f, n) do { if (f) { PROF_BEGIN(); fflush(f); (n)++; PROF_END(PF_LOG); } } while (0)
+
+/* Write an event to the trace of worker w, unless tracing is off. */
+#define TRACE(w, ...) do { if ((w)->ftrace) { PROF_BEGIN(); \
+    trace_event((w)->ftrace, (w)->id, __VA_ARGS__); PROF_END(PF_LOG); } } while (0)
+
+/* Read or write a pipe, counting the system call in n and profiling it as
+ * PF_ function pf.
+ */
+#define SYSREAD(n, pf, fd, buf, len) ((n)++, PROF_IO(pf, read(fd, buf, len)))
+#define SYSWRITE(n, pf, fd, buf, len) ((n)++, PROF_IO(pf, write(fd, buf, len)))
 
 char *badgood[] = {"bad ", "good"};
 char *tag[] = {"Data", "Ack ", "Nak "};
+char *kind_name[] = {"Data", "Ack", "Nak"};
+char *event_name[] = {"frame_arrival", "cksum_err", "timeout", "network_layer_ready",
+                      "ack_timeout"};
+char *status_message[] = {"End of simulation", "A deadlock has been detected", "",
+                          "A livelock has been detected"};
+int exit_status[] = {0, 2, 1, 3};	/* of the protocol programs, 1 also for bad parameters */
+
+/* The worker that the calling thread (or process) runs.  The functions that
+ * protocols call act on it, so a protocol never sees the simulation state.
+ */
+static __thread struct dlsim_worker *self;
+
+/* A buffer to present strings to flog_string, one per thread. */
+__thread char logbuf[255];
 
-/* Statistics */
-int data_sent;                  /* number of data frames sent */
-int data_retransmitted;         /* number of data frames retransmitted */
-int data_lost;                  /* number of data frames lost */
-int data_not_lost;              /* number of data frames not lost */
-int good_data_recd;             /* number of data frames received */
-int cksum_data_recd;            /* number of bad data frames received */
-
-int acks_sent;                  /* number of ack frames sent */
-int acks_lost;                  /* number of ack frames lost */
-int acks_not_lost;              /* number of ack frames not lost */
-int good_acks_recd;             /* number of ack frames received */
-int cksum_acks_recd;            /* number of bad ack frames received */
-
-int payloads_accepted;          /* number of pkts passed to network layer */
-int timeouts;                   /* number of timeouts */
-int ack_timeouts;               /* number of ack timeouts */
-
-/* Incoming frames are buffered here for later processing. */
-frame queue[MAX_QUEUE];         /* buffered incoming frames */
-frame *inp = &queue[0];         /* where to put the next frame */
-frame *outp = &queue[0];        /* where to remove the next frame from */
-int nframes=0;  /*JH*/          /* number of queued frames */
-
-bigint tick = 0;		/* the current time, measured in events */
-bigint last_tick;		/* when to stop the simulation */
-int exited[2];			/* set if exited (for each worker) */
-int hanging[2];			/* # times a process has done nothing */
-struct sigaction act, oact;
+/* The simulation of start_simulator(), and of the functions protocols call
+ * before it.
+ */
+static struct dlsim *default_simulation;
 
 /* Logfiles */
 char version[]="1.0";  /*JH*/               /* VERSION */
-time_t curtime;        /*JH*/
-struct tm *loctime;    /*JH*/
-FILE *flog;            /*JH*/
-char logfile[]="logX"; /*JH*/
-/* for different processes x will be replaced by m or 0 or 1 */
+static const bigint zero = 0;
+
+/* The start of a checkpoint file: the settings the state depends on and the
+ * state of main.  The sections of M0 and M1 follow, each a bigint length and
+ * the section.  Everything is in the layout and byte order of the machine,
+ * so a checkpoint can only be restored by the build that wrote it.
+ */
+struct checkpoint_header {
+    char magic[8];		/* CHECKPOINT_MAGIC */
+    unsigned int worker_size;	/* sizeof(struct dlsim_worker) */
+    unsigned int nseqs;
+    int fec_mode, fec_k, fec_m;
+    char traffic_spec[256];
+    bigint tick;
+    bigint hanging[2];
+    unsigned int rng;
+};
 
 
 /* Prototypes. */
 void start_simulator(void (*p1)(), void (*p2)(), long event, int tm_out, int pk_loss, int grb, int d_flags);
-void set_up_pipes(void);
-void fork_off_workers(void);
-void terminate(char *s);
+struct dlsim *default_sim(void);
+void sim_defaults(struct dlsim *s);
+int run_main(struct dlsim *s);
+int run_realtime(struct dlsim *s);
+int main_reply(struct dlsim *s, int process, bigint *word);
+int main_go_ahead(struct dlsim *s, int process);
+int main_flush(struct dlsim *s);
+int main_ring_wait(struct dlsim *s, int n);
+int set_up_pipes(struct dlsim *s);
+void close_pipes(struct dlsim *s);
+void fork_off_workers(struct dlsim *s);
+void *worker_thread(void *arg);
+void init_worker(struct dlsim *s, int id);
+void set_worker(struct dlsim_worker *w);
+void ring_setup(struct dlsim_worker *w);
+void ring_reap(struct dlsim_worker *w);
+int ring_reply(struct dlsim_worker *w, bigint word, bigint *ct);
+void ring_send(wire *r);
+void ring_flush(struct dlsim_worker *w);
+FILE *open_log(struct dlsim *s, char who);
+void open_decisions(struct dlsim *s, struct bitstream *b, char *what, int id);
+void close_decisions(struct dlsim_worker *w);
+void close_trace(struct dlsim_worker *w);
+void trace_step(struct dlsim_worker *w, int event);
+void trace_send(struct dlsim_worker *w, frame *s, unsigned int serial, int lost);
+void trace_timer(struct dlsim_worker *w, int slot, char ph);
+bigint progress(struct dlsim_worker *w);
+void print_batch_means(struct dlsim *s, FILE *f);
+void print_watchdog(struct dlsim *s, FILE *f);
+void worker_exit(int status);
+void terminate(struct dlsim *s, int status);
+int sim_rand(unsigned int *seed);
+int save_checkpoint(struct dlsim *s);
+int read_fully(struct dlsim *s, int fd, void *buf, bigint len);
+void send_checkpoint(bigint reply);
+int load_checkpoint(struct dlsim *s, char *file);
+const unsigned char *checkpoint_section(struct dlsim *s, int id, bigint *len);
+int restore_main(struct dlsim *s);
+void restore_worker(struct dlsim_worker *w);
 
 void init_max_seqnr(unsigned int o);
 unsigned int get_timedout_seqnr(void);
 void wait_for_event(event_type *event);
+int realtime_event(void);
 void init_frame(frame *s);
 void queue_frames(void);
+void fec_queue_frames(void);
+void udp_queue_frames(void);
+void ring_queue_frames(void);
+void fec_receive(wire *w);
+void fec_flush_group(bigint due);
+void fec_send(frame *s, int lost);
+void fec_finish_group(void);
+int fec_idle(void);
+void send_wire(wire *r);
+void enqueue_frame(frame *f, unsigned int serial, bigint due);
+int lose_frame(void);
+void init_traffic(void);
+int packet_ready(void);
 int pick_event(void);
 event_type frametype(void);
 void from_network_layer(packet *p);
@@ -115,6 +179,8 @@ void enable_network_layer(void);
 void disable_network_layer(void);
 int check_timers(void);
 int check_ack_timer(void);
+void checkpoint_variable(void *var, unsigned int size);
+boolean restored_from_checkpoint(void);
 void flog_frame(frame *f, char sr);    /*JH*/
 void flog_string(char *str_out);       /*JH*/
 void print_queue(void);                /*JH*/
@@ -122,28 +188,270 @@ unsigned int pktnum(packet *p);
 void fr(frame *f);
 void recalc_timers(void);
 void print_statistics(void);
+void print_worker_statistics(FILE *f, struct dlsim_worker *w);
+void print_links(struct dlsim *s, FILE *f);
+void print_link_statistics(FILE *f, const struct dlsim_stats *st0, const struct dlsim_stats *st1);
+void read_final_statistics(int fd, struct dlsim_stats *st);
 void sim_error(char *s);
 int parse_first_five_parameters(int argc, char *argv[], long *event, int *timeout_interval, int *pkt_loss, int *garbled, int *debug_flags);
+int parse_simulator_options(int argc, char *argv[]);
 
 void start_simulator(void (*p1)(), void (*p2)(), long event, int tm_out, int pk_loss, int grb, int d_flags)
 {
     /* The simulator has three processes: main(this process), M0, and M1, all of
      * which run independently.  Set them all up first.  Once set up, main
-     * maintains the clock (tick), and picks a process to run.  Then it writes a
-     * 32-bit word to that process to tell it to run.  The process sends back an
+     * maintains the clock (tick), and picks a process to run.  Then it writes the
+     * 64-bit tick to that process to tell it to run.  The process sends back an
      * answer when it is done.  Main then picks another process, and the cycle
      * repeats.
      */
 
+    struct dlsim *s = default_sim();
+    int status;
+
+    setvbuf(stdout, (char *) 0, _IONBF, (size_t) 0);	/* disable buffering*/
+
+    s->proc1 = p1;
+    s->proc2 = p2;
+    dlsim_parameters(s, event, tm_out, pk_loss, grb, d_flags);
+    printf("\n\nEvents: %llu    Parameters: %llu %d %u\n",
+           s->last_tick/DELTA, s->timeout_interval/DELTA, s->pkt_loss/10, s->garbled/10);
+    if (s->fec.mode != FEC_NONE)
+        printf("FEC: %s, %d data + %d parity frames per group\n",
+               (s->fec.mode == FEC_XOR ? "xor" : "rs"), s->fec.k, s->fec.m);
+    if (s->traffic_spec[0] != '\0') printf("Traffic: %s\n", s->traffic_spec);
+    print_links(s, stdout);
+    if (s->event_ns > 0)
+        printf("Transport: UDP over loopback, %g us per event\n", s->event_ns / 1000.0);
+    if (s->restore != NULL && !restore_main(s)) exit(1);
+
+    if (!set_up_pipes(s))	/* create six pipes */
+        sim_error("could not create pipes");
+    s->start_ns = udp_clock();
+    fork_off_workers(s);	/* fork off the worker processes */
+
+    /* Simulation run has finished. */
+    status = run_main(s);
+    bits_close(&s->sched);
+    prof_report(stdout, "main", "main loop");
+    terminate(s, status);
+}
+
+
+int run_main(struct dlsim *s)
+{
+    /* Main simulation loop.  Returns how the simulation ended. */
+
     int process = 0;		/* whose turn is it */
-    int rfd, wfd;			/* file descriptor for talking to workers */
     bigint word;			/* message from worker */
 
-    act.sa_handler = SIG_IGN;
-    setvbuf(stdout, (char *) 0, _IONBF, (size_t) 0);	/* disable buffering*/
+    prof_reset();
+    if (s->event_ns > 0) return(run_realtime(s));
+    if (s->io_uring && !uring_init(&s->ring, 8))
+        printf("No io_uring; the pipes are read and written directly\n");
+    if (s->ci_rel > 0) batch_init(&s->batch, s->ci_rel, s->ci_batch, s->traffic_spec[0] != '\0');
+    s->progress_tick = s->tick;
+    while (s->tick < s->last_tick) {
+        if ((process = bits_get(&s->sched)) < 0) {
+            process = sim_rand(&s->rng) & 1;	/* pick process to run: 0 or 1 */
+            bits_put(&s->sched, process);
+        }
+        s->tick = s->tick + DELTA;
+        if (!main_reply(s, process, &word)) return(DLSIM_ERROR);
+        /**/ LOG(s->flog,"XM01 %llu process=%d word=%llu\n", s->tick/DELTA, process, word);
+        /**/ FLUSH(s->flog, s->syscalls);
+        if (REPLY_CODE(word) == OK) s->hanging[process] = 0;
+        if (REPLY_CODE(word) == NOTHING) s->hanging[process] += DELTA;
+        if (s->hanging[0] >= DEADLOCK(s) && s->hanging[1] >= DEADLOCK(s))
+            return(DLSIM_DEADLOCK);
+
+        /* Watchdog: a livelock keeps the workers busy without delivering. */
+        if (s->watchdog > 0) {
+            if (REPLY_ACCEPTED(word) > 0) {
+                s->progress_tick = s->tick;
+                memset(s->stalled_runs, 0, sizeof(s->stalled_runs));
+                memset(s->stalled_idle, 0, sizeof(s->stalled_idle));
+                memset(s->stalled_sent, 0, sizeof(s->stalled_sent));
+            } else {
+                s->stalled_runs[process]++;
+                if (REPLY_CODE(word) == NOTHING) s->stalled_idle[process]++;
+                s->stalled_sent[process] += REPLY_SENT(word);
+                if (s->tick - s->progress_tick >= s->watchdog) {
+                    s->livelocked = 1;
+                    return(DLSIM_LIVELOCK);
+                }
+            }
+        }
+
+        /* Batch means: stop once the confidence intervals are narrow enough. */
+        if (s->ci_rel > 0) {
+            s->batch.accepted += REPLY_ACCEPTED(word);
+            s->batch.sent += REPLY_SENT(word);
+            s->batch.delays += REPLY_DELAYS(word);
+            s->batch.delay_sum += (double) REPLY_DELAY(word) / DELTA;
+            if (s->tick % (s->ci_batch * DELTA) == 0 && batch_end(&s->batch)) {
+                s->converged = 1;
+                return(DLSIM_END);
+            }
+        }
+
+        /* Write the time to the selected process to tell it to run. */
+        if (!main_go_ahead(s, process)) return(DLSIM_ERROR);
+        /**/ LOG(s->flog,"XM02 %llu process=%d\n", s->tick/DELTA, process);
+        /**/ FLUSH(s->flog, s->syscalls);
+
+        if (s->checkpoint[0] != '\0' && (s->tick == s->last_tick ||
+            (s->checkpoint_every > 0 && s->tick % s->checkpoint_every == 0))) {
+            if (!main_flush(s) || !save_checkpoint(s)) return(DLSIM_ERROR);
+        }
+    }
+    return(main_flush(s) ? DLSIM_END : DLSIM_ERROR);
+}
+
+
+int main_reply(struct dlsim *s, int process, bigint *word)
+{
+    /* Read the reply of process.  With io_uring, the go-ahead queued by
+     * main_go_ahead() goes out in the same system call.
+     */
+
+    int rfd = (process == 0 ? s->r4 : s->r6);
+
+    if (s->ring.fd < 0)
+        return(SYSREAD(s->syscalls, PF_CONTROL_READ, rfd, word, TICK_SIZE) == TICK_SIZE);
+    uring_queue(&s->ring, URING_READ, rfd, &s->ring_reply, TICK_SIZE, -1, 0, RING_REPLY);
+    if (!main_ring_wait(s, 1 + s->ring_pending)) return(0);
+    *word = s->ring_reply;
+    return(1);
+}
+
+
+int main_go_ahead(struct dlsim *s, int process)
+{
+    /* Write the tick to process.  With io_uring, it is only queued. */
+
+    int wfd = (process == 0 ? s->w3 : s->w5);
+
+    if (s->ring.fd >= 0) {
+        s->ring_go_ahead = s->tick;
+        uring_queue(&s->ring, URING_WRITE, wfd, &s->ring_go_ahead, TICK_SIZE, -1, 0, RING_GO_AHEAD);
+        s->ring_pending = 1;
+    } else if (SYSWRITE(s->syscalls, PF_CONTROL_WRITE, wfd, &s->tick, TICK_SIZE) != TICK_SIZE) {
+        printf("Main could not write to worker\n");
+        return(0);
+    }
+    return(1);
+}
+
+
+int main_flush(struct dlsim *s)
+{
+    /* Send a go-ahead that main_go_ahead() only queued. */
+
+    return(s->ring_pending ? main_ring_wait(s, 1) : 1);
+}
+
+
+int main_ring_wait(struct dlsim *s, int n)
+{
+    /* Submit what main queued and wait for n operations to complete. */
+
+    unsigned long long data;
+    int res, ok = 1;
+
+    while (n > 0) {
+        if (!PROF_IO(PF_CONTROL_READ, uring_submit(&s->ring, 1, &s->syscalls))) return(0);
+        while (uring_complete(&s->ring, &data, &res)) {
+            n--;
+            if (res == TICK_SIZE) continue;
+            if (data == RING_GO_AHEAD) printf("Main could not write to worker\n");
+            ok = 0;
+        }
+    }
+    s->ring_pending = 0;
+    return(ok);
+}
+
+
+int run_realtime(struct dlsim *s)
+{
+    /* Main on the UDP transport.  The workers run on the wall clock by
+     * themselves, so main only waits for the end of the run.  A worker
+     * only writes to main when it stops, i.e. on an error.
+     */
+
+    bigint end = s->start_ns + s->last_tick / DELTA * s->event_ns, now;
+    int ready;
+
+    while ((now = udp_clock()) < end) {
+        ready = PROF_IO(PF_CONTROL_READ, udp_wait(s->r4, s->r6, end - now, &s->syscalls));
+        if (ready != 0) return(DLSIM_ERROR);
+    }
+    s->tick = s->last_tick;
+    return(DLSIM_END);
+}
+
+
+struct dlsim *default_sim(void)
+{
+    /* The simulation of start_simulator(), created on first use. */
+
+    if (default_simulation == NULL && (default_simulation = dlsim_new()) == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return(default_simulation);
+}
+
+
+struct dlsim *dlsim_new(void)
+{
+    struct dlsim *s;
+
+    if ((s = malloc(sizeof(*s))) == NULL) return(NULL);
+    sim_defaults(s);
+    return(s);
+}
+
+
+void dlsim_free(struct dlsim *s)
+{
+    int i;
+
+    if (s == NULL) return;
+    for (i = 0; i < 2; i++) {
+        free(s->worker[i].traffic_out.times);
+        free(s->worker[i].traffic_in.times);
+    }
+    free(s->restore);
+    free(s);
+}
+
+
+void sim_defaults(struct dlsim *s)
+{
+    /* The settings of a simulation before any parameter is given. */
+
+    memset(s, 0, sizeof(*s));
+    s->timeout_interval = DELTA;
+    strcpy(s->log_prefix, "log");
+    s->seed = 1;
+    s->rng = s->seed;
+    s->nseqs = NR_TIMERS;
+    s->r1 = s->w1 = s->r2 = s->w2 = s->r3 = s->w3 = -1;
+    s->r4 = s->w4 = s->r5 = s->w5 = s->r6 = s->w6 = -1;
+    s->udp_fd[0] = s->udp_fd[1] = -1;
+    s->ring.fd = -1;
+    s->link[0].loss = s->link[0].garbled = -1;
+    s->link[1].loss = s->link[1].garbled = -1;
+}
+
+
+int dlsim_parameters(struct dlsim *s, long event, int tm_out, int pk_loss, int grb, int d_flags)
+{
+    if (event < 0 || tm_out < 0 || pk_loss < 0 || pk_loss > 99 ||
+        grb < 0 || grb > 99 || d_flags < 0) return(0);
 
-    proc1 = p1;
-    proc2 = p2;
     /* Each event uses DELTA ticks to make it possible for each timeout to
      * occur at a different tick.  For example, with DELTA = 10, ticks will
      * occur at 0, 10, 20, etc.  This makes it possible to schedule multiple
@@ -154,12 +462,12 @@ void start_simulator(void (*p1)(), void (*p2)(), long event, int tm_out, int pk_
      * 1000 events will give 1000 events, but they internally they will be
      * called 0 to 10,000.
      */
-    last_tick = DELTA * event;
+    s->last_tick = DELTA * event;
 
     /* Convert from external units to internal units so the user does not see
      * the internal units at all.
      */
-    timeout_interval = DELTA * tm_out;
+    s->timeout_interval = DELTA * tm_out;
 
     /* Packet loss takes place at the sender.  Packets selected for being lost
      * are not put on the wire at all.  Internally, pkt_loss and garbled are
@@ -169,7 +477,7 @@ void start_simulator(void (*p1)(), void (*p2)(), long event, int tm_out, int pk_
      * be lost is 990/1024.
      */
 
-    pkt_loss = 10 * pk_loss; /* for our purposes, 1000 == 1024 */
+    s->pkt_loss = 10 * pk_loss; /* for our purposes, 1000 == 1024 */
 
     /* This arg tells what fraction of arriving packets are garbled.  Thus if
      * pkt_loss is 50 and garbled is 50, half of all packets (actually,
@@ -177,187 +485,542 @@ void start_simulator(void (*p1)(), void (*p2)(), long event, int tm_out, int pk_
      * are sent, 500/1024 will arrive garbled.
      */
 
-    garbled = 10 * grb; /* for our purposes, 1000 == 1024 */
+    s->garbled = 10 * grb; /* for our purposes, 1000 == 1024 */
+
+    /* Turn tracing options on or off.  The bits are defined above. */
+    s->debug_flags = d_flags;
+    return(1);
+}
 
-    /* Turn tracing options on or off.  The bits are defined in worker.c. */
-    debug_flags = d_flags;
-    printf("\n\nEvents: %lu    Parameters: %lu %d %u\n",
-           last_tick/DELTA, timeout_interval/DELTA, pkt_loss/10, garbled/10);
 
-    set_up_pipes();		/* create five pipes */
-    fork_off_workers();		/* fork off the worker processes */
+void dlsim_protocol(struct dlsim *s, void (*p1)(void), void (*p2)(void), unsigned int nseqs)
+{
+    s->proc1 = p1;
+    s->proc2 = p2;
+    if (nseqs > 0) s->nseqs = nseqs;
+}
 
-    /* Main simulation loop. */
-    while (tick <last_tick) {
-        process = rand() & 1;		/* pick process to run: 0 or 1 */
-        tick = tick + DELTA;
-        rfd = (process == 0 ? r4 : r6);
-        if (read(rfd, &word, TICK_SIZE) != TICK_SIZE) terminate("");
-        /**/ fprintf(flog,"XM01 %lu process=%d word=%lu\n", tick/DELTA, process, word);
-        /**/ fflush(NULL);
-        if (word == OK) hanging[process] = 0;
-        if (word == NOTHING) hanging[process] += DELTA;
-        if (hanging[0] >= DEADLOCK && hanging[1] >= DEADLOCK)
-            terminate("A deadlock has been detected");
 
-        /* Write the time to the selected process to tell it to run. */
-        wfd = (process == 0 ? w3 : w5);
-        if (write(wfd, &tick, TICK_SIZE) != TICK_SIZE)
-            terminate("Main could not write to worker");
-        /**/ fprintf(flog,"XM02 %lu process=%d\n", tick/DELTA, process);
-        /**/ fflush(NULL);
+void dlsim_event_map(struct dlsim *s, const int *map)
+{
+    s->event_map = map;
+}
+
+
+int dlsim_run(struct dlsim *s)
+{
+    /* Run a simulation with M0 and M1 as threads of this process.  Main runs
+     * in the calling thread and drives them through the same pipes as in
+     * the forked simulator.
+     */
 
+    int status, i;
+
+    if (s->restore != NULL && !restore_main(s)) return(DLSIM_ERROR);
+    if (!set_up_pipes(s)) return(DLSIM_ERROR);
+    s->threaded = 1;
+    s->start_ns = udp_clock();
+    s->flog = open_log(s, 'M');
+    open_decisions(s, &s->sched, "sched", -1);
+    for (i = 0; i < 2; i++) init_worker(s, i);
+    for (i = 0; i < 2; i++) {
+        if (pthread_create(&s->thread[i], NULL, worker_thread, &s->worker[i]) != 0) {
+            printf("could not start worker thread\n");
+            if (i == 1) {	/* a zero go-ahead stops M0 */
+                write(s->w3, &zero, TICK_SIZE);
+                pthread_join(s->thread[0], NULL);
+            }
+            close_pipes(s);
+            return(DLSIM_ERROR);
+        }
     }
 
-    /* Simulation run has finished. */
-    terminate("End of simulation");
+    status = run_main(s);
+    uring_exit(&s->ring);
+    bits_close(&s->sched);
+    prof_report(stdout, "main", "main loop");
+
+    /* A zero go-ahead tells each worker to stop. */
+    write(s->w3, &zero, TICK_SIZE);
+    write(s->w5, &zero, TICK_SIZE);
+    for (i = 0; i < 2; i++) {
+        pthread_join(s->thread[i], NULL);
+        if (s->worker[i].status != 0) status = DLSIM_ERROR;
+    }
+    close_pipes(s);
+    if (s->flog != NULL) {
+        s->log_bytes = ftell(s->flog);
+        fclose(s->flog);
+    }
+    s->flog = NULL;
+    return(status);
 }
 
 
-void set_up_pipes(void)
+void *worker_thread(void *arg)
 {
-    /* Create six pipes so main, M0 and M1 can communicate pairwise. */
+    /* Body of a worker thread.  The protocol only returns through
+     * worker_exit().
+     */
+
+    self = arg;
+    prof_reset();
+    if (self->id == 0) (*self->sim->proc1)();
+    else (*self->sim->proc2)();
+    worker_exit(0);
+    return(NULL);
+}
 
-    int fd[2];
 
-    pipe(fd);  r1 = fd[0];  w1 = fd[1];	/* M0 to M1 for frames */
-    pipe(fd);  r2 = fd[0];  w2 = fd[1];	/* M1 to M0 for frames */
-    pipe(fd);  r3 = fd[0];  w3 = fd[1];	/* main to M0 for go-ahead */
-    pipe(fd);  r4 = fd[0];  w4 = fd[1];	/* M0 to main to signal readiness */
-    pipe(fd);  r5 = fd[0];  w5 = fd[1];	/* main to M1 for go-ahead */
-    pipe(fd);  r6 = fd[0];  w6 = fd[1];	/* M1 to main to signal readiness */
+const struct dlsim_stats *dlsim_statistics(struct dlsim *s, int id)
+{
+    return(&s->worker[id & 1].stats);
 }
 
-void fork_off_workers(void)
+
+void dlsim_cost(struct dlsim *s, dlsim_count *syscalls, dlsim_count *log_bytes)
+{
+    *syscalls = s->syscalls + s->worker[0].stats.syscalls + s->worker[1].stats.syscalls;
+    *log_bytes = s->log_bytes + s->worker[0].stats.log_bytes + s->worker[1].stats.log_bytes;
+}
+
+
+void dlsim_print_statistics(struct dlsim *s, FILE *f)
+{
+    dlsim_count acc, sent;
+
+    if (s->worker[0].sim == NULL) return;	/* the run never started */
+    print_worker_statistics(f, &s->worker[0]);
+    print_worker_statistics(f, &s->worker[1]);
+    print_links(s, f);
+    print_link_statistics(f, &s->worker[0].stats, &s->worker[1].stats);
+    if (s->ci_rel > 0) print_batch_means(s, f);
+    if (s->livelocked) print_watchdog(s, f);
+    acc = s->worker[0].stats.payloads_accepted + s->worker[1].stats.payloads_accepted;
+    sent = s->worker[0].stats.data_sent + s->worker[1].stats.data_sent;
+    if (sent > 0)
+        fprintf(f, "\nEfficiency (payloads accepted/data pkts sent) = %llu%c\n", (100 * acc)/sent, '%');
+}
+
+
+long dlsim_batch_means(struct dlsim *s, int metric, double *mean, double *halfwidth, int *converged)
+{
+    if (s->ci_rel <= 0 || metric < 0 || metric >= s->batch.nmetrics) return(0);
+    *mean = s->batch.mean[metric];
+    *halfwidth = batch_halfwidth(&s->batch, metric);
+    *converged = s->converged;
+    return(s->batch.n);
+}
+
+
+void print_batch_means(struct dlsim *s, FILE *f)
+{
+    batch_print(&s->batch, f);
+    if (s->converged)
+        fprintf(f, "The intervals were within %g%% of the means after %llu events.\n",
+                100 * s->ci_rel, s->tick/DELTA);
+    else
+        fprintf(f, "The intervals did not get within %g%% of the means.\n", 100 * s->ci_rel);
+}
+
+
+void print_watchdog(struct dlsim *s, FILE *f)
+{
+    /* What main saw since the last accepted payload and, when the workers
+     * are threads whose state main can see, where the workers are stuck.
+     */
+
+    struct dlsim_worker *w;
+    int i, j, timers;
+
+    fprintf(f, "\nNo payload was accepted in the %llu events since event %llu.\n",
+            (s->tick - s->progress_tick)/DELTA, s->progress_tick/DELTA);
+    for (i = 0; i < 2; i++)
+        fprintf(f, "M%d ran %llu times, did nothing %llu times and sent %llu data frames.\n",
+                i, s->stalled_runs[i], s->stalled_idle[i], s->stalled_sent[i]);
+    if (!s->threaded) return;
+    for (i = 0; i < 2; i++) {
+        w = &s->worker[i];
+        for (timers = 0, j = 0; j < NR_TIMERS; j++)
+            if (w->ack_timer[j] != NO_TIMER) timers++;
+        fprintf(f, "M%d: network layer %s, next packet %u, last delivered %u, %d timers "
+                "running, ack timer %s, %d frames queued\n", i,
+                w->network_layer_status ? "enabled" : "disabled", w->next_net_pkt,
+                w->last_pkt_given, timers, w->aux_timer != NO_TIMER ? "running" : "off",
+                w->nframes);
+    }
+}
+
+
+int set_up_pipes(struct dlsim *s)
+{
+    /* Create six pipes so main, M0 and M1 can communicate pairwise, and
+     * the sockets of the UDP transport if it is used.
+     */
+
+    int fd[12], i;
+
+    for (i = 0; i < 12; i += 2) {
+        if (pipe(&fd[i]) < 0) {
+            while (--i >= 0) close(fd[i]);
+            return(0);
+        }
+    }
+    s->r1 = fd[0];  s->w1 = fd[1];	/* M0 to M1 for frames */
+    s->r2 = fd[2];  s->w2 = fd[3];	/* M1 to M0 for frames */
+    s->r3 = fd[4];  s->w3 = fd[5];	/* main to M0 for go-ahead */
+    s->r4 = fd[6];  s->w4 = fd[7];	/* M0 to main to signal readiness */
+    s->r5 = fd[8];  s->w5 = fd[9];	/* main to M1 for go-ahead */
+    s->r6 = fd[10]; s->w6 = fd[11];	/* M1 to main to signal readiness */
+    if (s->event_ns > 0 && !udp_pair(s->udp_fd)) {
+        for (i = 0; i < 12; i++) close(fd[i]);
+        return(0);
+    }
+    return(1);
+}
+
+
+void close_pipes(struct dlsim *s)
+{
+    /* Close what is left open of the six pipes and the sockets.  A worker
+     * thread that has stopped already closed the ends it writes to.
+     */
+
+    int *fd[12], i;
+
+    fd[0] = &s->r1; fd[1] = &s->w1; fd[2] = &s->r2;  fd[3] = &s->w2;
+    fd[4] = &s->r3; fd[5] = &s->w3; fd[6] = &s->r4;  fd[7] = &s->w4;
+    fd[8] = &s->r5; fd[9] = &s->w5; fd[10] = &s->r6; fd[11] = &s->w6;
+    for (i = 0; i < 12; i++) {
+        if (*fd[i] >= 0) close(*fd[i]);
+        *fd[i] = -1;
+    }
+    for (i = 0; i < 2; i++) {
+        if (s->udp_fd[i] >= 0) close(s->udp_fd[i]);
+        s->udp_fd[i] = -1;
+    }
+}
+
+
+void fork_off_workers(struct dlsim *s)
 {
     /* Fork off the two workers, M0 and M1. */
-    curtime=time(NULL);
-    loctime=localtime(&curtime);
+    struct sigaction act, oact;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_IGN;
     if (fork() != 0) {
         /* This is the Parent.  It will become main, but first fork off M1. */
         if (fork() != 0) {
             /* This is main. */
             sigaction(SIGPIPE, &act, &oact);
             setvbuf(stdout, (char *)0, _IONBF, (size_t)0);/*don't buffer*/
-            close(r1);
-            close(w1);
-            close(r2);
-            close(w2);
-            close(r3);
-            close(w4);
-            close(r5);
-            close(w6);
+            close(s->r1);
+            close(s->w1);
+            close(s->r2);
+            close(s->w2);
+            close(s->r3);
+            close(s->w4);
+            close(s->r5);
+            close(s->w6);
+            close(s->udp_fd[0]);
+            close(s->udp_fd[1]);
             /* now open the log file */
-            logfile[3]='M';
-            if ((flog=fopen(logfile,"w"))==NULL)
-                sim_error("error in opening file logm");
-            fprintf(flog,"XXX0 version:%s, logfile: %s, %s\n",
-                    version, logfile, asctime(loctime));
+            s->flog = open_log(s, 'M');
+            open_decisions(s, &s->sched, "sched", -1);
             return;
         } else {
             /* This is the code for M1. Run protocol. */
             sigaction(SIGPIPE, &act, &oact);
             setvbuf(stdout, (char *)0, _IONBF, (size_t)0);/*don't buffer*/
-            close(w1);
-            close(r2);
-            close(r3);
-            close(w3);
-            close(r4);
-            close(w4);
-            close(w5);
-            close(r6);
-            if (fcntl(r1,F_SETFL,O_NONBLOCK+O_ASYNC)<0) /*JH*/
-                sim_error("pipe initialization failed for M1");
-            id = 1;		/* M1 gets id 1 */
-            mrfd = r5;	/* fd for reading time from main */
-            mwfd = w6;	/* fd for writing reply to main */
-            prfd = r1;	/* fd for reading frames from worker 0 */
-            /* open the logfile for p1 */
-            logfile[3]='1';
-            if ((flog=fopen(logfile,"w"))==NULL)
-                sim_error("error in opening file log1");
-            fprintf(flog,"XXX0 version:%s, logfile: %s, %s\n",
-                    version, logfile, asctime(loctime));
-            (*proc2)();	/* call the user-defined protocol function */
+            close(s->w1);
+            close(s->r2);
+            close(s->r3);
+            close(s->w3);
+            close(s->r4);
+            close(s->w4);
+            close(s->w5);
+            close(s->r6);
+            close(s->udp_fd[0]);
+            init_worker(s, 1);	/* M1 gets id 1 */
+            self = &s->worker[1];
+            prof_reset();
+            (*s->proc2)();	/* call the user-defined protocol function */
             return;
         }
     } else {
         /* This is the code for M0. Run protocol. */
         sigaction(SIGPIPE, &act, &oact);
         setvbuf(stdout, (char *)0, _IONBF, (size_t)0);/*don't buffer*/
-        close(r1);
-        close(w2);
-        close(w3);
-        close(r4);
-        close(r5);
-        close(w5);
-        close(r6);
-        close(w6); /*jh */
-
-        if (fcntl(r2,F_SETFL,O_NONBLOCK+O_ASYNC)<0) /*JH*/
-            sim_error("pipe initialization failed for M1");
-
-        id = 0;		/* M0 gets id 0 */
-        mrfd = r3;	/* fd for reading time from main */
-        mwfd = w4;	/* fd for writing reply to main */
-        prfd = r2;	/* fd for reading frames from worker 1 */
-        /* open the logfile for process p0 */
-        logfile[3]='0';
-        if ((flog=fopen(logfile,"w"))==NULL)
-            sim_error("error in opening file log1");
-
-        fprintf(flog,"XXX0 version:%s, logfile: %s, %s\n",
-                version, logfile, asctime(loctime));
-        (*proc1)();	/* call the user-defined protocol function */
+        close(s->r1);
+        close(s->w2);
+        close(s->w3);
+        close(s->r4);
+        close(s->r5);
+        close(s->w5);
+        close(s->r6);
+        close(s->w6); /*jh */
+        close(s->udp_fd[1]);
+        init_worker(s, 0);	/* M0 gets id 0 */
+        self = &s->worker[0];
+        prof_reset();
+        (*s->proc1)();	/* call the user-defined protocol function */
         return;
     }
 }
 
-void terminate(char *s)
+
+void init_worker(struct dlsim *s, int id)
 {
-    /* End the simulation run by sending each worker a 32-bit zero command. */
+    /* Set up worker id: its pipes, its state, its log file and its traffic
+     * generators.
+     */
 
-    int n, k1, k2, res1[MANY], res2[MANY], eff, acc, sent;
+    struct dlsim_worker *w = &s->worker[id], *caller = self;
+
+    memset(w, 0, sizeof(*w));
+    w->sim = s;
+    w->id = id;
+    w->mrfd = (id == 0 ? s->r3 : s->r5);	/* fd for reading time from main */
+    w->mwfd = (id == 0 ? s->w4 : s->w6);	/* fd for writing reply to main */
+    w->prfd = (id == 0 ? s->r2 : s->r1);	/* fd for reading frames from the peer */
+    w->pwfd = (id == 0 ? s->w1 : s->w2);	/* fd for writing frames to the peer */
+    w->nseqs = w->oldest_frame = s->nseqs;
+    w->fec_rx_size = s->fec.k;
+    w->last_pkt_given = 0xFFFFFFFF;
+    w->inp = w->outp = &w->queue[0];
+    w->rng = s->seed * 2654435761U + id + 1;
+    w->reply = OK;
+    w->ring.fd = -1;
+
+    self = w;
+    if (s->event_ns > 0) {
+        /* Frames go both ways through our own socket. */
+        w->prfd = w->pwfd = s->udp_fd[id];
+        if (!udp_init(&w->udp, w->prfd, WIRE_SIZE)) sim_error("frames too large for UDP");
+    } else if (s->io_uring) {
+        ring_setup(w);	/* io_uring waits for frames, so the pipe must block */
+    }
+    if (w->ring.fd < 0 && s->event_ns == 0 && fcntl(w->prfd,F_SETFL,O_NONBLOCK+O_ASYNC)<0) /*JH*/
+        sim_error("pipe initialization failed");
+    w->flog = open_log(s, id == 0 ? '0' : '1');
+    if (s->trace_prefix[0] != '\0' && (w->ftrace = trace_open(s->trace_prefix, id)) == NULL)
+        printf("Cannot open the trace %s%d.json\n", s->trace_prefix, id);
+    open_decisions(s, &w->lost, "lost", id);
+    open_decisions(s, &w->garbled, "garbled", id);
+    init_traffic();
+    if (s->restore != NULL) restore_worker(w);
+    self = caller;
+}
 
-    for (n = 0; n < MANY; n++) {res1[n] = 0; res2[n] = 0;}
-    write(w3, &zero, TICK_SIZE);
-    write(w5, &zero, TICK_SIZE);
-    sleep(4);
 
-    /* Clean out the pipe.  The zero word indicates start of statistics. */
-    n = read(r4, res1, MANY*sizeof(int));
-    k1 = 0;
-    while (res1[k1] != 0) k1++;
-    k1++;				/* res1[k1] = accepted, res1[k1+1] = sent */
-
-    /* Clean out the other pipe and look for statistics. */
-    n = read(r6, res2, MANY*sizeof(int));
-    k2 = 0;
-    while (res1[k2] != 0) k2++;
-    k2++;				/* res1[k2] = accepted, res1[k2+1] = sent */
-
-    if (strlen(s) > 0) {
-        acc = res1[k1] + res2[k2];
-        sent = res1[k1+1] + res2[k2+1];
-        if (sent > 0) {
-            eff = (100 * acc)/sent;
-            printf("\nEfficiency (payloads accepted/data pkts sent) = %d%c\n", eff, '%');
-        }
-        printf("%s.  Time=%lu\n",s, tick/DELTA);
+void set_worker(struct dlsim_worker *w)
+{
+    /* Act on worker w in the calling thread, as its worker thread does. */
+
+    self = w;
+}
+
+
+void ring_setup(struct dlsim_worker *w)
+{
+    /* Set up the io_uring of worker w, and register the buffers frames are
+     * read into and written from.  Without io_uring, w->ring.fd stays -1.
+     */
+
+    struct iovec iov[3];
+
+    if (!uring_init(&w->ring, 2 * RING_TX)) return;
+    iov[0].iov_base = w->queue;
+    iov[0].iov_len = sizeof(w->queue);
+    iov[1].iov_base = w->fec_in;
+    iov[1].iov_len = sizeof(w->fec_in);
+    iov[2].iov_base = w->ring_tx;
+    iov[2].iov_len = sizeof(w->ring_tx);
+    w->ring_fixed = uring_register(&w->ring, iov, 3);
+}
+
+
+FILE *open_log(struct dlsim *s, char who)
+{
+    /* Open the log file of main ('M'), M0 ('0') or M1 ('1'): the log prefix
+     * followed by who.  Returns NULL if logging is off.
+     */
+
+    char logfile[sizeof(s->log_prefix) + 1];
+    char date[32];
+    time_t curtime;
+    struct tm loctime;
+    FILE *f;
+
+    if (s->log_prefix[0] == '\0' || s->replay[0] != '\0') return(NULL);
+    sprintf(logfile, "%s%c", s->log_prefix, who);
+    if ((f = fopen(logfile, "w")) == NULL) {
+        printf("error in opening file %s\n", logfile);
+        return(NULL);
     }
-    exit(1);
+    curtime = time(NULL);
+    localtime_r(&curtime, &loctime);
+    asctime_r(&loctime, date);
+    fprintf(f,"XXX0 version:%s, logfile: %s, %s\n", version, logfile, date);
+    return(f);
+}
+
+
+void open_decisions(struct dlsim *s, struct bitstream *b, char *what, int id)
+{
+    /* Open the stream of decisions what of main (id -1) or worker id, if
+     * decisions are recorded or replayed.  See record.h.
+     */
+
+    char file[sizeof(s->record) + 16];
+    int mode = (s->replay[0] != '\0' ? BITS_REPLAY : BITS_RECORD);
+
+    memset(b, 0, sizeof(*b));
+    if (s->replay[0] == '\0' && s->record[0] == '\0') return;
+    sprintf(file, "%s.%s", mode == BITS_REPLAY ? s->replay : s->record, what);
+    if (id >= 0) sprintf(file + strlen(file), "%d", id);
+    if (!bits_open(b, mode, file))
+        printf("Cannot open %s; decisions are drawn at random\n", file);
+}
+
+
+void close_decisions(struct dlsim_worker *w)
+{
+    bits_close(&w->lost);
+    bits_close(&w->garbled);
+}
+
+
+void close_trace(struct dlsim_worker *w)
+{
+    if (w->ftrace != NULL) trace_close(w->ftrace, w->id);
+    w->ftrace = NULL;
+}
+
+
+void worker_exit(int status)
+{
+    /* The worker is done.  A worker process just exits.  A worker thread
+     * closes the pipe ends it writes to, so that main and the peer see end
+     * of file instead of waiting for it, and then ends the thread.
+     */
+
+    struct dlsim_worker *w = self;
+
+    close_decisions(w);
+    close_trace(w);
+    if (!w->sim->threaded) exit(status);
+    uring_exit(&w->ring);
+    prof_report(stdout, w->id == 0 ? "process 0" : "process 1", "protocol");
+    w->status = status;
+    close(w->mwfd);
+    close(w->pwfd);
+    if (w->id == 0) w->sim->w4 = w->sim->w1 = -1;
+    else w->sim->w6 = w->sim->w2 = -1;
+    w->sim->udp_fd[w->id] = -1;	/* pwfd if it was the socket */
+    if (w->flog != NULL) {
+        w->stats.log_bytes = ftell(w->flog);
+        fclose(w->flog);
+    }
+    w->flog = NULL;
+    pthread_exit(NULL);
+}
+
+
+void terminate(struct dlsim *s, int status)
+{
+    /* End the simulation run by sending each worker a zero command, and
+     * exit with the status that goes with how the run ended.
+     */
+
+    char *msg = status_message[status];
+    struct dlsim_stats st[2];
+    bigint acc, sent;
+
+    write(s->w3, &zero, TICK_SIZE);
+    write(s->w5, &zero, TICK_SIZE);
+    sleep(4);
+    read_final_statistics(s->r4, &st[0]);
+    read_final_statistics(s->r6, &st[1]);
+
+    if (strlen(msg) > 0) {
+        print_link_statistics(stdout, &st[0], &st[1]);
+        if (s->ci_rel > 0) print_batch_means(s, stdout);
+        if (s->livelocked) print_watchdog(s, stdout);
+        acc = st[0].payloads_accepted + st[1].payloads_accepted;
+        sent = st[0].data_sent + st[1].data_sent;
+        if (sent > 0)
+            printf("\nEfficiency (payloads accepted/data pkts sent) = %llu%c\n", (100 * acc)/sent, '%');
+        printf("%s.  Time=%llu\n",msg, s->tick/DELTA);
+    }
+    exit(exit_status[status]);
+}
+
+
+void read_final_statistics(int fd, struct dlsim_stats *st)
+{
+    /* Clean out the pipe from a worker process and take the statistics it
+     * sent when it ended.  The zero word indicates their start.  Replies
+     * are TICK_SIZE words, and a reply is never zero.
+     */
+
+    bigint res[MANY];
+    int n, k;
+
+    memset(st, 0, sizeof(*st));
+    n = read(fd, res, sizeof(res));
+    n = (n > 0 ? n / TICK_SIZE : 0);
+    for (k = 0; k < n && res[k] != 0; k++) ;
+    if (k + 1 + (int) (sizeof(*st) / TICK_SIZE) <= n) memcpy(st, &res[k + 1], sizeof(*st));
+}
+
+
+int sim_rand(unsigned int *seed)
+{
+    /* The rand() of the C standard, with its state kept by the caller, so
+     * that simulations and workers each have their own generator.
+     */
+
+    *seed = *seed * 1103515245 + 12345;
+    return((*seed / 65536) % 32768);
 }
 
 void init_max_seqnr(unsigned int o)
 {
-    nseqs = oldest_frame = o;
+    default_sim()->nseqs = o;
 }
 
 unsigned int get_timedout_seqnr(void)
 {
-    return(oldest_frame);
+    return(self->oldest_frame);
+}
+
+bigint progress(struct dlsim_worker *w)
+{
+    /* What worker w did since its previous reply, in the fields of a reply
+     * word.  A field that would overflow is told in full in later replies.
+     */
+
+    struct dlsim_stats *st = &w->stats;
+    bigint acc, sent, delays, delay;
+
+    acc = st->payloads_accepted - w->told_accepted;
+    sent = st->data_sent - w->told_sent;
+    delays = st->delays - w->told_delays;
+    delay = st->delay_sum - w->told_delay_sum;
+    if (acc > 0xFFF) acc = 0xFFF;
+    if (sent > 0xFFF) sent = 0xFFF;
+    if (delays > 0xFF) delays = 0xFF;
+    if (delay > 0xFFFFFF) delay = 0xFFFFFF;
+    w->told_accepted += acc;
+    w->told_sent += sent;
+    w->told_delays += delays;
+    w->told_delay_sum += delay;
+    return((acc << 8) | (sent << 20) | (delays << 32) | (delay << 40));
 }
 
+
 void wait_for_event(event_type *event)
 {
     /* Wait_for_event reads the pipe from main to get the time.  Then it
@@ -366,45 +1029,155 @@ void wait_for_event(event_type *event)
      * Once the pipe is empty, it makes a decision about what to do next.
      */
 
-    bigint ct, word = OK;
+    struct dlsim_worker *w = self;
+    bigint ct, word = w->reply;
+    PROF_BEGIN();
 
-    offset = 0;			/* prevents two timeouts at the same tick */
-    retransmitting = 0;		/* counts retransmissions */
-    while (true) {
+    w->reply = OK;
+    w->retransmitting = 0;	/* counts retransmissions */
+    if (w->sim->event_ns > 0) *event = realtime_event();	/* UDP transport */
+    else w->offset = 0;		/* prevents two timeouts at the same tick */
+    while (w->sim->event_ns == 0) {
         queue_frames();		/* go get any newly arrived frames */
-        if (write(mwfd, &word, TICK_SIZE) != TICK_SIZE)
-            print_statistics();
+        if (w->sim->ci_rel > 0 || w->sim->watchdog > 0) word |= progress(w);
 
-        /**/ fprintf(flog,"XWF1 %lu word=%lu\n", tick/DELTA, word);
-        /**/ fflush(NULL);
+        /**/ LOG(w->flog,"XWF1 %llu word=%llu\n", w->tick/DELTA, word);
+        /**/ FLUSH(w->flog, w->stats.syscalls);
 
-        if (read(mrfd, &ct, TICK_SIZE) != TICK_SIZE) print_statistics();
+        if (w->ring.fd >= 0) {
+            if (!ring_reply(w, word, &ct)) print_statistics();
+        } else {
+            if (SYSWRITE(w->stats.syscalls, PF_CONTROL_WRITE, w->mwfd, &word, TICK_SIZE) != TICK_SIZE)
+                print_statistics();
+            if (SYSREAD(w->stats.syscalls, PF_CONTROL_READ, w->mrfd, &ct, TICK_SIZE) != TICK_SIZE)
+                print_statistics();
+        }
         if (ct == 0) print_statistics();
-        tick = ct;		/* update time */
-        if ((debug_flags & PERIODIC) && (tick%INTERVAL == 0))
-            printf("Tick %lu. Proc %d. Data sent=%d  Payloads accepted=%d  Timeouts=%d\n", tick/DELTA, id, data_sent, payloads_accepted, timeouts);
+        if (ct == CHECKPOINT) {
+            send_checkpoint(word);	/* and then the reply again */
+            continue;
+        }
+        w->tick = ct;		/* update time */
+        if ((w->sim->debug_flags & PERIODIC) && (w->tick%INTERVAL == 0))
+            printf("Tick %llu. Proc %d. Data sent=%llu  Payloads accepted=%llu  Timeouts=%llu\n", w->tick/DELTA, w->id, w->stats.data_sent, w->stats.payloads_accepted, w->stats.timeouts);
 
         /* Now pick event. */
         *event = pick_event();
-        if (*event == no_event) {
-            word = (lowest_timer == 0 ? NOTHING : OK);
+        if (*event != no_event) break;
+        fec_idle();
+
+        /* A packet still to come from the network layer is not idleness. */
+        word = (w->lowest_timer == NO_TIMER && w->nframes == 0 && (w->traffic_ended || !w->network_layer_status) ? NOTHING : OK);
+    }
+
+    if (*event == timeout) {
+        fec_idle();
+        w->stats.timeouts++;
+        w->retransmitting = 1;	/* enter retransmission mode */
+        LOG(w->flog,"XXX1%6llu T%2d timeout for frame %d\n",w->tick/DELTA, w->id, w->oldest_frame);
+        if (w->sim->debug_flags & TIMEOUTS)
+            printf("Tick %llu. Proc %d got timeout for frame %d\n",w->tick/DELTA, w->id, w->oldest_frame);
+    }
+
+    if (*event == ack_timeout) {
+        w->stats.ack_timeouts++;
+        if (w->sim->debug_flags & TIMEOUTS)
+            printf("Tick %llu. Proc %d got ack timeout\n",w->tick/DELTA, w->id);
+    }
+    if (w->ftrace != NULL) trace_step(w, *event);
+    if (w->sim->event_map != NULL) {
+        /* Hand the event over in the protocol's own numbering. */
+        if (w->sim->event_map[*event] < 0) sim_error("protocol cannot handle event");
+        *event = w->sim->event_map[*event];
+    }
+    PROF_END(PF_WAIT_FOR_EVENT);
+}
+
+
+int ring_reply(struct dlsim_worker *w, bigint word, bigint *ct)
+{
+    /* Write the reply to main and read the next go-ahead with one system
+     * call.  The frames written during the event are linked ahead of the
+     * reply, so they are in the pipe before main sees it.  Returns 0 if
+     * main or the peer is gone.
+     */
+
+    w->ring_reply = word;
+    if (!uring_queue(&w->ring, URING_WRITE, w->mwfd, &w->ring_reply, TICK_SIZE, -1, 0, RING_REPLY) ||
+        !uring_queue(&w->ring, URING_READ, w->mrfd, &w->ring_go_ahead, TICK_SIZE, -1, 0, RING_GO_AHEAD))
+        sim_error("io_uring full");
+    w->ring_busy += 2;
+    while (w->ring_busy > 0) {
+        if (!PROF_IO(PF_CONTROL_READ, uring_submit(&w->ring, 1, &w->stats.syscalls))) return(0);
+        ring_reap(w);
+    }
+    w->ring_ntx = 0;
+    *ct = w->ring_go_ahead;
+    return(!w->ring_failed);
+}
+
+
+void ring_reap(struct dlsim_worker *w)
+{
+    /* Take the completions of the ring.  The frames read are only queued
+     * by ring_queue_frames(), when read() would have read them.
+     */
+
+    unsigned long long data;
+    int res;
+
+    while (uring_complete(&w->ring, &data, &res)) {
+        if (data == RING_FRAMES_IN) {
+            w->rx_state = RX_DONE;
+            w->rx_res = res;
             continue;
         }
-        word = OK;
-        if (*event == timeout) {
-            timeouts++;
-            retransmitting = 1;	/* enter retransmission mode */
-            fprintf(flog,"XXX1%6lu T%2d timeout for frame %d\n",tick/DELTA, id, oldest_frame);
-            if (debug_flags & TIMEOUTS)
-                printf("Tick %lu. Proc %d got timeout for frame %d\n",tick/DELTA, id, oldest_frame);
-        }
+        w->ring_busy--;
+        if (res != (data == RING_FRAME_OUT ? WIRE_SIZE : TICK_SIZE)) w->ring_failed = 1;
+    }
+}
+
+
+int realtime_event(void)
+{
+    /* Wait_for_event() on the UDP transport, where the tick follows the
+     * wall clock instead of main.  The records queued for the peer are sent
+     * first.  Then, as long as no event is possible, the worker sleeps
+     * until a frame arrives, its next timer or packet is due, or main tells
+     * it to stop.
+     */
+
+    struct dlsim_worker *w = self;
+    bigint now, next, ct;
+    int event, ready;
 
-        if (*event == ack_timeout) {
-            ack_timeouts++;
-            if (debug_flags & TIMEOUTS)
-                printf("Tick %lu. Proc %d got ack timeout\n",tick/DELTA, id);
+    while (true) {
+        if (!PROF_IO(PF_FRAME_WRITE, udp_flush(&w->udp, &w->stats.syscalls))) print_statistics();
+        queue_frames();
+        now = DELTA * (udp_clock() - w->sim->start_ns) / w->sim->event_ns;
+        if (now > w->tick) {
+            w->tick = now;
+            w->offset = 0;	/* prevents two timeouts at the same tick */
+        }
+        if ((event = pick_event()) != no_event) return(event);
+        if (fec_idle()) continue;	/* send the parity first */
+
+        next = w->lowest_timer;
+        if (w->fec_tx_n > 0 && (next == NO_TIMER || w->fec_tx_last + FEC_HOLDOFF * DELTA < next))
+            next = w->fec_tx_last + FEC_HOLDOFF * DELTA;
+        if (w->aux_timer != NO_TIMER && (next == NO_TIMER || w->aux_timer < next))
+            next = w->aux_timer;
+        if (w->network_layer_status && w->traffic_out.mode != TRAFFIC_SATURATED &&
+            !w->traffic_ended && (next == NO_TIMER || w->next_arrival < next))
+            next = w->next_arrival;
+        ready = PROF_IO(PF_CONTROL_READ, udp_wait(w->prfd, w->mrfd, next == NO_TIMER ? -1 :
+                        (long long) ((next - w->tick) * w->sim->event_ns / DELTA),
+                        &w->stats.syscalls));
+        if (ready < 0) sim_error("error in waiting for frames");
+        if (ready & UDP_CONTROL) {	/* main only ever says stop */
+            if (SYSREAD(w->stats.syscalls, PF_CONTROL_READ, w->mrfd, &ct, TICK_SIZE) != TICK_SIZE ||
+                ct == 0) print_statistics();
         }
-        return;
     }
 }
 
@@ -417,7 +1190,7 @@ void init_frame(frame *s)
 
     s->seq = 0;
     s->ack = 0;
-    s->kind = (id == 0 ? data : ack);
+    s->kind = (self->id == 0 ? data : ack);
     s->info.data[0] = 0;
     s->info.data[1] = 0;
     s->info.data[2] = 0;
@@ -433,43 +1206,270 @@ void queue_frames(void)
      * at queue[0].  This is done in two read operations.
      */
 
-    int prfd, frct, k;
-    frame *top;
+    struct dlsim_worker *w = self;
+    int frct, k;
+    wire *top;
+    PROF_BEGIN();
 
-    prfd = (id == 0 ? r2 : r1);	/* which file descriptor is pipe on */
+    if (w->sim->event_ns > 0) {
+        udp_queue_frames();	/* frames come in as datagrams */
+        PROF_END(PF_QUEUE_FRAMES);
+        return;
+    }
+    if (w->ring.fd >= 0) {
+        ring_queue_frames();	/* a read is in flight in the ring */
+        PROF_END(PF_QUEUE_FRAMES);
+        return;
+    }
+    if (w->sim->fec.mode != FEC_NONE) {
+        fec_queue_frames();	/* parity records must be filtered out */
+        PROF_END(PF_QUEUE_FRAMES);
+        return;
+    }
 
     /* How many frames can be read consecutively? */
-    top = (outp <= inp ? &queue[MAX_QUEUE] : outp);/* how far can we rd?*/
-    k = top - inp;	/* number of frames that can be read consecutively */
-    /**/ fprintf(flog,"XQF1 k=%d, nframes=%d\n",k, nframes);
-    frct =read(prfd, inp, k * FRAME_SIZE) ;
-    /**/ fprintf(flog,"XQF2 k=%d, nframes=%d\n",k, nframes);
+    top = (w->outp <= w->inp ? &w->queue[MAX_QUEUE] : w->outp);/* how far can we rd?*/
+    k = top - w->inp;	/* number of frames that can be read consecutively */
+    /**/ LOG(w->flog,"XQF1 k=%d, nframes=%d\n",k, w->nframes);
+    frct =SYSREAD(w->stats.syscalls, PF_FRAME_READ, w->prfd, w->inp, k * WIRE_SIZE) ;
+    /**/ LOG(w->flog,"XQF2 k=%d, nframes=%d\n",k, w->nframes);
     if (frct<0) {
         if (errno != EAGAIN) sim_error("error in reading the pipe 1");}
     if (frct > 0)
-    { nframes = nframes + frct/FRAME_SIZE;
-        /**/ fprintf(flog,"XQF3 k=%d, nframes=%d\n",k, nframes);
-        inp = inp + frct/FRAME_SIZE;
-        if (inp == &queue[MAX_QUEUE]) inp = queue;
-        /**/ if (nframes>0) print_queue();
-        if (frct/FRAME_SIZE==k)     /*are there residual frames to be read? */
-        { k = outp - inp;
-            /**/ fprintf(flog,"XQF4 k=%d, nframes=%d\n",k, nframes);
-            frct = read (prfd, inp, k * FRAME_SIZE);
-            /**/ fprintf(flog,"XQF5 k=%d, nframes=%d\n",k, nframes);
+    { w->nframes = w->nframes + frct/WIRE_SIZE;
+        /**/ LOG(w->flog,"XQF3 k=%d, nframes=%d\n",k, w->nframes);
+        w->inp = w->inp + frct/WIRE_SIZE;
+        if (w->inp == &w->queue[MAX_QUEUE]) w->inp = w->queue;
+        /**/ if (w->nframes>0) print_queue();
+        if (frct/WIRE_SIZE==k)     /*are there residual frames to be read? */
+        { k = w->outp - w->inp;
+            /**/ LOG(w->flog,"XQF4 k=%d, nframes=%d\n",k, w->nframes);
+            frct = SYSREAD(w->stats.syscalls, PF_FRAME_READ, w->prfd, w->inp, k * WIRE_SIZE);
+            /**/ LOG(w->flog,"XQF5 k=%d, nframes=%d\n",k, w->nframes);
             if (frct<0) {
                 if (errno != EAGAIN) sim_error("error in reading the pipe 2"); }
             if (frct > 0)
-            { nframes = nframes + frct/FRAME_SIZE;
-                /**/ fprintf(flog,"XQF6 k=%d, nframes=%d\n",k, nframes);
-                inp = inp + frct/FRAME_SIZE;
-                /**/ if (nframes>1) print_queue();
-                if (frct/FRAME_SIZE==k)
+            { w->nframes = w->nframes + frct/WIRE_SIZE;
+                /**/ LOG(w->flog,"XQF6 k=%d, nframes=%d\n",k, w->nframes);
+                w->inp = w->inp + frct/WIRE_SIZE;
+                /**/ if (w->nframes>1) print_queue();
+                if (frct/WIRE_SIZE==k)
                     sim_error("queue full");
             }
         }
     }
+    PROF_END(PF_QUEUE_FRAMES);
+}
+
+
+void fec_queue_frames(void)
+{
+    /* Queue_frames() for a channel with forward error correction.  The pipe
+     * is drained into fec_in[] first, and each record is then handed to
+     * fec_receive(), which queues the data frames and drops the parity.
+     * Room is left in queue[] for a whole group of rebuilt frames.
+     */
+
+    struct dlsim_worker *w = self;
+    int frct, k, i;
+
+    while (true) {
+        k = MAX_QUEUE - w->nframes - FEC_MAX_K;
+        if (k <= 0) sim_error("queue full");
+        frct = SYSREAD(w->stats.syscalls, PF_FRAME_READ, w->prfd, w->fec_in, k * WIRE_SIZE);
+        if (frct < 0) {
+            if (errno != EAGAIN) sim_error("error in reading the pipe 1");
+            return;
+        }
+        for (i = 0; i < frct/WIRE_SIZE; i++) fec_receive(&w->fec_in[i]);
+        if (frct/WIRE_SIZE < k) return;	/* pipe is empty */
+    }
+}
+
+
+void udp_queue_frames(void)
+{
+    /* Queue_frames() for the UDP transport.  The datagrams are received
+     * in batches into fec_in[], and each record is queued, or handed to
+     * fec_receive() with FEC on.  When the queue is full, the rest stay in
+     * the socket, whose buffer drops what does not fit, as a real link
+     * would.
+     */
+
+    struct dlsim_worker *w = self;
+    int n, k, i;
+
+    while (true) {
+        k = MAX_QUEUE - w->nframes - FEC_MAX_K;
+        if (k <= 0) return;
+        if (k > UDP_BATCH) k = UDP_BATCH;
+        n = PROF_IO(PF_FRAME_READ, udp_receive(&w->udp, w->fec_in, k, &w->stats.syscalls));
+        if (n < 0) sim_error("error in reading the socket");
+        for (i = 0; i < n; i++) {
+            if (w->sim->fec.mode != FEC_NONE) fec_receive(&w->fec_in[i]);
+            else enqueue_frame(&w->fec_in[i].f, w->fec_in[i].group, w->fec_in[i].due);
+        }
+        if (n < k) return;	/* socket is empty */
+    }
+}
+
+
+void ring_queue_frames(void)
+{
+    /* Queue_frames() on the io_uring backend.  A read of the pipe is kept
+     * in flight, straight into the free part of queue[], or into fec_in[]
+     * with FEC on.  When it has completed, its frames are queued and it is
+     * submitted again at once, to pick up what has come since, so the queue
+     * ends up with the same frames as with read().  The read that finds the
+     * pipe empty stays in flight, and as long as nothing arrives, this
+     * takes no system call at all.
+     */
+
+    struct dlsim_worker *w = self;
+    int fec = (w->sim->fec.mode != FEC_NONE), k, n, i, reaped = 0;
+    wire *buf, *top;
+
+    while (true) {
+        if (!uring_poll(&w->ring, &w->stats.syscalls)) sim_error("error in reading the pipe 1");
+        ring_reap(w);
+        if (w->rx_state == RX_IN_FLIGHT) return;	/* pipe is empty */
+        if (w->rx_state == RX_DONE) {
+            w->rx_state = RX_IDLE;
+            if (w->rx_res < 0) sim_error("error in reading the pipe 1");
+            if (w->rx_res == 0) return;		/* the peer is gone */
+            n = w->rx_res / WIRE_SIZE;
+            reaped = 1;
+            if (fec) {
+                for (i = 0; i < n; i++) fec_receive(&w->fec_in[i]);
+            } else {
+                w->nframes += n;
+                w->inp += n;
+                if (w->inp == &w->queue[MAX_QUEUE]) w->inp = w->queue;
+                /**/ if (w->nframes>0) print_queue();
+            }
+        }
+
+        /* Read again, as much as there is room for. */
+        if (fec) {
+            k = MAX_QUEUE - w->nframes - FEC_MAX_K;
+            buf = w->fec_in;
+        } else {
+            top = (w->outp <= w->inp ? &w->queue[MAX_QUEUE] : w->outp);
+            k = (w->nframes == MAX_QUEUE ? 0 : top - w->inp);
+            buf = w->inp;
+        }
+        if (k <= 0) sim_error("queue full");
+        w->rx_len = k * WIRE_SIZE;
+        if (!uring_queue(&w->ring, URING_READ, w->prfd, buf, w->rx_len,
+                         w->ring_fixed ? (fec ? 1 : 0) : -1, 0, RING_FRAMES_IN))
+            sim_error("io_uring full");
+        w->rx_state = RX_IN_FLIGHT;
+        if (!reaped) return;	/* the first read goes with the reply */
+        if (!PROF_IO(PF_FRAME_READ, uring_submit(&w->ring, 0, &w->stats.syscalls)))
+            sim_error("error in reading the pipe 1");
+    }
+}
+
+
+void fec_receive(wire *r)
+{
+    /* Process one record of the incoming FEC stream.  Data frames are passed
+     * on in order.  After a gap, the frames behind it are held back until
+     * any k blocks of the group are in and the lost frames have been rebuilt,
+     * so that a rebuilt frame never overtakes the frames sent after it.
+     * Records arrive in order, so a record of a new group, or the last
+     * parity block, means the old group is as complete as it will get.
+     * The parity blocks of a group sent before it was full say how many
+     * frames it has; the missing ones were zero blocks to the encoder, and
+     * fewer parity blocks were sent.
+     */
+
+    struct dlsim_worker *w = self;
+    struct fec_code *fec = &w->sim->fec;
+    unsigned char *blocks[FEC_MAX_K + FEC_MAX_M];
+    int i, n;
+
+    if (r->index >= (unsigned int) (fec->k + fec->m)) sim_error("bad FEC record");
+    if (r->index >= (unsigned int) fec->k && (r->size == 0 || r->size > (unsigned int) fec->k))
+        sim_error("bad FEC record");
+    if (r->group != w->fec_rx_group) {
+        fec_flush_group(r->due);
+        w->fec_rx_group = r->group;
+        w->fec_rx_next = 0;
+    }
+    w->fec_rx[r->index] = r->f;
+    w->fec_rx_present[r->index] = 1;
+    if (r->index >= (unsigned int) fec->k && (int) r->size < w->fec_rx_size) {
+        for (i = r->size; i < fec->k; i++) {
+            memset(&w->fec_rx[i], 0, FRAME_SIZE);
+            w->fec_rx_present[i] = 1;
+        }
+        w->fec_rx_size = r->size;
+    }
+
+    for (i = 0, n = 0; i < fec->k + fec->m; i++) n += w->fec_rx_present[i];
+    if (w->fec_rx_next < w->fec_rx_size && n >= fec->k) {
+        for (i = 0; i < fec->k + fec->m; i++) blocks[i] = (unsigned char *) &w->fec_rx[i];
+        if (fec_decode(fec, blocks, w->fec_rx_present, FRAME_SIZE)) {
+            for (i = w->fec_rx_next; i < w->fec_rx_size; i++) {
+                if (w->fec_rx_present[i]) continue;
+                w->fec_rx_present[i] = 1;
+                w->stats.fec_recovered++;
+            }
+        }
+    }
+
+    /* Pass on the frames that are now in order.  They reach the protocol
+     * when the record that freed them does.
+     */
+    while (w->fec_rx_next < w->fec_rx_size && w->fec_rx_present[w->fec_rx_next]) {
+        enqueue_frame(&w->fec_rx[w->fec_rx_next], w->fec_rx_group * fec->k + w->fec_rx_next, r->due);
+        w->fec_rx_next++;
+    }
+    if (r->index >= (unsigned int) fec->k &&
+        r->index == (unsigned int) (fec->k + fec_parity_blocks(fec, r->size) - 1))
+        fec_flush_group(r->due);
+}
+
+
+void fec_flush_group(bigint due)
+{
+    /* Give up on the rest of the incoming group: pass on the frames still
+     * held back, to reach the protocol at tick due, skipping the ones that
+     * were lost for good.
+     */
+
+    struct dlsim_worker *w = self;
+    struct fec_code *fec = &w->sim->fec;
+    int i;
+
+    for (; w->fec_rx_next < w->fec_rx_size; w->fec_rx_next++) {
+        if (w->fec_rx_present[w->fec_rx_next])
+            enqueue_frame(&w->fec_rx[w->fec_rx_next], w->fec_rx_group * fec->k + w->fec_rx_next, due);
+        else w->stats.fec_unrecovered++;
+    }
+    for (i = 0; i < fec->k + fec->m; i++) w->fec_rx_present[i] = 0;
+    w->fec_rx_next = w->fec_rx_size = fec->k;
+}
+
 
+void enqueue_frame(frame *f, unsigned int serial, bigint due)
+{
+    /* Append one frame, numbered serial by its sender and due at tick due,
+     * to the circular buffer queue[].
+     */
+
+    struct dlsim_worker *w = self;
+
+    if (w->nframes == MAX_QUEUE) sim_error("queue full");
+    w->inp->group = serial;
+    w->inp->index = 0;
+    w->inp->size = 0;
+    w->inp->due = due;
+    w->inp->f = *f;
+    w->inp++;
+    if (w->inp == &w->queue[MAX_QUEUE]) w->inp = w->queue;
+    w->nframes++;
 }
 
 
@@ -482,11 +1482,16 @@ int pick_event(void)
      * a reasonable strategy, and more closely models how a real line works.
      */
 
-    if (check_ack_timer() > 0) return(ack_timeout);
-    if (nframes > 0) return((int)frametype());
-    if (network_layer_status) return(network_layer_ready);
-    if (check_timers() >= 0) return(timeout);	/* timer went off */
-    return no_event;
+    int event;
+    PROF_BEGIN();
+
+    if (check_ack_timer() > 0) event = ack_timeout;
+    else if (self->nframes > 0 && self->outp->due <= self->tick) event = (int)frametype();
+    else if (self->network_layer_status && packet_ready()) event = network_layer_ready;
+    else if (check_timers() >= 0) event = timeout;	/* timer went off */
+    else event = no_event;
+    PROF_END(PF_PICK_EVENT);
+    return(event);
 }
 
 
@@ -506,34 +1511,43 @@ event_type frametype(void)
      * or bad (contains a checksum error).
      */
 
-    int n, i;
+    struct dlsim_worker *w = self;
+    struct dlsim_link *l = &w->sim->link[1 - w->id];	/* the peer's direction */
+    int n, i, bad;
     event_type event;
+    PROF_BEGIN();
 
     /* Remove one frame from the queue. */
-    last_frame = *outp;		/* copy the first frame in the queue */
-    outp++;
-    if (outp == &queue[MAX_QUEUE]) outp = queue;
-    nframes--;
+    w->last_frame = w->outp->f;	/* copy the first frame in the queue */
+    w->rx_serial = w->outp->group;
+    w->outp++;
+    if (w->outp == &w->queue[MAX_QUEUE]) w->outp = w->queue;
+    w->nframes--;
 
     /* Generate frames with checksum errors at random. */
-    n = rand() & 01777;
-    if (n < garbled) {
+    if ((bad = bits_get(&w->garbled)) < 0) {
+        n = sim_rand(&w->rng) & 01777;
+        bad = (n < (l->garbled >= 0 ? l->garbled : w->sim->garbled));
+        bits_put(&w->garbled, bad);
+    }
+    if (bad) {
         /* Checksum error.*/
         event = cksum_err;
-        if (last_frame.kind == data) cksum_data_recd++;
-        if (last_frame.kind == ack) cksum_acks_recd++;
+        if (w->last_frame.kind == data) w->stats.cksum_data_recd++;
+        if (w->last_frame.kind == ack) w->stats.cksum_acks_recd++;
         i = 0;
     } else {
         event = frame_arrival;
-        if (last_frame.kind == data) good_data_recd++;
-        if (last_frame.kind == ack) good_acks_recd++;
+        if (w->last_frame.kind == data) w->stats.good_data_recd++;
+        if (w->last_frame.kind == ack) w->stats.good_acks_recd++;
         i = 1;
     }
 
-    if (debug_flags & RECEIVES) {
-        printf("Tick %lu. Proc %d got %s frame:  ",tick/DELTA,id,badgood[i]);
-        fr(&last_frame);
+    if (w->sim->debug_flags & RECEIVES) {
+        printf("Tick %llu. Proc %d got %s frame:  ",w->tick/DELTA,w->id,badgood[i]);
+        fr(&w->last_frame);
     }
+    PROF_END(PF_FRAMETYPE);
     return(event);
 }
 
@@ -542,11 +1556,25 @@ void from_network_layer(packet *p)
 {
     /* Fetch a packet from the network layer for transmission on the channel. */
 
-    p->data[0] = (next_net_pkt >> 24) & BYTE;
-    p->data[1] = (next_net_pkt >> 16) & BYTE;
-    p->data[2] = (next_net_pkt >>  8) & BYTE;
-    p->data[3] = (next_net_pkt      ) & BYTE;
-    next_net_pkt++;
+    struct dlsim_worker *w = self;
+    double t;
+
+    if (w->traffic_out.mode != TRAFFIC_SATURATED && !w->traffic_ended) {
+        /* Protocols 2-4 fetch without waiting for network_layer_ready, so
+         * they would take packets before the generator made them.
+         */
+        if (!w->network_layer_status)
+            sim_error("traffic= needs a protocol that waits for network_layer_ready");
+        if (w->tick > w->next_arrival) w->stats.queue_wait_sum += w->tick - w->next_arrival;
+        t = traffic_next(&w->traffic_out);
+        if (t < 0) w->traffic_ended = 1;
+        else w->next_arrival = (bigint) (t * DELTA);
+    }
+    p->data[0] = (w->next_net_pkt >> 24) & BYTE;
+    p->data[1] = (w->next_net_pkt >> 16) & BYTE;
+    p->data[2] = (w->next_net_pkt >>  8) & BYTE;
+    p->data[3] = (w->next_net_pkt      ) & BYTE;
+    w->next_net_pkt++;
 }
 
 
@@ -557,26 +1585,41 @@ void to_network_layer(packet *p)
      * is terminated with a "protocol error" message.
      */
 
+    struct dlsim_worker *w = self;
     unsigned int num;
+    double t;
+    bigint d;
 
     num = pktnum(p);
-    if (num != last_pkt_given + 1) {
-        printf("Tick %lu. Proc %d got protocol error.  Packet delivered out of order.\n", tick/DELTA, id);
-        printf("Expected payload %d but got payload %d\n",last_pkt_given+1,num);
-        exit(0);
+    if (num != w->last_pkt_given + 1) {
+        printf("Tick %llu. Proc %d got protocol error.  Packet delivered out of order.\n", w->tick/DELTA, w->id);
+        printf("Expected payload %d but got payload %d\n",w->last_pkt_given+1,num);
+        worker_exit(w->sim->threaded);	/* a thread reports the error */
+    }
+    w->last_pkt_given = num;
+    w->stats.payloads_accepted++;
+
+    /* Packets arrive in order, so the peer's generator replays their times. */
+    if (w->traffic_in.mode != TRAFFIC_SATURATED && (t = traffic_next(&w->traffic_in)) >= 0) {
+        d = (bigint) (t * DELTA);
+        d = (w->tick > d ? w->tick - d : 0);
+        w->stats.delay_sum += d;
+        if (d > w->stats.delay_max) w->stats.delay_max = d;
+        w->stats.delays++;
     }
-    last_pkt_given = num;
-    payloads_accepted++;
 }
 
 
 void from_physical_layer (frame *r)
 {
     /* Copy the newly-arrived frame to the user. */
-    *r = last_frame;
-    fprintf(flog,"PFF4 tick %lu, from_ph: r->seq=%u, r->ack=%u\n", tick/DELTA, r->seq, r->ack);
-    fflush(flog);
+    PROF_BEGIN();
+
+    *r = self->last_frame;
+    LOG(self->flog,"PFF4 tick %llu, from_ph: r->seq=%u, r->ack=%u\n", self->tick/DELTA, r->seq, r->ack);
+    FLUSH(self->flog, self->stats.syscalls);
     flog_frame(r,'R');
+    PROF_END(PF_FROM_PHYSICAL);
 }
 
 void to_physical_layer(frame *s)
@@ -585,9 +1628,11 @@ void to_physical_layer(frame *s)
      * However, this is where bad packets are discarded: they never get written.
      */
 
-    int fd, got, k;
-
-
+    struct dlsim_worker *w = self;
+    int lost;
+    unsigned int serial;
+    wire r;
+    PROF_BEGIN();
 
     /* The following statement is essential to later on determine the timed
      * out sequence number, e.g. in protocol 6. Keeping track of
@@ -598,37 +1643,209 @@ void to_physical_layer(frame *s)
      * timeout, knowing the buffer number makes it possible to determine
      * the sequence number.
      */
-    if (s->kind==data) seqs[s->seq % nseqs] = s->seq; /*JH*/
+    if (s->kind==data) w->seqs[s->seq % w->nseqs] = s->seq; /*JH*/
 
-    if (s->kind == data) data_sent++;
-    if (s->kind == ack) acks_sent++;
-    if (retransmitting) data_retransmitted++;
-    fprintf(flog,"PTF5 tick %lu, to_ph: s->seq=%u, s->ack=%u\n", tick/DELTA, s->seq, s->ack);
-    fflush(flog);
+    if (s->kind == data) w->stats.data_sent++;
+    if (s->kind == ack) w->stats.acks_sent++;
+    if (w->retransmitting) w->stats.data_retransmitted++;
+    LOG(w->flog,"PTF5 tick %llu, to_ph: s->seq=%u, s->ack=%u\n", w->tick/DELTA, s->seq, s->ack);
+    FLUSH(w->flog, w->stats.syscalls);
     flog_frame(s,'S');
+
+    /* Number the frame, so that a trace can follow it to the peer.  With
+     * FEC, its slot in the stream of groups is its number.
+     */
+    if (w->sim->fec.mode != FEC_NONE) serial = w->fec_tx_group * w->sim->fec.k + w->fec_tx_n;
+    else serial = w->tx_serial++;
+
     /* Bad transmissions (checksum errors) are simulated here. */
-    k = rand() & 01777;		/* 0 <= k <= about 1000 (really 1023) */
-    if (k < pkt_loss) {	/* simulate packet loss */
-        if (debug_flags & SENDS) {
-            printf("Tick %lu. Proc %d sent frame that got lost: ",tick/DELTA, id);
+    lost = lose_frame();
+    if (w->ftrace != NULL) trace_send(w, s, serial, lost);
+    if (lost) {	/* simulate packet loss */
+        if (w->sim->debug_flags & SENDS) {
+            printf("Tick %llu. Proc %d sent frame that got lost: ",w->tick/DELTA, w->id);
             fr(s);
         }
-        if (s->kind == data) data_lost++;	/* statistics gathering */
-        if (s->kind == ack) acks_lost++;	/* ditto */
-        return;
-
+        if (s->kind == data) w->stats.data_lost++;	/* statistics gathering */
+        if (s->kind == ack) w->stats.acks_lost++;	/* ditto */
+    } else {
+        if (s->kind == data) w->stats.data_not_lost++;	/* statistics gathering */
+        if (s->kind == ack) w->stats.acks_not_lost++;	/* ditto */
     }
-    if (s->kind == data) data_not_lost++;		/* statistics gathering */
-    if (s->kind == ack) acks_not_lost++;		/* ditto */
-    fd = (id == 0 ? w1 : w2);
 
-    got = write(fd, s, FRAME_SIZE);
-    if (got != FRAME_SIZE) print_statistics();	/* must be done */
+    if (w->sim->fec.mode != FEC_NONE) {
+        fec_send(s, lost);	/* the FEC layer numbers and writes the frame */
+    } else if (!lost) {
+        r.group = serial;
+        r.index = 0;
+        r.size = 0;
+        r.f = *s;
+        send_wire(&r);
+    }
 
-    if (debug_flags & SENDS) {
-        printf("Tick %lu. Proc %d sent frame: ", tick/DELTA, id);
+    if (!lost && (w->sim->debug_flags & SENDS)) {
+        printf("Tick %llu. Proc %d sent frame: ", w->tick/DELTA, w->id);
         fr(s);
     }
+    PROF_END(PF_TO_PHYSICAL);
+}
+
+
+int lose_frame(void)
+{
+    /* Decide whether the frame now being put on the link is lost on the
+     * way, and when it reaches the peer (self->due).  A link with a rate
+     * sends its frames one at a time, lost ones too; a link with a delay
+     * holds each frame that long.
+     */
+
+    struct dlsim_worker *w = self;
+    struct dlsim_link *l = &w->sim->link[w->id];
+    int k, lost;
+
+    if (l->frame_ticks > 0 || l->delay > 0) {
+        if (w->link_free < w->tick) w->link_free = w->tick;
+        w->link_free += l->frame_ticks;
+        w->due = w->link_free + l->delay;
+    }
+    if ((lost = bits_get(&w->lost)) < 0) {
+        k = sim_rand(&w->rng) & 01777;	/* 0 <= k <= about 1000 (really 1023) */
+        lost = (k < (l->loss >= 0 ? l->loss : w->sim->pkt_loss));
+        bits_put(&w->lost, lost);
+    }
+    return(lost);
+}
+
+
+void fec_send(frame *s, int lost)
+{
+    /* Pass a frame through the FEC layer.  Every frame, lost or not, takes the
+     * next slot in the current group.  When the group is full, the parity
+     * blocks are computed and sent; they can be lost like any other frame.
+     */
+
+    struct dlsim_worker *w = self;
+    wire r;
+
+    r.group = w->fec_tx_group;
+    r.index = w->fec_tx_n;
+    r.size = 0;
+    r.f = *s;
+    w->fec_tx[w->fec_tx_n++] = *s;
+    w->fec_tx_last = w->tick;
+    if (!lost) send_wire(&r);
+    if (w->fec_tx_n == w->sim->fec.k) fec_finish_group();
+}
+
+
+void fec_finish_group(void)
+{
+    /* Send the parity blocks of the outgoing group and start the next one.
+     * The empty slots of a group that is not full count as zero blocks,
+     * and it gets fewer parity blocks (see fec_parity_blocks()).
+     */
+
+    struct dlsim_worker *w = self;
+    struct fec_code *fec = &w->sim->fec;
+    unsigned char *data[FEC_MAX_K], *parity[FEC_MAX_M];
+    frame par[FEC_MAX_M], zero;
+    int i;
+    wire r;
+
+    memset(&zero, 0, sizeof(zero));
+    for (i = 0; i < fec->k; i++)
+        data[i] = (unsigned char *) (i < w->fec_tx_n ? &w->fec_tx[i] : &zero);
+    for (i = 0; i < fec->m; i++) parity[i] = (unsigned char *) &par[i];
+    fec_encode(fec, data, parity, FRAME_SIZE);
+    r.group = w->fec_tx_group;
+    r.size = w->fec_tx_n;
+    for (i = 0; i < fec_parity_blocks(fec, w->fec_tx_n); i++) {
+        w->stats.fec_parity_sent++;
+        if (lose_frame()) {
+            w->stats.fec_parity_lost++;
+            continue;
+        }
+        r.index = fec->k + i;
+        r.f = par[i];
+        send_wire(&r);
+    }
+    w->fec_tx_group++;
+    w->fec_tx_n = 0;
+}
+
+
+int fec_idle(void)
+{
+    /* The sender is idle, or a timer went off.  A group that is not full
+     * may wait long for its next frame, e.g. when the window is smaller
+     * than k, and frames lost from it can only be rebuilt once its parity
+     * is sent.  So it is finished once no frame has joined it for
+     * FEC_HOLDOFF events; waiting that long lets the frames sent after
+     * an acknowledgement join it, instead of every burst getting parity of
+     * its own.  Returns 1 if it was finished.
+     */
+
+    struct dlsim_worker *w = self;
+
+    if (w->fec_tx_n == 0 || w->tick < w->fec_tx_last + FEC_HOLDOFF * DELTA) return(0);
+    fec_finish_group();
+    return(1);
+}
+
+
+void send_wire(wire *r)
+{
+    /* Write one record to the peer.  The UDP transport sends it with the
+     * others of the same event, before the next wait.
+     */
+
+    struct dlsim_worker *w = self;
+    int ok;
+
+    r->due = w->due;
+    if (w->ring.fd >= 0) {
+        ring_send(r);
+        return;
+    }
+    if (w->sim->event_ns > 0)
+        ok = PROF_IO(PF_FRAME_WRITE, udp_send(&w->udp, r, &w->stats.syscalls));
+    else
+        ok = (SYSWRITE(w->stats.syscalls, PF_FRAME_WRITE, w->pwfd, r, WIRE_SIZE) == WIRE_SIZE);
+    if (!ok) print_statistics();	/* must be done */
+}
+
+
+void ring_send(wire *r)
+{
+    /* Queue the write of a record on the io_uring backend.  It goes out
+     * with the reply to main, linked ahead of it, or when ring_tx[] is
+     * full.
+     */
+
+    struct dlsim_worker *w = self;
+    wire *t;
+
+    if (w->ring_ntx == RING_TX) ring_flush(w);
+    t = &w->ring_tx[w->ring_ntx++];
+    *t = *r;
+    if (!uring_queue(&w->ring, URING_WRITE, w->pwfd, t, WIRE_SIZE, w->ring_fixed ? 2 : -1,
+                     1, RING_FRAME_OUT))
+        sim_error("io_uring full");
+    w->ring_busy++;
+}
+
+
+void ring_flush(struct dlsim_worker *w)
+{
+    /* Write the frames in ring_tx[] now, and wait until they are out. */
+
+    uring_unlink(&w->ring);
+    while (w->ring_busy > 0) {
+        if (!PROF_IO(PF_FRAME_WRITE, uring_submit(&w->ring, 1, &w->stats.syscalls))) print_statistics();
+        ring_reap(w);
+    }
+    w->ring_ntx = 0;
+    if (w->ring_failed) print_statistics();	/* must be done */
 }
 
 
@@ -636,8 +1853,12 @@ void start_timer(seq_nr k)
 {
     /* Start a timer for a data frame. */
 
-    ack_timer[k % nseqs] = tick + timeout_interval + offset; /*JH*/
-    offset++;
+    if (self->ftrace != NULL) {
+        if (self->ack_timer[k % self->nseqs] != NO_TIMER) trace_timer(self, k % self->nseqs, 'e');
+        trace_timer(self, k % self->nseqs, 'b');
+    }
+    self->ack_timer[k % self->nseqs] = self->tick + self->sim->timeout_interval + self->offset; /*JH*/
+    self->offset++;
     recalc_timers();		/* figure out which timer is now lowest */
 }
 
@@ -646,7 +1867,9 @@ void stop_timer(seq_nr k)
 {
     /* Stop a data frame timer. */
 
-    ack_timer[k % nseqs] = 0; /*JH*/
+    if (self->ftrace != NULL && self->ack_timer[k % self->nseqs] != NO_TIMER)
+        trace_timer(self, k % self->nseqs, 'e');
+    self->ack_timer[k % self->nseqs] = NO_TIMER; /*JH*/
     recalc_timers();		/* figure out which timer is now lowest */
 }
 
@@ -659,8 +1882,12 @@ void start_ack_timer(void)
      * provided much extra insight.
      */
 
-    aux_timer = tick + timeout_interval/AUX;
-    offset++;
+    if (self->ftrace != NULL) {
+        if (self->aux_timer != NO_TIMER) trace_timer(self, NR_TIMERS, 'e');
+        trace_timer(self, NR_TIMERS, 'b');
+    }
+    self->aux_timer = self->tick + self->sim->timeout_interval/AUX;
+    self->offset++;
 }
 
 
@@ -668,7 +1895,34 @@ void stop_ack_timer(void)
 {
     /* Stop the ack timer. */
 
-    aux_timer = 0;
+    if (self->ftrace != NULL && self->aux_timer != NO_TIMER) trace_timer(self, NR_TIMERS, 'e');
+    self->aux_timer = NO_TIMER;
+}
+
+
+void init_traffic(void)
+{
+    /* Start the generator of our own packets and the copy of the peer's. */
+
+    struct dlsim_worker *w = self;
+    char *spec = (w->sim->traffic_spec[0] != '\0' ? w->sim->traffic_spec : NULL);
+    double t;
+
+    traffic_setup(&w->traffic_out, spec, w->id);
+    traffic_setup(&w->traffic_in, spec, 1 - w->id);
+    if (w->traffic_out.mode == TRAFFIC_SATURATED) return;
+    t = traffic_next(&w->traffic_out);
+    if (t < 0) w->traffic_ended = 1;
+    else w->next_arrival = (bigint) (t * DELTA);
+}
+
+
+int packet_ready(void)
+{
+    /* Does the network layer have a packet for us at this tick? */
+
+    if (self->traffic_out.mode == TRAFFIC_SATURATED) return(1);
+    return(!self->traffic_ended && self->next_arrival <= self->tick);
 }
 
 
@@ -676,7 +1930,7 @@ void enable_network_layer(void)
 {
     /* Allow network_layer_ready events to occur. */
 
-    network_layer_status = 1;
+    self->network_layer_status = 1;
 }
 
 
@@ -684,7 +1938,280 @@ void disable_network_layer(void)
 {
     /* Prevent network_layer_ready events from occuring. */
 
-    network_layer_status = 0;
+    self->network_layer_status = 0;
+}
+
+
+int save_checkpoint(struct dlsim *s)
+{
+    /* Write a checkpoint.  Main first takes the replies of both workers,
+     * so that neither is still running and no frame is on its way when
+     * the other one saves what is in its pipe.  Then it sends each a
+     * CHECKPOINT go-ahead instead of a tick.  The worker answers with its
+     * section and then sends its reply again, so main can go on as if
+     * nothing happened.  The file is written under a temporary name first,
+     * so that a crash never leaves half a checkpoint behind.
+     */
+
+    struct checkpoint_header h;
+    char tmp[sizeof(s->checkpoint) + 4];
+    unsigned char *buf;
+    bigint word, len, cmd = CHECKPOINT;
+    FILE *f;
+    int p, rfd, wfd, ok;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.worker_size = sizeof(struct dlsim_worker);
+    h.nseqs = s->nseqs;
+    h.fec_mode = s->fec.mode;
+    h.fec_k = s->fec.k;
+    h.fec_m = s->fec.m;
+    strcpy(h.traffic_spec, s->traffic_spec);
+    h.tick = s->tick;
+    h.hanging[0] = s->hanging[0];
+    h.hanging[1] = s->hanging[1];
+    h.rng = s->rng;
+
+    sprintf(tmp, "%s.tmp", s->checkpoint);
+    if ((f = fopen(tmp, "wb")) == NULL) {
+        printf("Cannot write checkpoint %s\n", tmp);
+        return(0);
+    }
+    ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+    for (p = 0; p < 2 && ok; p++) ok = read_fully(s, p == 0 ? s->r4 : s->r6, &word, TICK_SIZE);
+    for (p = 0; p < 2 && ok; p++) {
+        rfd = (p == 0 ? s->r4 : s->r6);
+        wfd = (p == 0 ? s->w3 : s->w5);
+        ok = SYSWRITE(s->syscalls, PF_CONTROL_WRITE, wfd, &cmd, TICK_SIZE) == TICK_SIZE &&
+             read_fully(s, rfd, &len, TICK_SIZE) && (buf = malloc(len)) != NULL;
+        if (!ok) break;
+        ok = read_fully(s, rfd, buf, len) && fwrite(&len, TICK_SIZE, 1, f) == 1 &&
+             fwrite(buf, len, 1, f) == 1;
+        free(buf);
+    }
+    if (fclose(f) != 0 || !ok || rename(tmp, s->checkpoint) != 0) {
+        printf("Cannot write checkpoint %s\n", s->checkpoint);
+        remove(tmp);
+        return(0);
+    }
+    LOG(s->flog, "XCK1 %llu checkpoint written to %s\n", s->tick/DELTA, s->checkpoint);
+    return(1);
+}
+
+
+int read_fully(struct dlsim *s, int fd, void *buf, bigint len)
+{
+    /* Read len bytes from a pipe to main, which may take several reads. */
+
+    char *p = buf;
+    long n;
+
+    while (len > 0) {
+        n = SYSREAD(s->syscalls, PF_CONTROL_READ, fd, p, len);
+        if (n <= 0) return(0);
+        p += n;
+        len -= n;
+    }
+    return(1);
+}
+
+
+void send_checkpoint(bigint reply)
+{
+    /* Main asked for a checkpoint: send it the length and the contents of
+     * this worker's section.  Reply is what the worker owes main.
+     */
+
+    struct dlsim_worker *w = self;
+    unsigned char *buf, *p;
+    bigint len;
+    int i;
+
+    queue_frames();		/* frames still in the pipe are state too */
+    len = SECTION_SIZE + w->nframes * WIRE_SIZE;
+    for (i = 0; i < w->nvars; i++) len += sizeof(unsigned int) + w->vars[i].size;
+    if ((p = buf = malloc(len)) == NULL) sim_error("out of memory");
+
+    memcpy(p, &reply, TICK_SIZE); p += TICK_SIZE;
+    memcpy(p, w->ack_timer, SPAN(ack_timer, queue)); p += SPAN(ack_timer, queue);
+    memcpy(p, &w->nframes, sizeof(int)); p += sizeof(int);
+    for (i = 0; i < w->nframes; i++) {
+        memcpy(p, &w->queue[(w->outp - w->queue + i) % MAX_QUEUE], WIRE_SIZE);
+        p += WIRE_SIZE;
+    }
+    memcpy(p, w->fec_tx, SPAN(fec_tx, fec_in)); p += SPAN(fec_tx, fec_in);
+    memcpy(p, &w->traffic_out, SPAN(traffic_out, vars)); p += SPAN(traffic_out, vars);
+    memcpy(p, &w->nvars, sizeof(int)); p += sizeof(int);
+    for (i = 0; i < w->nvars; i++) {
+        memcpy(p, &w->vars[i].size, sizeof(unsigned int)); p += sizeof(unsigned int);
+        memcpy(p, w->vars[i].addr, w->vars[i].size); p += w->vars[i].size;
+    }
+
+    i = (SYSWRITE(w->stats.syscalls, PF_CONTROL_WRITE, w->mwfd, &len, TICK_SIZE) == TICK_SIZE &&
+         SYSWRITE(w->stats.syscalls, PF_CONTROL_WRITE, w->mwfd, buf, len) == len);
+    free(buf);
+    if (!i) print_statistics();	/* main is gone */
+}
+
+
+int load_checkpoint(struct dlsim *s, char *file)
+{
+    /* Read a checkpoint to start the simulation from, and check that it is
+     * whole.  Whether it fits the simulation is checked by restore_main().
+     */
+
+    struct checkpoint_header h;
+    const unsigned char *p;
+    bigint len;
+    long size;
+    int id, n, ok;
+    FILE *f;
+
+    if ((f = fopen(file, "rb")) == NULL) {
+        printf("Cannot open checkpoint %s\n", file);
+        return(0);
+    }
+    free(s->restore);
+    ok = (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= (long) sizeof(h) &&
+          fseek(f, 0, SEEK_SET) == 0 && (s->restore = malloc(size)) != NULL &&
+          fread(s->restore, size, 1, f) == 1);
+    fclose(f);
+    if (ok) {
+        s->restore_len = size;
+        memcpy(&h, s->restore, sizeof(h));
+        ok = (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) == 0 &&
+              h.worker_size == sizeof(struct dlsim_worker));
+    }
+    for (id = 0; id < 2 && ok; id++) {
+        p = checkpoint_section(s, id, &len);
+        if (p == NULL || len < SECTION_SIZE) ok = 0;
+        else {
+            memcpy(&n, p + TICK_SIZE + SPAN(ack_timer, queue), sizeof(int));
+            ok = (n >= 0 && n < MAX_QUEUE && SECTION_SIZE + n * WIRE_SIZE <= len);
+        }
+    }
+    if (!ok) {
+        printf("%s is not a checkpoint of this simulator\n", file);
+        free(s->restore);
+        s->restore = NULL;
+    }
+    return(ok);
+}
+
+
+const unsigned char *checkpoint_section(struct dlsim *s, int id, bigint *len)
+{
+    /* Find the section of worker id in the checkpoint being restored.
+     * Returns NULL if the checkpoint ends early.
+     */
+
+    const unsigned char *p = s->restore + sizeof(struct checkpoint_header);
+    const unsigned char *end = s->restore + s->restore_len;
+    int i;
+
+    for (i = 0; i <= id; i++) {
+        if (end - p < TICK_SIZE) return(NULL);
+        memcpy(len, p, TICK_SIZE);
+        p += TICK_SIZE;
+        if (*len > end - p) return(NULL);
+        if (i < id) p += *len;
+    }
+    return(p);
+}
+
+
+int restore_main(struct dlsim *s)
+{
+    /* Start main from the checkpoint.  The simulation parameters (loss,
+     * garbling, timeout, number of events) may differ from those of the run
+     * that wrote it, but not what the state is made of.
+     */
+
+    struct checkpoint_header h;
+
+    memcpy(&h, s->restore, sizeof(h));
+    if (h.nseqs != s->nseqs || h.fec_mode != s->fec.mode || h.fec_k != s->fec.k ||
+        h.fec_m != s->fec.m || strcmp(h.traffic_spec, s->traffic_spec) != 0) {
+        printf("The checkpoint was made with another protocol, fec= or traffic=\n");
+        return(0);
+    }
+    s->tick = h.tick;
+    s->hanging[0] = h.hanging[0];
+    s->hanging[1] = h.hanging[1];
+    s->rng = h.rng;
+    return(1);
+}
+
+
+void restore_worker(struct dlsim_worker *w)
+{
+    /* Start worker w from its section of the checkpoint.  The protocol's
+     * variables are left for restored_from_checkpoint().
+     */
+
+    const unsigned char *p;
+    double *times_out = w->traffic_out.times, *times_in = w->traffic_in.times;
+    bigint len;
+
+    p = checkpoint_section(w->sim, w->id, &len);
+    w->restore_end = p + len;
+    memcpy(&w->reply, p, TICK_SIZE); p += TICK_SIZE;
+    memcpy(w->ack_timer, p, SPAN(ack_timer, queue)); p += SPAN(ack_timer, queue);
+    memcpy(&w->nframes, p, sizeof(int)); p += sizeof(int);
+    memcpy(w->queue, p, w->nframes * WIRE_SIZE); p += w->nframes * WIRE_SIZE;
+    w->outp = w->queue;
+    w->inp = &w->queue[w->nframes];
+    memcpy(w->fec_tx, p, SPAN(fec_tx, fec_in)); p += SPAN(fec_tx, fec_in);
+
+    /* The traffic traces were loaded again; only the positions are saved. */
+    memcpy(&w->traffic_out, p, SPAN(traffic_out, vars)); p += SPAN(traffic_out, vars);
+    w->traffic_out.times = times_out;
+    w->traffic_in.times = times_in;
+    w->restore_vars = p;
+}
+
+
+void checkpoint_variable(void *var, unsigned int size)
+{
+    /* Have a protocol variable saved in checkpoints. */
+
+    struct dlsim_worker *w = self;
+
+    if (w->nvars == MAX_VARS) sim_error("too many checkpoint variables");
+    w->vars[w->nvars].addr = var;
+    w->vars[w->nvars].size = size;
+    w->nvars++;
+}
+
+
+boolean restored_from_checkpoint(void)
+{
+    /* If the simulation was restored from a checkpoint, give the protocol
+     * variables their saved values and return true.
+     */
+
+    struct dlsim_worker *w = self;
+    const unsigned char *p = w->restore_vars;
+    unsigned int size;
+    int i, n;
+
+    if (p == NULL) return(false);
+    w->restore_vars = NULL;
+    if (w->restore_end - p < sizeof(int)) sim_error("checkpoint does not match the protocol");
+    memcpy(&n, p, sizeof(int));
+    p += sizeof(int);
+    if (n != w->nvars) sim_error("checkpoint does not match the protocol");
+    for (i = 0; i < n; i++) {
+        if (w->restore_end - p < sizeof(size)) sim_error("checkpoint does not match the protocol");
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+        if (size != w->vars[i].size || w->restore_end - p < size)
+            sim_error("checkpoint does not match the protocol");
+        memcpy(w->vars[i].addr, p, size);
+        p += size;
+    }
+    return(true);
 }
 
 
@@ -692,10 +2219,15 @@ int check_timers(void)
 {
     /* Check for possible timeout.  If found, reset the timer. */
 
+    struct dlsim_worker *w = self;
     int i;
+    PROF_BEGIN();
 
     /* See if a timeout event is even possible now. */
-    if (lowest_timer == 0 || tick < lowest_timer) return(-1);
+    if (w->lowest_timer == NO_TIMER || w->tick < w->lowest_timer) {
+        PROF_END(PF_CHECK_TIMERS);
+        return(-1);
+    }
 
     /* A timeout event is possible.  Find the lowest timer. Note that it is
      * impossible for two frame timers to have the same value, so that when a
@@ -704,15 +2236,18 @@ int check_timers(void)
      * previous one.
      */
     for (i = 0; i < NR_TIMERS; i++) {
-        if (ack_timer[i] == lowest_timer) {
-            ack_timer[i] = 0;	/* turn the timer off */
+        if (w->ack_timer[i] == w->lowest_timer) {
+            if (w->ftrace != NULL) trace_timer(w, i, 'e');
+            w->ack_timer[i] = NO_TIMER;	/* turn the timer off */
             recalc_timers();	/* find new lowest timer */
-            oldest_frame = seqs[i];	/* timed out sequence number */
+            w->oldest_frame = w->seqs[i];	/* timed out sequence number */
+            PROF_END(PF_CHECK_TIMERS);
             return(i);
         }
     }
-    printf("Impossible.  check_timers failed at %lu\n", lowest_timer);
-    exit(1);
+    printf("Impossible.  check_timers failed at %llu\n", w->lowest_timer);
+    worker_exit(1);
+    return(-1);
 }
 
 
@@ -720,18 +2255,85 @@ int check_ack_timer()
 {
     /* See if the ack timer has expired. */
 
-    if (aux_timer > 0 && tick >= aux_timer) {
-        aux_timer = 0;
+    if (self->aux_timer != NO_TIMER && self->tick >= self->aux_timer) {
+        if (self->ftrace != NULL) trace_timer(self, NR_TIMERS, 'e');
+        self->aux_timer = NO_TIMER;
         return(1);
     } else {
         return(0);
     }
 }
 
+void trace_step(struct dlsim_worker *w, int event)
+{
+    /* Trace the event the protocol is about to get: a slice of one event,
+     * in which the flow of an arriving frame ends, and the depth of the
+     * queue if it changed.
+     */
+
+    frame *f = &w->last_frame;
+
+    w->trace_sends = 0;
+    if (event == frame_arrival || event == cksum_err) {
+        TRACE(w, 'X', event_name[event], w->tick, ",\"dur\":%d,\"args\":{\"kind\":\"%s\",\"seq\":%u,\"ack\":%u}",
+              DELTA, kind_name[f->kind], f->seq, f->ack);
+        TRACE(w, 'f', "frame", w->tick, ",\"cat\":\"frame\",\"id\":%llu,\"bp\":\"e\"",
+              2 * (bigint) w->rx_serial + 1 - w->id);
+    } else if (event == timeout) {
+        TRACE(w, 'X', "timeout", w->tick, ",\"dur\":%d,\"args\":{\"seq\":%u}", DELTA, w->oldest_frame);
+    } else {
+        TRACE(w, 'X', event_name[event], w->tick, ",\"dur\":%d", DELTA);
+    }
+    if (w->nframes != w->trace_queue) {
+        w->trace_queue = w->nframes;
+        TRACE(w, 'C', "queue", w->tick, ",\"args\":{\"frames\":%d}", w->nframes);
+    }
+}
+
+
+void trace_send(struct dlsim_worker *w, frame *s, unsigned int serial, int lost)
+{
+    /* Trace a frame sent: a slice of one tick inside the current event, the
+     * frames of an event one after the other, from which the flow to the
+     * peer starts.  The flow is numbered after the frame and its sender.
+     * With FEC, a lost frame gets a flow too, as the peer may rebuild it.
+     */
+
+    char name[16];
+    bigint ts = w->tick + (w->trace_sends < DELTA - 1 ? w->trace_sends : DELTA - 1);
+
+    w->trace_sends++;
+    sprintf(name, "%s %s", lost ? "lost" : "send", kind_name[s->kind]);
+    TRACE(w, 'X', name, ts, ",\"dur\":1,\"args\":{\"seq\":%u,\"ack\":%u,\"retransmission\":%d}",
+          s->seq, s->ack, w->retransmitting);
+    if (!lost || w->sim->fec.mode != FEC_NONE) TRACE(w, 's', "frame", ts, ",\"cat\":\"frame\",\"id\":%llu", 2 * (bigint) serial + w->id);
+}
+
+
+void trace_timer(struct dlsim_worker *w, int slot, char ph)
+{
+    /* Begin (ph 'b') or end ('e') the span of the frame timer in slot, or
+     * of the ack timer if slot is NR_TIMERS.
+     */
+
+    int id = w->id * (NR_TIMERS + 1) + slot;
+
+    if (slot == NR_TIMERS)
+        TRACE(w, ph, "ack timer", w->tick, ",\"cat\":\"timer\",\"id\":%d", id);
+    else
+        TRACE(w, ph, "timer", w->tick, ",\"cat\":\"timer\",\"id\":%d,\"args\":{\"seq\":%u}",
+              id, w->seqs[slot]);
+}
+
+
 void flog_frame(frame *f, char sr)
 {
-    fprintf(flog,"XXXX%6lu %c%2d",tick/DELTA,sr,id);
-    if (id==0) {
+    FILE *flog = self->flog;
+
+    if (flog == NULL) return;
+    PROF_BEGIN();
+    fprintf(flog,"XXXX%6llu %c%2d",self->tick/DELTA,sr,self->id);
+    if (self->id==0) {
         fprintf(flog,"%4d %4s%4d%4d ",
                 pktnum(&f->info), tag[f->kind], f->seq, f->ack);
         if (sr=='S') fprintf(flog,"-->\n");
@@ -744,39 +2346,46 @@ void flog_frame(frame *f, char sr)
         fprintf(flog,"%4d %4s%4d%4d\n",
                 pktnum(&f->info), tag[f->kind], f->seq, f->ack);
     }
+    PROF_END(PF_LOG);
 }
 
 void flog_string(char *str_out)
-{ fprintf(flog,"%s",str_out);
+{ LOG(self->flog,"%s",str_out);
 }
 
 void print_queue(void) /*JH*/
 {
+    struct dlsim_worker *w = self;
+    FILE *flog = w->flog;
     int i,k,kk=0;
-    frame *top;
+    wire *top;
     frame prt_frame;
-    fprintf(flog,"XPQ0\n"); fflush(flog);
-    top=(outp<inp ? inp : &queue[MAX_QUEUE]);
-    k = top -outp;
+
+    if (flog == NULL) return;
+    PROF_BEGIN();
+    fprintf(flog,"XPQ0\n"); FLUSH(flog, w->stats.syscalls);
+    top=(w->outp<w->inp ? w->inp : &w->queue[MAX_QUEUE]);
+    k = top -w->outp;
     for (i=0; i<k; i++)
-    { kk=outp-queue;
-        prt_frame = queue[kk+i];
+    { kk=w->outp-w->queue;
+        prt_frame = w->queue[kk+i].f;
         fprintf(flog, "XPQ1 pos=%d, seq=%u, ack=%u, info=%d\n",
                 kk+i, prt_frame.seq, prt_frame.ack, pktnum(&prt_frame.info));
     }
-    fflush(flog);
+    FLUSH(flog, w->stats.syscalls);
     kk=0;
-    if (inp < outp)
-    {  kk = inp-queue;
+    if (w->inp < w->outp)
+    {  kk = w->inp-w->queue;
         for (i=0;i<kk; i++)
-        {  prt_frame = queue[i];
+        {  prt_frame = w->queue[i].f;
             fprintf(flog, "XPQ2 pos=%d, seq=%u, ack=%u, info=%d\n",
                     i, prt_frame.seq, prt_frame.ack, pktnum(&prt_frame.info));
         }
-        fflush(flog);
+        FLUSH(flog, w->stats.syscalls);
     }
-    fprintf(flog,"XPQ3, nframes=%d, frames printed=%d\n", nframes, k+kk);
-    fflush(flog);
+    fprintf(flog,"XPQ3, nframes=%d, frames printed=%d\n", w->nframes, k+kk);
+    FLUSH(flog, w->stats.syscalls);
+    PROF_END(PF_LOG);
 }
 
 unsigned int pktnum(packet *p)
@@ -804,71 +2413,153 @@ void fr(frame *f)
 
 void recalc_timers(void)
 {
-    /* Find the lowest timer */
+    /* Find the lowest timer, or NO_TIMER if none is running. */
 
-    int i;
-    bigint t = UINT_MAX;
+    struct dlsim_worker *w = self;
+    FILE *flog = w->flog;
+    int i, n = 0;
+    bigint t = NO_TIMER;
+    PROF_BEGIN();
 
     for (i = 0; i < NR_TIMERS; i++) {
-        if (ack_timer[i] > 0 && ack_timer[i] < t) t = ack_timer[i];
+        if (w->ack_timer[i] != NO_TIMER) n++;
+        if (w->ack_timer[i] != NO_TIMER && (t == NO_TIMER || w->ack_timer[i] < t))
+            t = w->ack_timer[i];
+    }
+    w->lowest_timer = t;
+    if (w->ftrace != NULL && n != w->trace_window) {
+        w->trace_window = n;
+        TRACE(w, 'C', "window", w->tick, ",\"args\":{\"outstanding\":%d}", n);
     }
-    lowest_timer = t;
 
-    fprintf(flog,"XRC1%6lu %3d seqs=", tick, id); /*JH*/
-    for (i=0; i < NR_TIMERS; i++) {            /*JH*/
-        fprintf(flog,"%2u",seqs[i]);           /*JH*/
-    }                                          /*JH*/
-    fprintf(flog,"ack_timer=");                /*JH*/
-    for (i=0; i < NR_TIMERS; i++) {            /*JH*/
-        fprintf(flog,"%4lu", ack_timer[i]);         /*JH*/
-    }                                          /*JH*/
-    fprintf(flog,"lowest=%lu\n",lowest_timer);  /*JH*/
+    if (flog != NULL) {
+        PROF_BEGIN();
+        fprintf(flog,"XRC1%6llu %3d seqs=", w->tick, w->id); /*JH*/
+        for (i=0; i < NR_TIMERS; i++) {            /*JH*/
+            fprintf(flog,"%2u",w->seqs[i]);           /*JH*/
+        }                                          /*JH*/
+        fprintf(flog,"ack_timer=");                /*JH*/
+        for (i=0; i < NR_TIMERS; i++) {            /*JH*/
+            fprintf(flog,"%4llu", w->ack_timer[i]);         /*JH*/
+        }                                          /*JH*/
+        fprintf(flog,"lowest=%llu\n",w->lowest_timer);  /*JH*/
+        PROF_END(PF_LOG);
+    }
+    PROF_END(PF_RECALC_TIMERS);
 }
 
 
 void print_statistics(void)
 {
-    /* Display statistics. */
-
-    int word[3];
-
-    sleep(id+1);  /* let p0 and p1 sleep for different times */ /*jh*/
-    printf("\nProcess %d:\n", id);
-    printf("\tTotal data frames sent:  %9d\n", data_sent);
-    printf("\tData frames lost:        %9d\n", data_lost);
-    printf("\tData frames not lost:    %9d\n", data_not_lost);
-    printf("\tFrames retransmitted:    %9d\n", data_retransmitted);
-    printf("\tGood ack frames rec'd:   %9d\n", good_acks_recd);
-    printf("\tBad ack frames rec'd:    %9d\n\n", cksum_acks_recd);
-    
-    printf("\tGood data frames rec'd:  %9d\n", good_data_recd);
-    printf("\tBad data frames rec'd:   %9d\n", cksum_data_recd);
-    printf("\tPayloads accepted:       %9d\n", payloads_accepted);
-    printf("\tTotal ack frames sent:   %9d\n", acks_sent);
-    printf("\tAck frames lost:         %9d\n", acks_lost);
-    printf("\tAck frames not lost:     %9d\n", acks_not_lost);
-    
-    printf("\tTimeouts:                %9d\n", timeouts);
-    printf("\tAck timeouts:            %9d\n", ack_timeouts);
+    /* Display statistics.  A worker thread leaves that to the caller of
+     * dlsim_run(), which has the statistics of both workers at hand.
+     */
+
+    struct dlsim_worker *w = self;
+    struct {
+        bigint zero;
+        struct dlsim_stats stats;
+    } word;
+
+    if (w->sim->threaded) worker_exit(0);
+
+    sleep(w->id+1);  /* let p0 and p1 sleep for different times */ /*jh*/
+    print_worker_statistics(stdout, w);
+    prof_report(stdout, w->id == 0 ? "process 0" : "process 1", "protocol");
     fflush(stdin);
-    
-    word[0] = 0;
-    word[1] = payloads_accepted;
-    word[2] = data_sent;
-    write(mwfd, word, 3*sizeof(int));	/* tell main we are done printing */
+
+    word.zero = 0;
+    word.stats = w->stats;
+    close_decisions(w);
+    close_trace(w);
+    write(w->mwfd, &word, sizeof(word));	/* tell main we are done printing */
     sleep(1);
     exit(0);
 }
 
+void print_worker_statistics(FILE *f, struct dlsim_worker *w)
+{
+    struct dlsim_stats *st = &w->stats;
+
+    fprintf(f, "\nProcess %d:\n", w->id);
+    fprintf(f, "\tTotal data frames sent:  %9llu\n", st->data_sent);
+    fprintf(f, "\tData frames lost:        %9llu\n", st->data_lost);
+    fprintf(f, "\tData frames not lost:    %9llu\n", st->data_not_lost);
+    fprintf(f, "\tFrames retransmitted:    %9llu\n", st->data_retransmitted);
+    fprintf(f, "\tGood ack frames rec'd:   %9llu\n", st->good_acks_recd);
+    fprintf(f, "\tBad ack frames rec'd:    %9llu\n\n", st->cksum_acks_recd);
+
+    fprintf(f, "\tGood data frames rec'd:  %9llu\n", st->good_data_recd);
+    fprintf(f, "\tBad data frames rec'd:   %9llu\n", st->cksum_data_recd);
+    fprintf(f, "\tPayloads accepted:       %9llu\n", st->payloads_accepted);
+    fprintf(f, "\tTotal ack frames sent:   %9llu\n", st->acks_sent);
+    fprintf(f, "\tAck frames lost:         %9llu\n", st->acks_lost);
+    fprintf(f, "\tAck frames not lost:     %9llu\n", st->acks_not_lost);
+
+    fprintf(f, "\tTimeouts:                %9llu\n", st->timeouts);
+    fprintf(f, "\tAck timeouts:            %9llu\n", st->ack_timeouts);
+    if (w->sim->fec.mode != FEC_NONE) {
+        fprintf(f, "\n\tFEC parity frames sent:  %9llu\n", st->fec_parity_sent);
+        fprintf(f, "\tFEC parity frames lost:  %9llu\n", st->fec_parity_lost);
+        fprintf(f, "\tFrames rebuilt by FEC:   %9llu\n", st->fec_recovered);
+        fprintf(f, "\tFrames not rebuilt:      %9llu\n", st->fec_unrecovered);
+    }
+    if (w->traffic_out.mode != TRAFFIC_SATURATED && w->next_net_pkt > 0)
+        fprintf(f, "\n\tMean queueing delay:     %9.1f\n",
+                (double) st->queue_wait_sum / DELTA / w->next_net_pkt);
+    if (st->delays > 0) {
+        fprintf(f, "\tMean delivery delay:     %9.1f\n", (double) st->delay_sum / DELTA / st->delays);
+        fprintf(f, "\tMax delivery delay:      %9llu\n", st->delay_max / DELTA);
+    }
+}
+
+void print_links(struct dlsim *s, FILE *f)
+{
+    /* The directions of the link that options set apart. */
+
+    struct dlsim_link *l;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        l = &s->link[i];
+        if (l->loss < 0) continue;
+        fprintf(f, "Link M%d->M%d: %d%% lost, %d%% bad, delay %g events, ", i, 1 - i,
+                l->loss/10, l->garbled/10, (double) l->delay / DELTA);
+        if (l->frame_ticks > 0) fprintf(f, "%g frames per event\n", (double) DELTA / l->frame_ticks);
+        else fprintf(f, "no rate limit\n");
+    }
+}
+
+void print_link_statistics(FILE *f, const struct dlsim_stats *st0, const struct dlsim_stats *st1)
+{
+    /* The frames on each direction of the link, as its sender and its
+     * receiver counted them.  Frames neither lost nor received were still
+     * on their way at the end.
+     */
+
+    const struct dlsim_stats *st[2];
+    int i;
+
+    st[0] = st0;
+    st[1] = st1;
+    fprintf(f, "\n%-8s %10s %8s %8s %8s %10s %8s %8s %8s\n", "Link", "Data sent", "lost",
+            "bad", "good", "Acks sent", "lost", "bad", "good");
+    for (i = 0; i < 2; i++)
+        fprintf(f, "M%d->M%d   %10llu %8llu %8llu %8llu %10llu %8llu %8llu %8llu\n", i, 1 - i,
+                st[i]->data_sent, st[i]->data_lost, st[1-i]->cksum_data_recd,
+                st[1-i]->good_data_recd, st[i]->acks_sent, st[i]->acks_lost,
+                st[1-i]->cksum_acks_recd, st[1-i]->good_acks_recd);
+}
+
 void sim_error(char *s)
 {
     /* A simulator error has occurred. */
-    
-    int fd;
-    
+
     printf("%s\n", s);
-    fd = (id == 0 ? w4 : w6);
-    write(fd, &zero, TICK_SIZE);
+    if (self != NULL) {
+        write(self->mwfd, &zero, TICK_SIZE);
+        worker_exit(1);
+    }
     exit(1);
 }
 
@@ -877,7 +2568,7 @@ int parse_first_five_parameters(int argc, char *argv[], long *event, int *timeou
     /* Help function for protocol writers to parse first five command-line
      * parameters that the simulator needs.
      */
-    
+
     if (argc < 6) {
         printf("Need at least five command-line parameters.\n");
         return(0);
@@ -910,3 +2601,186 @@ int parse_first_five_parameters(int argc, char *argv[], long *event, int *timeou
     return(1);
 }
 
+int parse_simulator_options(int argc, char *argv[])
+{
+    /* Help function for protocol writers to parse the optional simulator
+     * options that follow the first five parameters.
+     */
+
+    return(dlsim_options(default_sim(), argc, argv));
+}
+
+int dlsim_options(struct dlsim *s, int argc, char *argv[])
+{
+    /* Each option has the form name=value.  The options are:
+     *   fec=xor:K     XOR parity over groups of K frames
+     *   fec=rs:K:M    Reed-Solomon, M parity frames per group of K frames
+     *   traffic=SPEC  network layer arrivals, see traffic.h
+     *   log=PREFIX    log files PREFIXM, PREFIX0 and PREFIX1; none for no logs
+     *   seed=N        seed of the random number generators
+     *   checkpoint=FILE[:N]  save the state in FILE at the end, and every N
+     *                 events if N is given
+     *   restore=FILE  start from the state saved in FILE
+     *   record=PREFIX write the random decisions to PREFIX.sched, ...
+     *   replay=PREFIX read them back instead, see record.h
+     *   ci=REL[:BATCH]  stop when the batch means are known within REL
+     *                 times their value, see batch.h
+     *   watchdog=N    stop when no payload has been accepted for N events
+     *   transport=udp[:USEC]  send the frames over loopback UDP sockets,
+     *                 with events of USEC microseconds of wall clock time
+     *                 (default 100), see udp.h; transport=pipe is the
+     *                 simulated channel
+     *   io=uring      read and write the pipes through io_uring, see
+     *                 uring.h; io=syscalls uses read() and write()
+     *   trace=PREFIX  timelines of M0 and M1 in PREFIX0.json and
+     *                 PREFIX1.json, see trace.h
+     *   link0=LOSS:CKSUM[:DELAY[:RATE]]  the frames sent by M0 are lost and
+     *                 garbled at these percentages instead of pkt_loss and
+     *                 garbled, take DELAY events to arrive, and go out at
+     *                 RATE frames per event (0 for no limit); link1= is
+     *                 the same for the frames sent by M1
+     */
+
+    int i, k, m, n;
+    unsigned int seed;
+    long every;
+    double usec, delay, rate;
+    struct dlsim_link *l;
+    char *file, *colon;
+    struct traffic t;
+
+    for (i = 0; i < argc; i++) {
+        n = -1;
+        if (sscanf(argv[i], "fec=xor:%d%n", &k, &n) == 1 && n == (int) strlen(argv[i])) {
+            if (!fec_init(&s->fec, FEC_XOR, k, 1)) {
+                printf("FEC group size must be between 1 and %d\n", FEC_MAX_K);
+                return(0);
+            }
+        } else if (sscanf(argv[i], "fec=rs:%d:%d%n", &k, &m, &n) == 2 && n == (int) strlen(argv[i])) {
+            if (!fec_init(&s->fec, FEC_RS, k, m)) {
+                printf("FEC needs 1 to %d data and 1 to %d parity frames\n",
+                       FEC_MAX_K, FEC_MAX_M);
+                return(0);
+            }
+        } else if (strncmp(argv[i], "fec=", 4) == 0) {
+            printf("Bad forward error correction: %s\n", argv[i] + 4);
+            return(0);
+        } else if (strncmp(argv[i], "traffic=", 8) == 0) {
+            for (k = 0; k < 2; k++) {	/* a trace may name a file per stream */
+                t.times = NULL;
+                m = strlen(argv[i] + 8) < sizeof(s->traffic_spec) &&
+                    traffic_setup(&t, argv[i] + 8, k);
+                free(t.times);
+                if (!m) {
+                    printf("Bad traffic generator: %s\n", argv[i] + 8);
+                    return(0);
+                }
+            }
+            strcpy(s->traffic_spec, argv[i] + 8);
+        } else if (strncmp(argv[i], "log=", 4) == 0) {
+            if (strlen(argv[i] + 4) >= sizeof(s->log_prefix)) {
+                printf("Log file prefix too long: %s\n", argv[i] + 4);
+                return(0);
+            }
+            strcpy(s->log_prefix, strcmp(argv[i] + 4, "none") == 0 ? "" : argv[i] + 4);
+        } else if (strncmp(argv[i], "link0=", 6) == 0 || strncmp(argv[i], "link1=", 6) == 0) {
+            l = &s->link[argv[i][4] - '0'];
+            delay = rate = 0;
+            n = -1;	/* where the last field read ends */
+            if (sscanf(argv[i] + 6, "%d:%d%n:%lf%n:%lf%n", &k, &m, &n, &delay, &n, &rate, &n) < 2 ||
+                n != (int) strlen(argv[i] + 6) || k < 0 || k > 99 || m < 0 || m > 99 || delay < 0 || rate < 0) {
+                printf("Bad link: %s\n", argv[i] + 6);
+                return(0);
+            }
+            l->loss = 10 * k;
+            l->garbled = 10 * m;
+            l->delay = (bigint) (delay * DELTA + 0.5);
+            l->frame_ticks = 0;
+            if (rate > 0 && (l->frame_ticks = (bigint) (DELTA / rate + 0.5)) == 0) l->frame_ticks = 1;
+        } else if (strncmp(argv[i], "trace=", 6) == 0) {
+            if (argv[i][6] == '\0' || strlen(argv[i] + 6) >= sizeof(s->trace_prefix)) {
+                printf("Bad trace prefix: %s\n", argv[i] + 6);
+                return(0);
+            }
+            strcpy(s->trace_prefix, argv[i] + 6);
+        } else if (sscanf(argv[i], "seed=%u", &seed) == 1) {
+            s->seed = s->rng = seed;
+        } else if (strncmp(argv[i], "checkpoint=", 11) == 0) {
+            file = argv[i] + 11;
+            colon = strrchr(file, ':');
+            every = 0;
+            k = strlen(file);
+            if (colon != NULL && sscanf(colon + 1, "%ld", &every) == 1) k = colon - file;
+            if (k == 0 || k >= sizeof(s->checkpoint) || every < 0) {
+                printf("Bad checkpoint option: %s\n", file);
+                return(0);
+            }
+            memcpy(s->checkpoint, file, k);
+            s->checkpoint[k] = '\0';
+            s->checkpoint_every = DELTA * every;
+        } else if (strncmp(argv[i], "restore=", 8) == 0) {
+            if (!load_checkpoint(s, argv[i] + 8)) return(0);
+        } else if (strncmp(argv[i], "ci=", 3) == 0) {
+            s->ci_batch = 1000;
+            if (sscanf(argv[i], "ci=%lf:%ld", &s->ci_rel, &s->ci_batch) < 1 ||
+                s->ci_rel <= 0 || s->ci_batch <= 0) {
+                printf("Bad confidence interval option: %s\n", argv[i] + 3);
+                s->ci_rel = 0;
+                return(0);
+            }
+        } else if (strncmp(argv[i], "watchdog=", 9) == 0) {
+            if (sscanf(argv[i] + 9, "%ld", &every) != 1 || every <= 0) {
+                printf("Bad watchdog window: %s\n", argv[i] + 9);
+                return(0);
+            }
+            s->watchdog = DELTA * every;
+        } else if (strncmp(argv[i], "record=", 7) == 0) {
+            if (strlen(argv[i] + 7) >= sizeof(s->record)) {
+                printf("Record prefix too long: %s\n", argv[i] + 7);
+                return(0);
+            }
+            strcpy(s->record, argv[i] + 7);
+        } else if (strncmp(argv[i], "replay=", 7) == 0) {
+            if (strlen(argv[i] + 7) >= sizeof(s->replay)) {
+                printf("Replay prefix too long: %s\n", argv[i] + 7);
+                return(0);
+            }
+            strcpy(s->replay, argv[i] + 7);
+        } else if (strcmp(argv[i], "io=uring") == 0) {
+            s->io_uring = 1;
+        } else if (strcmp(argv[i], "io=syscalls") == 0) {
+            s->io_uring = 0;
+        } else if (strcmp(argv[i], "transport=pipe") == 0) {
+            s->event_ns = 0;
+        } else if (strncmp(argv[i], "transport=udp", 13) == 0) {
+            usec = 100;
+            if ((argv[i][13] != '\0' && sscanf(argv[i] + 13, ":%lf", &usec) != 1) ||
+                usec * 1000 < 1) {
+                printf("Bad transport: %s\n", argv[i] + 10);
+                return(0);
+            }
+            s->event_ns = (bigint) (usec * 1000);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return(0);
+        }
+    }
+
+    /* The UDP transport has no main loop to count events, stop the run or
+     * take checkpoints.
+     */
+    if (s->event_ns > 0 && (s->checkpoint[0] != '\0' || s->restore != NULL ||
+                            s->ci_rel > 0 || s->watchdog > 0)) {
+        printf("transport=udp cannot be combined with checkpoint=, restore=, ci= or watchdog=\n");
+        return(0);
+    }
+
+    /* On the UDP transport, the kernel's network path sets delay and rate. */
+    for (i = 0; i < 2; i++) {
+        if (s->event_ns > 0 && (s->link[i].delay > 0 || s->link[i].frame_ticks > 0)) {
+            printf("transport=udp takes no link delay or rate\n");
+            return(0);
+        }
+    }
+    return(1);
+}
@@ -9,33 +9,257 @@ typedef enum {
     ack_timeout
 } event_type;
 
+#include <pthread.h>
 #include "protocol.h"
-typedef unsigned long bigint;	/* bigint integer type available */
+#include "dlsim.h"
+#include "fec.h"
+#include "traffic.h"
+#include "record.h"
+#include "batch.h"
+#include "udp.h"
+#include "uring.h"
+#include "trace.h"
+typedef unsigned long long bigint;	/* 64-bit ticks, also in a 32-bit build */
+
+/* Frames travel between the workers inside a wire record, so that the layers
+ * below the protocol (e.g. forward error correction) can add a header of
+ * their own. The protocols only ever see the frame.
+ */
+typedef struct {
+    unsigned int group;		/* FEC group the frame belongs to; without FEC,
+                                 * the number of the frame among those its
+                                 * sender sent, for traces */
+    unsigned int index;		/* position in the group; >= k for parity */
+    unsigned int size;		/* in a parity block, the number of frames in
+                                 * the group: k, or fewer if it was sent
+                                 * before it was full */
+    bigint due;			/* tick at which it reaches the peer, 0 for
+                                 * at once */
+    frame f;			/* the frame itself, or a parity block */
+} wire;
 
 /* General constants */
-#define TICK_SIZE (sizeof(tick))
+#define TICK_SIZE (sizeof(bigint))
 #define DELTA 10		/* must be greater than NR_TIMERS so each
                          * timer can go off at a separate tick.
                         */
+#define NR_TIMERS 8             /* number of timers; this should be greater
+than half the number of sequence numbers. */
+#define MAX_QUEUE 1000            /* max number of buffered frames */
+#define NO_TIMER 0		/* value of a timer that is not running */
+#define FEC_HOLDOFF 5		/* events a partly filled FEC group waits
+                                 * for more frames once the sender is idle */
 
 /* Reply codes sent by workers back to main. */
 #define OK      1		/* normal response */
 #define NOTHING 2		/* worker did nothing */
 
-/* Simulation parameters. */
-bigint timeout_interval;	/* timeout interval in ticks */
-int pkt_loss;			/* controls packet loss rate: 0 to 990 */
-int garbled;			/* control cksum error rate: 0 to 990 */
-int debug_flags;		/* debug flags */
-void (*proc1)(void);
-void (*proc2)(void);
+/* With batch means or the watchdog on (options ci= and watchdog=), a reply
+ * also tells main what the worker did since its previous reply.
+ */
+#define REPLY_CODE(r)     ((r) & 0xFF)		/* OK or NOTHING */
+#define REPLY_ACCEPTED(r) (((r) >> 8) & 0xFFF)	/* payloads accepted */
+#define REPLY_SENT(r)     (((r) >> 20) & 0xFFF)	/* data frames sent */
+#define REPLY_DELAYS(r)   (((r) >> 32) & 0xFF)	/* delivery delays measured */
+#define REPLY_DELAY(r)    ((r) >> 40)		/* their sum in ticks */
+
+/* What an operation on the io_uring backend was for. */
+#define RING_FRAMES_IN 1	/* read of frames from the peer */
+#define RING_FRAME_OUT 2	/* write of a frame to the peer */
+#define RING_REPLY     3	/* reply to main */
+#define RING_GO_AHEAD  4	/* go-ahead from main */
+#define RING_TX 64		/* max frames written per system call */
+#define RX_IDLE      0		/* no read of frames in flight */
+#define RX_IN_FLIGHT 1		/* waiting for frames */
+#define RX_DONE      2		/* frames read, not yet queued */
+
+/* A go-ahead that asks the worker for its state instead of running it. */
+#define CHECKPOINT (~(bigint) 0)
+#define MAX_VARS 16		/* max number of protocol variables saved */
+
+/* A protocol variable that checkpoints save. */
+struct checkpoint_var {
+    void *addr;
+    unsigned int size;
+};
+
+/* One direction of the link, the frames sent by M0 (link[0]) or by M1
+ * (link[1]).  The option linkN= sets it apart from the common parameters.
+ */
+struct dlsim_link {
+    int loss;			/* like pkt_loss, -1 for pkt_loss */
+    int garbled;		/* like garbled, -1 for garbled */
+    bigint delay;		/* ticks a frame takes to reach the peer */
+    bigint frame_ticks;		/* ticks to send one frame, 0 for no limit */
+};
+
+/* One end of the link, M0 or M1.  A forked worker process uses one of these,
+ * and so does a worker thread of libdlsim.
+ */
+struct dlsim_worker {
+    struct dlsim *sim;		/* the simulation this worker belongs to */
+    int id;			/* 0 or 1 */
+    int mrfd, mwfd;		/* fds for the go-ahead and the reply */
+    int prfd, pwfd;		/* fds for frames from and to the peer */
+    int status;			/* exit status of a worker thread */
+
+    /* Status variables. */
+    bigint ack_timer[NR_TIMERS];	/* ack timers */
+    unsigned int seqs[NR_TIMERS];	/* last sequence number sent per timer */
+    bigint lowest_timer;		/* lowest of the timers */
+    bigint aux_timer;		/* value of the auxiliary timer */
+    int network_layer_status;	/* 0 is disabled, 1 is enabled */
+    unsigned int next_net_pkt;	/* seq of next network packet to fetch */
+    unsigned int last_pkt_given;	/* seq of last pkt delivered*/
+    frame last_frame;		/* arrive frames are kept here */
+    int offset;			/* to prevent multiple timeouts on same tick*/
+    bigint tick;		/* current time */
+    int retransmitting;		/* flag that is set on a timeout */
+    unsigned int nseqs;		/* must be MAX_SEQ + 1 after startup */
+    unsigned int oldest_frame;	/* tells which frame timed out */
+    unsigned int tx_serial;	/* number of the next frame we send */
+    unsigned int rx_serial;	/* number the peer gave the frame in last_frame */
+    bigint link_free;		/* when our link has sent the frames given to it */
+    bigint due;			/* when the frame being sent reaches the peer */
+    unsigned int rng;		/* state of the loss and garbling generator */
+    dlsim_count told_accepted;	/* payloads_accepted as last told to main */
+    dlsim_count told_sent;	/* data_sent as last told to main */
+    dlsim_count told_delays;	/* delays as last told to main */
+    dlsim_count told_delay_sum;	/* delay_sum as last told to main */
+    struct dlsim_stats stats;	/* statistics */
+
+    /* Incoming frames are buffered here for later processing. */
+    wire queue[MAX_QUEUE];	/* buffered incoming frames */
+    wire *inp;			/* where to put the next frame */
+    wire *outp;			/* where to remove the next frame from */
+    int nframes;		/* number of queued frames */
+
+    /* Forward error correction.  The sender keeps the frames of the group
+     * being filled; the receiver keeps the blocks of the group being
+     * received.
+     */
+    frame fec_tx[FEC_MAX_K];	/* frames of the outgoing group */
+    int fec_tx_n;		/* number of frames in fec_tx */
+    unsigned int fec_tx_group;	/* number of the outgoing group */
+    bigint fec_tx_last;		/* tick the last frame joined the group */
+    frame fec_rx[FEC_MAX_K + FEC_MAX_M];	/* blocks of the incoming group */
+    int fec_rx_present[FEC_MAX_K + FEC_MAX_M];	/* which blocks have arrived */
+    unsigned int fec_rx_group;	/* number of the incoming group */
+    int fec_rx_next;		/* next frame of the group to pass on */
+    int fec_rx_size;		/* frames in the incoming group, k until a
+                                 * parity block says fewer */
+    wire fec_in[MAX_QUEUE];	/* records read from the pipe */
+
+    /* Network layer traffic.  The receiver runs a copy of the sender's
+     * generator to know when each packet it accepts was enqueued.
+     */
+    struct traffic traffic_out;	/* arrivals of the packets we send */
+    struct traffic traffic_in;	/* arrivals of the packets the peer sends */
+    bigint next_arrival;	/* tick at which our next packet arrives */
+    int traffic_ended;		/* our generator has no more packets */
+
+    /* Checkpoints.  A restored worker keeps the saved values of the protocol
+     * variables until the protocol has registered them.
+     */
+    struct checkpoint_var vars[MAX_VARS];	/* protocol variables */
+    int nvars;			/* number of protocol variables */
+    bigint reply;		/* first reply to main */
+    const unsigned char *restore_vars;	/* saved values, NULL if none */
+    const unsigned char *restore_end;	/* end of the saved values */
+
+    struct bitstream lost;	/* recorded losses of the frames we send */
+    struct bitstream garbled;	/* recorded garbling of the frames we get */
+    struct udp_link udp;	/* our end of the UDP transport */
+
+    /* The io_uring backend.  A read of frames from the peer is always in
+     * flight; the frames written during an event wait in ring_tx until
+     * the reply after them has gone out.
+     */
+    struct uring ring;		/* fd is -1 without io_uring */
+    int ring_fixed;		/* queue[], fec_in[] and ring_tx[] are registered */
+    wire ring_tx[RING_TX];	/* frames being written */
+    int ring_ntx;		/* number of frames in ring_tx */
+    int ring_busy;		/* writes and reads in flight, but the frames in */
+    int ring_failed;		/* a write or read failed */
+    bigint ring_reply;		/* reply being written */
+    bigint ring_go_ahead;	/* go-ahead being read */
+    int rx_state;		/* RX_IDLE, RX_IN_FLIGHT or RX_DONE */
+    int rx_len;			/* bytes the read of frames asked for */
+    int rx_res;			/* result of the completed read of frames */
+    FILE *flog;			/* log file, NULL if logging is off */
+    FILE *ftrace;		/* trace, NULL if tracing is off */
+    int trace_sends;		/* frames sent during the current event */
+    int trace_queue;		/* queue depth last traced */
+    int trace_window;		/* timers running last traced */
+};
+
+/* One simulation: its parameters, the pipes, main and the two workers. */
+struct dlsim {
+    /* Simulation parameters. */
+    bigint timeout_interval;	/* timeout interval in ticks */
+    int pkt_loss;		/* controls packet loss rate: 0 to 990 */
+    int garbled;		/* control cksum error rate: 0 to 990 */
+    struct dlsim_link link[2];	/* the two directions of the link */
+    int debug_flags;		/* debug flags */
+    struct fec_code fec;	/* forward error correction, off by default */
+    char traffic_spec[256];	/* traffic generator, "" is saturated */
+    char log_prefix[64];	/* log file names, "" turns logging off */
+    char trace_prefix[64];	/* trace file names, "" for no traces */
+    char record[64];		/* prefix of the decisions recorded, or "" */
+    char replay[64];		/* prefix of the decisions replayed, or "" */
+    double ci_rel;		/* stop at this relative CI half width, 0 for never */
+    long ci_batch;		/* events per batch */
+    bigint event_ns;		/* wall clock nanoseconds per event on the UDP
+                                 * transport, 0 for the simulated channel */
+    int io_uring;		/* use io_uring for the pipes if there is one */
+    bigint watchdog;		/* ticks without an accepted payload that end
+                                 * the run, 0 for never */
+    unsigned int seed;		/* seed of the random number generators */
+    unsigned int nseqs;		/* number of sequence numbers */
+    char checkpoint[256];	/* checkpoint file, "" for none */
+    bigint checkpoint_every;	/* ticks between checkpoints, 0 for at the end only */
+    unsigned char *restore;	/* checkpoint to start from, NULL if none */
+    long restore_len;		/* its size */
+    void (*proc1)(void);
+    void (*proc2)(void);
+    const int *event_map;	/* events as the protocol numbers them */
+    int threaded;		/* workers are threads, not processes */
 
-/* File descriptors for pipes. */
-int r1, w1, r2, w2, r3, w3, r4, w4, r5, w5, r6, w6;
+    /* File descriptors for pipes. */
+    int r1, w1, r2, w2, r3, w3, r4, w4, r5, w5, r6, w6;
+    int udp_fd[2];		/* sockets of M0 and M1 on the UDP transport */
 
-/* Filled in by main to tell each worker its id. */
-int id;				/* 0 or 1 */
+    /* State of main. */
+    bigint tick;		/* the current time, measured in events */
+    bigint last_tick;		/* when to stop the simulation */
+    bigint start_ns;		/* wall clock at the start, on the UDP transport */
+    bigint hanging[2];		/* # times a process has done nothing */
+    unsigned int rng;		/* state of the scheduling generator */
+    struct uring ring;		/* io_uring of main, fd -1 if none */
+    bigint ring_reply;		/* reply being read */
+    bigint ring_go_ahead;	/* go-ahead being written */
+    int ring_pending;		/* a go-ahead waits to be submitted */
+    struct bitstream sched;	/* recorded choices of the process to run */
+    struct batch_means batch;	/* batch means, if ci_rel > 0 */
+    int converged;		/* the run stopped on the batch means */
+    bigint progress_tick;	/* when a payload was last accepted */
+    dlsim_count stalled_runs[2];	/* go-aheads given to M0 and M1 since then */
+    dlsim_count stalled_idle[2];	/* those in which they did nothing */
+    dlsim_count stalled_sent[2];	/* data frames they sent since then */
+    int livelocked;		/* the run stopped on the watchdog */
+    FILE *flog;			/* log file of main */
+    dlsim_count syscalls;	/* pipe reads and writes and log flushes of main */
+    dlsim_count log_bytes;	/* size of the log file of main */
+    pthread_t thread[2];	/* worker threads */
 
-bigint zero;
+    struct dlsim_worker worker[2];	/* M0 and M1 */
+};
 
-int mrfd, mwfd, prfd;
+/* For programs that drive the functions of a worker themselves, such as the
+ * micro benchmarks of bench.c: init_worker() sets up worker id of s, and
+ * set_worker() makes w the worker that the functions of protocol.h and
+ * queue_frames() act on in the calling thread.
+ */
+void init_worker(struct dlsim *s, int id);
+void set_worker(struct dlsim_worker *w);
+void queue_frames(void);
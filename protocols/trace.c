@@ -0,0 +1,45 @@
+/* Chrome trace event output of the simulator.  See trace.h. */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "trace.h"
+
+/* Each process of the link is a process of its own in the trace, so that
+ * its async timer spans and counters get tracks of their own.
+ */
+#define PID(id) ((id) + 1)
+
+FILE *trace_open(const char *prefix, int id)
+{
+    char file[256];
+    FILE *f;
+
+    if (snprintf(file, sizeof(file), "%s%d.json", prefix, id) >= (int) sizeof(file)) return(NULL);
+    if ((f = fopen(file, "w")) == NULL) return(NULL);
+    fprintf(f, "[\n");
+    fprintf(f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"M%d\"}},\n",
+            PID(id), id);
+    fprintf(f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"events\"}},\n",
+            PID(id), PID(id));
+    return(f);
+}
+
+void trace_event(FILE *f, int id, char ph, const char *name, unsigned long long ts,
+                 const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(f, "{\"ph\":\"%c\",\"name\":\"%s\",\"ts\":%llu,\"pid\":%d,\"tid\":%d",
+            ph, name, ts, PID(id), PID(id));
+    va_start(ap, fmt);
+    vfprintf(f, fmt, ap);
+    va_end(ap);
+    fprintf(f, "},\n");
+}
+
+void trace_close(FILE *f, int id)
+{
+    fprintf(f, "{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%d,\"args\":{\"sort_index\":%d}}\n]\n",
+            PID(id), id);
+    fclose(f);
+}
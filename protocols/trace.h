@@ -0,0 +1,43 @@
+/* Timelines of a simulation in the Chrome trace event format.
+ *
+ * With the option trace=PREFIX, M0 and M1 write what happens to them to
+ * PREFIX0.json and PREFIX1.json, which chrome://tracing and ui.perfetto.dev
+ * open as they are; combinetraces.sh PREFIX merges them into PREFIX.json,
+ * one timeline with both processes.  Time is the simulated clock, one tick
+ * shown as a microsecond, so each event takes 10 us.  On it:
+ *
+ *   - each event a protocol is given is a slice, named after the event, and
+ *     each frame sent is a short slice inside it ("send Data", "lost Ack");
+ *   - a flow arrow runs from each frame sent to the frame_arrival or
+ *     cksum_err event in which the peer got it; a lost frame has none,
+ *     unless forward error correction rebuilt it;
+ *   - each frame timer, and the ack timer, is an async span from the time it
+ *     is started until it is stopped or goes off;
+ *   - counter tracks show the frames queued at the receiver ("queue") and
+ *     the frame timers running ("window"), i.e. the frames outstanding.
+ *
+ * A file stays loadable when its run ends early: Chrome and Perfetto do not
+ * need the closing bracket that trace_close() writes.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* Open the trace of M0 (id 0) or M1 (id 1) and name its track.  Returns
+ * NULL if the file cannot be opened.
+ */
+FILE *trace_open(const char *prefix, int id);
+
+/* Write one event of phase ph ('X', 'b', 'C', ...) at tick ts to the trace
+ * of process id.  The JSON fields in fmt, if any, follow the common ones,
+ * so fmt starts with a comma.
+ */
+void trace_event(FILE *f, int id, char ph, const char *name, unsigned long long ts,
+                 const char *fmt, ...);
+
+/* End the trace and close it. */
+void trace_close(FILE *f, int id);
+
+#endif
@@ -0,0 +1,139 @@
+/* Traffic generators for the network layer: Poisson, on-off and trace-driven
+ * arrivals.  See traffic.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "traffic.h"
+
+static double uniform(struct traffic *t)
+{
+    /* Return a uniform random number in (0, 1] from the stream's own
+     * xorshift64* generator, so that generators never disturb rand().
+     */
+
+    unsigned long long x = t->rng;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t->rng = x;
+    return ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0)
+           + (1.0 / 9007199254740992.0);
+}
+
+static double exponential(struct traffic *t, double mean)
+{
+    return -mean * log(uniform(t));
+}
+
+static int load_trace(struct traffic *t, const char *file)
+{
+    /* Read the arrival times, one per line, which must not decrease.  Blank
+     * lines are skipped; any other line that is not a number fails.
+     */
+
+    FILE *f;
+    char line[256];
+    double x, last = 0;
+    long size = 0, lineno = 0;
+    int n;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        printf("Cannot open traffic trace %s\n", file);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        n = -1;
+        if (sscanf(line, " %n", &n) == 0 && line[n] == '\0') continue;
+        n = -1;
+        if (sscanf(line, "%lf %n", &x, &n) != 1 || n < 0 || line[n] != '\0') {
+            printf("Traffic trace %s, line %ld: not an arrival time\n", file, lineno);
+            fclose(f);
+            return 0;
+        }
+        if (x < last) {
+            printf("Traffic trace %s, line %ld: not in time order\n", file, lineno);
+            fclose(f);
+            return 0;
+        }
+        if (t->ntimes == size) {
+            size = (size == 0 ? 1024 : 2 * size);
+            t->times = realloc(t->times, size * sizeof(double));
+            if (t->times == NULL) {
+                printf("Out of memory reading %s\n", file);
+                fclose(f);
+                return 0;
+            }
+        }
+        t->times[t->ntimes++] = last = x;
+    }
+    fclose(f);
+    return 1;
+}
+
+int traffic_setup(struct traffic *t, const char *spec, int stream)
+{
+    char file[256], *comma;
+    int n = -1;			/* characters sscanf() matched, if all */
+
+    memset(t, 0, sizeof(*t));
+    t->rng = 0x9E3779B97F4A7C15ULL * (stream + 1);
+
+    if (spec == NULL || strcmp(spec, "saturated") == 0) {
+        t->mode = TRAFFIC_SATURATED;
+        return 1;
+    }
+    if (sscanf(spec, "poisson:%lf%n", &t->rate, &n) == 1 && n == (int) strlen(spec)) {
+        t->mode = TRAFFIC_POISSON;
+        return t->rate > 0;
+    }
+    if (sscanf(spec, "onoff:%lf:%lf:%lf%n", &t->rate, &t->on_mean, &t->off_mean, &n) == 3 &&
+        n == (int) strlen(spec)) {
+        t->mode = TRAFFIC_ONOFF;
+        t->on_end = exponential(t, t->on_mean);
+        return t->rate > 0 && t->on_mean > 0 && t->off_mean >= 0;
+    }
+    if (strncmp(spec, "trace:", 6) == 0 && strlen(spec + 6) < sizeof(file)) {
+        t->mode = TRAFFIC_TRACE;
+        strcpy(file, spec + 6);
+        comma = strchr(file, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+            if (stream == 1) return load_trace(t, comma + 1);
+        }
+        return load_trace(t, file);
+    }
+    return 0;
+}
+
+double traffic_next(struct traffic *t)
+{
+    switch (t->mode) {
+        case TRAFFIC_POISSON:
+            t->now += exponential(t, 1.0 / t->rate);
+            break;
+
+        case TRAFFIC_ONOFF:
+            /* An arrival that falls past the end of the on period is dropped;
+             * by memorylessness the next one is drawn fresh after the off
+             * period.
+             */
+            t->now += exponential(t, 1.0 / t->rate);
+            while (t->now > t->on_end) {
+                t->now = t->on_end + exponential(t, t->off_mean);
+                t->on_end = t->now + exponential(t, t->on_mean);
+                t->now += exponential(t, 1.0 / t->rate);
+            }
+            break;
+
+        case TRAFFIC_TRACE:
+            if (t->next == t->ntimes) return -1;
+            t->now = t->times[t->next++];
+            break;
+    }
+    return t->now;
+}
@@ -0,0 +1,49 @@
+/* Traffic generators for the network layer.
+ *
+ * By default the network layer always has a packet ready, so the offered
+ * load is saturated. A traffic generator instead decides when each packet
+ * arrives from above:
+ *   poisson:RATE           Poisson arrivals, RATE packets per event
+ *   onoff:RATE:ON:OFF      bursts of Poisson arrivals at RATE, with on and off
+ *                          periods of exponential length, means ON and OFF
+ *                          events
+ *   trace:FILE[,FILE1]     arrival times (in events, one per line) replayed
+ *                          from FILE; M1 uses FILE1 if it is given
+ *
+ * A generator is deterministic for a given stream number, so the receiver
+ * can run a copy of the sender's generator to learn when each packet it is
+ * handed was enqueued.
+ */
+
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#define TRAFFIC_SATURATED 0	/* a packet is always ready */
+#define TRAFFIC_POISSON   1	/* Poisson arrivals */
+#define TRAFFIC_ONOFF     2	/* on-off bursts */
+#define TRAFFIC_TRACE     3	/* arrival times from a file */
+
+struct traffic {
+    int mode;			/* one of the TRAFFIC_ values above */
+    double rate;		/* arrivals per event while on */
+    double on_mean;		/* mean length of an on period in events */
+    double off_mean;		/* mean length of an off period in events */
+    double now;			/* arrival time of the last packet */
+    double on_end;		/* end of the current on period */
+    unsigned long long rng;	/* xorshift state, never zero */
+    double *times;		/* trace: arrival times */
+    long ntimes;		/* trace: number of arrival times */
+    long next;			/* trace: index of the next arrival */
+};
+
+/* Set up generator t from a specification (the part after "traffic=") for
+ * stream 0 (M0) or 1 (M1). Returns 0 if the specification is invalid.
+ */
+int traffic_setup(struct traffic *t, const char *spec, int stream);
+
+/* Return the arrival time, in events, of the next packet of the stream, or
+ * -1 if the stream has ended (only a trace can end).
+ */
+double traffic_next(struct traffic *t);
+
+#endif
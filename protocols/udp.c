@@ -0,0 +1,184 @@
+/* UDP loopback transport for the frames between M0 and M1.  See udp.h.
+ * sendmmsg(), recvmmsg() and ppoll() are Linux calls; elsewhere the
+ * records go one send() or recv() each, and poll() waits.
+ */
+
+#define _GNU_SOURCE		/* sendmmsg(), recvmmsg() and ppoll() */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "udp.h"
+
+int udp_pair(int fd[2])
+{
+    struct sockaddr_in a[2];
+    socklen_t len;
+    int i, size = UDP_BUFFER, ok = 1;
+
+    fd[0] = fd[1] = -1;
+    for (i = 0; i < 2 && ok; i++) {
+        memset(&a[i], 0, sizeof(a[i]));
+        a[i].sin_family = AF_INET;
+        a[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(a[i]);
+        ok = ((fd[i] = socket(AF_INET, SOCK_DGRAM, 0)) >= 0 &&
+              bind(fd[i], (struct sockaddr *) &a[i], sizeof(a[i])) == 0 &&
+              getsockname(fd[i], (struct sockaddr *) &a[i], &len) == 0);
+        if (ok) setsockopt(fd[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    ok = ok && connect(fd[0], (struct sockaddr *) &a[1], sizeof(a[1])) == 0 &&
+         connect(fd[1], (struct sockaddr *) &a[0], sizeof(a[0])) == 0;
+    if (!ok) {
+        for (i = 0; i < 2; i++) if (fd[i] >= 0) close(fd[i]);
+        fd[0] = fd[1] = -1;
+    }
+    return(ok);
+}
+
+int udp_init(struct udp_link *u, int fd, unsigned int len)
+{
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+    u->len = len;
+    return(len <= UDP_MAX_RECORD);
+}
+
+int udp_send(struct udp_link *u, const void *rec, unsigned long long *calls)
+{
+    memcpy(u->tx[u->ntx++], rec, u->len);
+    return(u->ntx < UDP_BATCH ? 1 : udp_flush(u, calls));
+}
+
+#ifdef __linux__
+
+int udp_flush(struct udp_link *u, unsigned long long *calls)
+{
+    struct mmsghdr msg[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    int i, n, sent = 0;
+
+    memset(msg, 0, u->ntx * sizeof(msg[0]));
+    for (i = 0; i < u->ntx; i++) {
+        iov[i].iov_base = u->tx[i];
+        iov[i].iov_len = u->len;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (sent < u->ntx) {
+        (*calls)++;
+        n = sendmmsg(u->fd, msg + sent, u->ntx - sent, 0);
+        if (n < 0 && errno == ENOBUFS) break;	/* dropped, as on a real link */
+        if (n < 0 && errno != EINTR) return(0);
+        if (n > 0) sent += n;
+    }
+    u->ntx = 0;
+    return(1);
+}
+
+int udp_receive(struct udp_link *u, void *recs, int max, unsigned long long *calls)
+{
+    struct mmsghdr msg[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    int i, n;
+
+    if (max > UDP_BATCH) max = UDP_BATCH;
+    memset(msg, 0, max * sizeof(msg[0]));
+    for (i = 0; i < max; i++) {
+        iov[i].iov_base = (unsigned char *) recs + i * u->len;
+        iov[i].iov_len = u->len;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    (*calls)++;
+    n = recvmmsg(u->fd, msg, max, MSG_DONTWAIT, NULL);
+    if (n >= 0) return(n);
+
+    /* A refused datagram, reported late, is lost like any other. */
+    return(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+           errno == ECONNREFUSED ? 0 : -1);
+}
+
+int udp_wait(int data_fd, int control_fd, long long ns, unsigned long long *calls)
+{
+    struct pollfd p[2];
+    struct timespec ts;
+    int n;
+
+    p[0].fd = data_fd;
+    p[1].fd = control_fd;
+    p[0].events = p[1].events = POLLIN;
+    p[0].revents = p[1].revents = 0;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    (*calls)++;
+    n = ppoll(p, 2, ns < 0 ? NULL : &ts, NULL);
+    if (n < 0) return(errno == EINTR ? 0 : -1);
+    return((p[0].revents ? UDP_DATA : 0) | (p[1].revents ? UDP_CONTROL : 0));
+}
+
+#else
+
+int udp_flush(struct udp_link *u, unsigned long long *calls)
+{
+    int sent = 0;
+    ssize_t n;
+
+    while (sent < u->ntx) {
+        (*calls)++;
+        n = send(u->fd, u->tx[sent], u->len, 0);
+        if (n < 0 && errno == ENOBUFS) break;	/* dropped, as on a real link */
+        if (n < 0 && errno != EINTR) return(0);
+        if (n >= 0) sent++;
+    }
+    u->ntx = 0;
+    return(1);
+}
+
+int udp_receive(struct udp_link *u, void *recs, int max, unsigned long long *calls)
+{
+    int n;
+    ssize_t len;
+
+    if (max > UDP_BATCH) max = UDP_BATCH;
+    for (n = 0; n < max; n++) {
+        (*calls)++;
+        len = recv(u->fd, (unsigned char *) recs + n * u->len, u->len, MSG_DONTWAIT);
+        if (len >= 0) continue;
+
+        /* A refused datagram, reported late, is lost like any other. */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+            errno == ECONNREFUSED) break;
+        return(n > 0 ? n : -1);
+    }
+    return(n);
+}
+
+int udp_wait(int data_fd, int control_fd, long long ns, unsigned long long *calls)
+{
+    struct pollfd p[2];
+    int n;
+
+    p[0].fd = data_fd;
+    p[1].fd = control_fd;
+    p[0].events = p[1].events = POLLIN;
+    p[0].revents = p[1].revents = 0;
+    (*calls)++;
+    n = poll(p, 2, ns < 0 ? -1 : (int) ((ns + 999999) / 1000000));
+    if (n < 0) return(errno == EINTR ? 0 : -1);
+    return((p[0].revents ? UDP_DATA : 0) | (p[1].revents ? UDP_CONTROL : 0));
+}
+
+#endif
+
+unsigned long long udp_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
@@ -0,0 +1,68 @@
+/* A real network path for the frames between M0 and M1.
+ *
+ * With the option transport=udp, the workers exchange their frames as UDP
+ * datagrams over the loopback interface instead of through pipes, one
+ * record per datagram, and run on the wall clock instead of the ticks of
+ * main.  Records to send are collected and sent with one sendmmsg() call
+ * before the worker waits for its next event; arriving records are read
+ * with recvmmsg(), up to UDP_BATCH at a time.
+ *
+ * Loss and checksum errors are still injected by the simulator.  On top of
+ * that, the kernel drops datagrams that find the receive buffer of the
+ * peer's socket full; those count as sent and not lost, but never arrive.
+ */
+
+#ifndef UDP_H
+#define UDP_H
+
+#define UDP_BATCH      64	/* records sent or received per system call */
+#define UDP_MAX_RECORD 64	/* max size of a record */
+#define UDP_BUFFER (1 << 20)	/* receive buffer of a socket in bytes */
+
+/* What udp_wait() found readable. */
+#define UDP_DATA    1		/* the socket */
+#define UDP_CONTROL 2		/* the control descriptor */
+
+/* One end of the link: its socket and the records waiting to be sent. */
+struct udp_link {
+    int fd;			/* socket, connected to the peer */
+    unsigned int len;		/* size of a record */
+    int ntx;			/* number of records in tx */
+    unsigned char tx[UDP_BATCH][UDP_MAX_RECORD];	/* records to send */
+};
+
+/* Create two UDP sockets on the loopback interface, connected to each
+ * other.  Returns 0 on failure.
+ */
+int udp_pair(int fd[2]);
+
+/* Set up one end of the link on socket fd for records of len bytes.
+ * Returns 0 if len is too large.
+ */
+int udp_init(struct udp_link *u, int fd, unsigned int len);
+
+/* The functions below add the system calls they make to *calls. */
+
+/* Queue one record to send, and send the queue when it is full.  Returns 0
+ * if the peer is gone.
+ */
+int udp_send(struct udp_link *u, const void *rec, unsigned long long *calls);
+
+/* Send the queued records.  Returns 0 if the peer is gone. */
+int udp_flush(struct udp_link *u, unsigned long long *calls);
+
+/* Receive up to max records into recs without waiting.  Returns the number
+ * received, or -1 on an error.
+ */
+int udp_receive(struct udp_link *u, void *recs, int max, unsigned long long *calls);
+
+/* Wait at most ns nanoseconds (forever if ns < 0) until data_fd or
+ * control_fd is readable.  Returns UDP_DATA and UDP_CONTROL or'ed
+ * together, 0 on a timeout, or -1 on an error.
+ */
+int udp_wait(int data_fd, int control_fd, long long ns, unsigned long long *calls);
+
+/* The monotonic wall clock in nanoseconds. */
+unsigned long long udp_clock(void);
+
+#endif
@@ -0,0 +1,192 @@
+/* A minimal io_uring interface, on the raw system calls.  See uring.h.
+ * io_uring is Linux only; elsewhere uring_init() always fails, so the
+ * pipes are read and written directly.
+ */
+
+#ifdef __linux__
+
+#define _GNU_SOURCE		/* syscall() and MAP_POPULATE */
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+#define ENTER(u, submit, wait) \
+    syscall(__NR_io_uring_enter, (u)->fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0)
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    u->taskrun_flag = 1;
+    if ((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));	/* a kernel before 5.19 */
+        u->taskrun_flag = 0;
+        u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (u->fd < 0) return(0);
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+    u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) u->cq_map = u->sq_map;
+    else u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+        close(u->fd);
+        u->fd = -1;
+        return(0);
+    }
+
+    sq = u->sq_map;
+    cq = u->cq_map;
+    u->entries = p.sq_entries;
+    u->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned int *) (sq + p.sq_off.flags);
+    u->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    u->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    u->cqes = cq + p.cq_off.cqes;
+    u->tail = u->submitted = *u->sq_tail;
+    return(1);
+}
+
+void uring_exit(struct uring *u)
+{
+    if (u->fd < 0) return;
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_map != u->sq_map) munmap(u->cq_map, u->cq_len);
+    munmap(u->sq_map, u->sq_len);
+    close(u->fd);
+    u->fd = -1;
+}
+
+int uring_register(struct uring *u, const void *iov, unsigned int n)
+{
+    return(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, n) == 0);
+}
+
+int uring_queue(struct uring *u, int op, int fd, void *buf, unsigned int len,
+                int buf_index, int link, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int i;
+
+    if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->entries) return(0);
+    i = u->tail & *u->sq_mask;
+    sqe = (struct io_uring_sqe *) u->sqes + i;
+    memset(sqe, 0, sizeof(*sqe));
+    if (op == URING_READ) sqe->opcode = (buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    else sqe->opcode = (buf_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = (unsigned long long) -1;	/* pipes have no offset */
+    sqe->buf_index = (buf_index >= 0 ? buf_index : 0);
+    sqe->flags = (link ? IOSQE_IO_LINK : 0);
+    sqe->user_data = data;
+    u->sq_array[i] = i;
+    u->tail++;
+    return(1);
+}
+
+void uring_unlink(struct uring *u)
+{
+    if (u->tail != u->submitted)
+        ((struct io_uring_sqe *) u->sqes + ((u->tail - 1) & *u->sq_mask))->flags &= ~IOSQE_IO_LINK;
+}
+
+int uring_submit(struct uring *u, unsigned int wait, unsigned long long *calls)
+{
+    long n;
+
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+    (*calls)++;
+    n = ENTER(u, u->tail - u->submitted, wait);
+    if (n < 0) return(errno == EINTR);	/* the caller waits again */
+    u->submitted += n;
+    return(1);
+}
+
+int uring_poll(struct uring *u, unsigned long long *calls)
+{
+    if (u->taskrun_flag &&
+        !(__atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_TASKRUN)) return(1);
+    return(uring_submit(u, 0, calls));
+}
+
+int uring_complete(struct uring *u, unsigned long long *data, int *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return(0);
+    cqe = (struct io_uring_cqe *) u->cqes + (head & *u->cq_mask);
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return(1);
+}
+
+#else
+
+#include <string.h>
+#include "uring.h"
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+    return(0);
+}
+
+void uring_exit(struct uring *u)
+{
+}
+
+int uring_register(struct uring *u, const void *iov, unsigned int n)
+{
+    return(0);
+}
+
+int uring_queue(struct uring *u, int op, int fd, void *buf, unsigned int len,
+                int buf_index, int link, unsigned long long data)
+{
+    return(0);
+}
+
+void uring_unlink(struct uring *u)
+{
+}
+
+int uring_submit(struct uring *u, unsigned int wait, unsigned long long *calls)
+{
+    return(0);
+}
+
+int uring_poll(struct uring *u, unsigned long long *calls)
+{
+    return(0);
+}
+
+int uring_complete(struct uring *u, unsigned long long *data, int *res)
+{
+    return(0);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/* A minimal io_uring interface for the pipes of the simulator.
+ *
+ * With the option io=uring, main and the workers read and write their pipes
+ * through an io_uring instead of with read() and write(): the operations of
+ * a step are queued and submitted together, and their completions reaped
+ * from the completion ring, so that e.g. a worker writes its frames and its
+ * reply and waits for the next go-ahead in a single system call.  The ring
+ * is set up with the raw system calls, so liburing is not needed.
+ *
+ * When the kernel has no io_uring, uring_init() fails and the caller keeps
+ * using read() and write(); the pipe semantics are the same either way.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+/* Operations for uring_queue(). */
+#define URING_READ  0
+#define URING_WRITE 1
+
+struct uring {
+    int fd;			/* the ring, -1 if none */
+    int taskrun_flag;		/* the kernel flags pending completion work */
+    unsigned int entries;	/* size of the submission ring */
+    unsigned int tail;		/* our tail of the submission ring */
+    unsigned int submitted;	/* how far the kernel has taken it */
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    void *sqes;			/* submission queue entries */
+    void *cqes;			/* completion queue entries */
+    void *sq_map, *cq_map;	/* the mapped rings */
+    size_t sq_len, cq_len, sqes_len;
+};
+
+/* Set up a ring with room for entries operations.  Returns 0 if io_uring
+ * is not available; u->fd is then -1.
+ */
+int uring_init(struct uring *u, unsigned int entries);
+
+/* Tear the ring down, cancelling what is still in flight. */
+void uring_exit(struct uring *u);
+
+/* Register n buffers for fixed reads and writes.  Returns 0 on failure,
+ * e.g. when they exceed the locked memory limit.
+ */
+int uring_register(struct uring *u, const void *iov, unsigned int n);
+
+/* Queue a read or write of len bytes of fd at buf.  Buf must lie in the
+ * registered buffer buf_index, or buf_index be -1.  With link set, the next
+ * operation queued only starts when this one has completed.  Data comes
+ * back with the completion.  Returns 0 if the ring is full.
+ */
+int uring_queue(struct uring *u, int op, int fd, void *buf, unsigned int len,
+                int buf_index, int link, unsigned long long data);
+
+/* Make the last operation queued the end of its chain of links. */
+void uring_unlink(struct uring *u);
+
+/* Submit what was queued and wait until at least wait operations have
+ * completed, counting the system call in *calls.  Returns 0 on an error.
+ */
+int uring_submit(struct uring *u, unsigned int wait, unsigned long long *calls);
+
+/* Let the kernel finish completions that wait for this thread, if there
+ * are any.  Returns 0 on an error.
+ */
+int uring_poll(struct uring *u, unsigned long long *calls);
+
+/* Take the next completion: its data and result (bytes or -errno).
+ * Returns 0 if there is none.
+ */
+int uring_complete(struct uring *u, unsigned long long *data, int *res);
+
+#endif